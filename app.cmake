@@ -0,0 +1,59 @@
+# Application sources and build settings, except src/main.c. Shared by
+# this application's CMakeLists.txt and by the test suites which link
+# the application itself (tests/perf); set APP_DIR to the application
+# directory, or include tests/test_app.cmake, before including it.
+
+# Application "library" build configuration. TODO: move these out of this tree.
+target_sources(app PRIVATE ${APP_DIR}/src/lib/product_id.c)
+target_sources(app PRIVATE ${APP_DIR}/src/lib/lwm2m_credentials.c)
+
+# Application build configuration.
+target_include_directories(app PRIVATE $ENV{ZEPHYR_BASE}/subsys/testsuite/include/)
+target_include_directories(app PRIVATE ${APP_DIR}/src/lib)
+target_include_directories(app PRIVATE ${APP_DIR}/src)
+
+target_sources(app PRIVATE ${APP_DIR}/src/app.c)
+target_sources(app PRIVATE ${APP_DIR}/src/app_work_queue.c)
+target_sources(app PRIVATE ${APP_DIR}/src/lwm2m.c)
+target_sources(app PRIVATE ${APP_DIR}/src/lwm2m_servers.c)
+target_sources(app PRIVATE ${APP_DIR}/src/coap_rto.c)
+target_sources(app PRIVATE ${APP_DIR}/src/settings.c)
+target_sources(app PRIVATE ${APP_DIR}/src/fw_writer.c)
+target_sources(app PRIVATE ${APP_DIR}/src/light_control.c)
+target_sources(app PRIVATE ${APP_DIR}/src/obs_sched.c)
+target_sources(app PRIVATE ${APP_DIR}/src/sensors.c)
+target_sources_ifdef(CONFIG_NET_L2_BT        app PRIVATE ${APP_DIR}/src/bluetooth.c)
+target_sources_ifdef(CONFIG_FOTA_MCAST_GROUP app PRIVATE ${APP_DIR}/src/mcast_group.c)
+target_sources_ifdef(CONFIG_FOTA_DIAG        app PRIVATE ${APP_DIR}/src/mem_stats.c)
+target_sources_ifdef(CONFIG_FOTA_DIAG        app PRIVATE ${APP_DIR}/src/diag.c)
+target_sources_ifdef(CONFIG_FOTA_CPU_STATS   app PRIVATE ${APP_DIR}/src/cpu_stats.c)
+target_sources_ifdef(CONFIG_FOTA_LOG_RING    app PRIVATE ${APP_DIR}/src/log_ring.c)
+
+# Network pool allocation failures are counted by wrapping the
+# allocators the network stack calls, see src/mem_stats.c.
+if(CONFIG_FOTA_DIAG AND CONFIG_NETWORKING)
+  zephyr_ld_options(-Wl,--wrap=k_mem_slab_alloc)
+  if(NOT CONFIG_NET_BUF_LOG)
+    zephyr_ld_options(-Wl,--wrap=net_buf_alloc_fixed)
+    zephyr_ld_options(-Wl,--wrap=net_buf_alloc_len)
+  endif()
+endif()
+
+# CPU usage is accounted in the kernel's context switch tracing hooks,
+# see src/cpu_stats.c.
+if(CONFIG_FOTA_CPU_STATS)
+  zephyr_ld_options(-Wl,--wrap=sys_trace_thread_switched_in)
+  zephyr_ld_options(-Wl,--wrap=sys_trace_thread_switched_out)
+endif()
+
+# The LwM2M engine's requests to the server are timed and paced with
+# the server's RTO estimate, see src/lwm2m_servers.c.
+zephyr_ld_options(-Wl,--wrap=coap_pending_init)
+zephyr_ld_options(-Wl,--wrap=coap_pending_cycle)
+zephyr_ld_options(-Wl,--wrap=coap_pending_received)
+
+# The diagnostics and log ring objects use the LwM2M engine's internal
+# object API.
+target_include_directories(app PRIVATE $ENV{ZEPHYR_BASE}/subsys/net/lib/lwm2m)
+
+target_link_libraries_ifdef(CONFIG_MBEDTLS app PRIVATE mbedTLS)
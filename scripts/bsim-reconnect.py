@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""BLE reconnect test under BabbleSim.
+
+Runs the nrf52_bsim build of the application next to the test central
+of tests/bsim_reconnect, on a simulated 2.4 GHz phy. The central acts
+as the device's IPSP router and LwM2M server: once the device has
+registered, it drops the BLE link a few times, restores it, and checks
+that the device registers again each time. The test passes when the
+central exits with 0.
+
+Build both images first, with BabbleSim installed and BSIM_OUT_PATH and
+BSIM_COMPONENTS_PATH set:
+    west build -b nrf52_bsim -d build-bsim -- \\
+        -DOVERLAY_CONFIG=tests/bsim_reconnect/device.conf
+    west build -b nrf52_bsim -d build-bsim-central \\
+        tests/bsim_reconnect/central
+    ./scripts/bsim-reconnect.py
+
+Logs of the device, the central and the phy are kept in --log-dir."""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+DEVICE_EXE = 'build-bsim/zephyr/zephyr.exe'
+CENTRAL_EXE = 'build-bsim-central/zephyr/zephyr.exe'
+
+# Simulated time, in seconds, after which the phy ends the simulation
+SIM_LENGTH = 600
+
+
+def start(cmd, log_dir, name):
+    log = open(os.path.join(log_dir, '%s.log' % name), 'w')
+    return subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+
+
+def stop(proc):
+    if proc.poll() is None:
+        proc.terminate()
+        try:
+            proc.wait(5)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-d', '--device', default=DEVICE_EXE,
+                        help='nrf52_bsim build of the application')
+    parser.add_argument('-c', '--central', default=CENTRAL_EXE,
+                        help='nrf52_bsim build of the test central')
+    parser.add_argument('-s', '--sim-id', default='fota_reconnect',
+                        help='BabbleSim simulation ID')
+    parser.add_argument('-t', '--timeout', type=int, default=600,
+                        help='wall clock seconds before giving up')
+    parser.add_argument('--log-dir', default='bsim-reconnect-logs')
+    args = parser.parse_args()
+
+    bsim_out = os.environ.get('BSIM_OUT_PATH')
+    if not bsim_out:
+        parser.error('BSIM_OUT_PATH is not set')
+    for exe in (args.device, args.central):
+        if not os.access(exe, os.X_OK):
+            parser.error('%s: not found, see --help to build it' % exe)
+    os.makedirs(args.log_dir, exist_ok=True)
+
+    sim = ['-s=%s' % args.sim_id]
+    phy = start([os.path.join(bsim_out, 'bin', 'bs_2G4_phy_v1')] + sim +
+                ['-D=2', '-sim_length=%d' % (SIM_LENGTH * 1000000)],
+                args.log_dir, 'phy')
+    device = start([os.path.abspath(args.device)] + sim + ['-d=0'],
+                   args.log_dir, 'device')
+    central = start([os.path.abspath(args.central)] + sim + ['-d=1'],
+                    args.log_dir, 'central')
+
+    try:
+        status = central.wait(args.timeout)
+    except subprocess.TimeoutExpired:
+        print('Central still running after %d s' % args.timeout)
+        status = None
+    finally:
+        for proc in (central, device, phy):
+            stop(proc)
+
+    with open(os.path.join(args.log_dir, 'central.log')) as f:
+        for line in f:
+            if re.search(r'Loop \d+:|registered|Reconnect test', line):
+                print(line.rstrip())
+    with open(os.path.join(args.log_dir, 'device.log')) as f:
+        for line in f:
+            if 'BT LE Reconnected after' in line or 'rebooting' in line:
+                print(line.rstrip())
+
+    if status != 0:
+        print('FAILED, logs in %s' % args.log_dir)
+        sys.exit(1)
+    print('PASSED')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,378 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Caching CoAP proxy serving firmware images to many devices.
+
+Devices built with CONFIG_LWM2M_FIRMWARE_UPDATE_PULL_COAP_PROXY_SUPPORT
+(the OpenThread, IEEE 802.15.4 and BLE 6LoWPAN builds) download firmware
+through a CoAP proxy, by default coap://[fd11:22::1]:5682 on the border
+router: they send Block2 GET requests with the image URI in a Proxy-Uri
+option. A pass-through proxy fetches every block again for every device.
+This one fetches each image once, keeps it in memory (or mmaps it from
+--cache-dir, where it survives restarts) and serves every device's blocks
+from there, so the firmware server sees one download whatever the size
+of the fleet.
+
+coap:// images are fetched block-wise, http:// and https:// ones with a
+plain GET. Per-device and aggregate throughput are printed every --stats
+seconds and on exit.
+
+Example, on the border router:
+    ./coap-proxy.py -a fd11:22::1 --cache-dir /var/cache/coap-proxy"""
+
+import argparse
+import asyncio
+import collections
+import hashlib
+import mmap
+import os
+import socket
+import sys
+import time
+import urllib.parse
+import urllib.request
+
+import coaplib
+from coap_endpoint import Endpoint, ResetError
+
+UPSTREAM_BLOCK_SIZE = 1024
+
+
+class UpstreamError(Exception):
+    def __init__(self, code, message):
+        super().__init__(message)
+        self.code = code
+
+
+class Image:
+    """A cached firmware image."""
+
+    def __init__(self, uri, data, mapped=None):
+        self.uri = uri
+        self.data = data
+        self.mapped = mapped
+        self.fetched = time.time()
+        self.etag = hashlib.sha256(data).digest()[:8]
+
+    def close(self):
+        if self.mapped:
+            self.data.release()
+            self.mapped.close()
+
+
+class Cache:
+    """Images by URI. Concurrent requests for an image being fetched
+    wait for that one fetch."""
+
+    def __init__(self, upstream, cache_dir, ttl):
+        self.upstream = upstream
+        self.cache_dir = cache_dir
+        self.ttl = ttl
+        self.images = {}
+        self.fetches = {}
+        self.upstream_bytes = 0
+
+    def _path(self, uri):
+        return os.path.join(self.cache_dir,
+                            hashlib.sha256(uri.encode('utf-8')).hexdigest())
+
+    def _load(self, uri):
+        if not self.cache_dir:
+            return None
+        path = self._path(uri)
+        try:
+            if time.time() - os.path.getmtime(path) > self.ttl:
+                return None
+            with open(path, 'rb') as f:
+                mapped = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        except (OSError, ValueError):
+            return None
+        image = Image(uri, memoryview(mapped), mapped)
+        image.fetched = os.path.getmtime(path)
+        return image
+
+    def _store(self, uri, data):
+        if not self.cache_dir:
+            return Image(uri, data)
+        path = self._path(uri)
+        with open(path + '.tmp', 'wb') as f:
+            f.write(data)
+        os.replace(path + '.tmp', path)
+        return self._load(uri) or Image(uri, data)
+
+    async def get(self, uri):
+        image = self.images.get(uri)
+        if image and time.time() - image.fetched <= self.ttl:
+            return image
+
+        if uri not in self.fetches:
+            self.fetches[uri] = asyncio.ensure_future(self._fetch(uri))
+        try:
+            return await asyncio.shield(self.fetches[uri])
+        finally:
+            if self.fetches.get(uri) and self.fetches[uri].done():
+                del self.fetches[uri]
+
+    async def _fetch(self, uri):
+        image = self._load(uri)
+        if image:
+            print('%s: cached in %s' % (uri, self.cache_dir))
+        else:
+            start = time.time()
+            data = await self.upstream.fetch(uri)
+            self.upstream_bytes += len(data)
+            print('%s: fetched %d bytes in %.1f s' %
+                  (uri, len(data), time.time() - start))
+            image = self._store(uri, data)
+
+        old = self.images.get(uri)
+        self.images[uri] = image
+        if old and old is not image:
+            old.close()
+        return image
+
+
+class Upstream:
+    """Fetches whole images from coap:// and http(s):// servers."""
+
+    def __init__(self, endpoint, timeout):
+        self.endpoint = endpoint
+        self.timeout = timeout
+
+    async def fetch(self, uri):
+        scheme = urllib.parse.urlsplit(uri).scheme
+        if scheme == 'coap':
+            coro = self._fetch_coap(uri)
+        elif scheme in ('http', 'https'):
+            loop = asyncio.get_event_loop()
+            coro = loop.run_in_executor(None, self._fetch_http, uri)
+        else:
+            raise UpstreamError(coaplib.PROXYING_NOT_SUPPORTED,
+                                'unsupported scheme %s' % scheme)
+        try:
+            return await asyncio.wait_for(coro, self.timeout)
+        except asyncio.TimeoutError:
+            raise UpstreamError(coaplib.GATEWAY_TIMEOUT,
+                                'timed out fetching %s' % uri)
+
+    def _fetch_http(self, uri):
+        try:
+            with urllib.request.urlopen(uri, timeout=self.timeout) as r:
+                return r.read()
+        except OSError as e:
+            raise UpstreamError(coaplib.BAD_GATEWAY, str(e))
+
+    async def _fetch_coap(self, uri):
+        parts = urllib.parse.urlsplit(uri)
+        loop = asyncio.get_event_loop()
+        try:
+            infos = await loop.getaddrinfo(parts.hostname, parts.port or 5683,
+                                           type=socket.SOCK_DGRAM)
+        except OSError as e:
+            raise UpstreamError(coaplib.BAD_GATEWAY, str(e))
+        # The endpoint socket is IPv6: map IPv4 servers
+        host, port = infos[0][4][:2]
+        if infos[0][0] == socket.AF_INET:
+            host = '::ffff:' + host
+        peer = (host, port, 0, 0)
+
+        data = bytearray()
+        num = 0
+        size = UPSTREAM_BLOCK_SIZE
+        while True:
+            msg = coaplib.Message(coaplib.CON, coaplib.GET,
+                                  token=coaplib.new_token())
+            msg.uri_path = urllib.parse.unquote(parts.path)
+            for query in filter(None, parts.query.split('&')):
+                msg.add_option(coaplib.URI_QUERY, query)
+            msg.add_option(coaplib.BLOCK2,
+                           coaplib.block_encode(num, False, size))
+
+            try:
+                response = await self.endpoint.request(msg, peer)
+            except asyncio.TimeoutError:
+                raise UpstreamError(coaplib.GATEWAY_TIMEOUT,
+                                    'no response from %s' % uri)
+            except ResetError as e:
+                raise UpstreamError(coaplib.BAD_GATEWAY, str(e))
+            if response.code != coaplib.CONTENT:
+                raise UpstreamError(coaplib.BAD_GATEWAY, '%s: %s' % (
+                    uri, coaplib.code_str(response.code)))
+
+            data += response.payload
+            block2 = response.get_option(coaplib.BLOCK2)
+            if block2 is None:
+                return bytes(data)
+            # The server may pick smaller blocks than asked for: go on
+            # with its size
+            _, more, size = coaplib.block_decode(block2)
+            if not more:
+                return bytes(data)
+            num = len(data) // size
+
+
+class DeviceStats:
+    def __init__(self):
+        self.blocks = 0
+        self.bytes = 0
+        self.first = None
+        self.last = None
+        self.completed = 0
+
+    def add(self, length, last_block):
+        now = time.time()
+        if self.first is None:
+            self.first = now
+        self.last = now
+        self.blocks += 1
+        self.bytes += length
+        if last_block:
+            self.completed += 1
+
+    def rate(self):
+        elapsed = (self.last or 0) - (self.first or 0)
+        return self.bytes / elapsed if elapsed > 0 else 0
+
+
+class Proxy:
+    def __init__(self, cache, max_block):
+        self.cache = cache
+        self.max_block = max_block
+        self.devices = collections.defaultdict(DeviceStats)
+        self.total = DeviceStats()
+
+    async def handle(self, endpoint, request, peer):
+        separate = False
+
+        if request.code != coaplib.GET:
+            response = request.make_response(coaplib.METHOD_NOT_ALLOWED)
+            endpoint.respond(request, peer, response)
+            return
+
+        uri = request.get_option(coaplib.PROXY_URI)
+        if not uri:
+            response = request.make_response(coaplib.PROXYING_NOT_SUPPORTED)
+            endpoint.respond(request, peer, response)
+            return
+
+        image = self.cache.images.get(uri)
+        if not image or time.time() - image.fetched > self.cache.ttl:
+            # Keep the device from retransmitting during the fetch
+            separate = endpoint.ack(request, peer)
+            try:
+                image = await self.cache.get(uri)
+            except UpstreamError as e:
+                print('%s: %s' % (uri, e), file=sys.stderr)
+                image = None
+                response = request.make_response(e.code)
+
+        if image:
+            response = self._block(request, peer, image)
+
+        if separate:
+            response.mtype = coaplib.CON
+        endpoint.respond(request, peer, response)
+
+    def _block(self, request, peer, image):
+        block2 = request.get_option(coaplib.BLOCK2)
+        if block2 is None:
+            # No preference from the device: start with our largest
+            num, size = 0, self.max_block
+        else:
+            num, _, size = coaplib.block_decode(block2)
+
+        # The device counts blocks in its own size. Serve the block
+        # covering the same offset in ours, which is no larger, and
+        # number it in ours: the device adopts the smaller size.
+        offset = num * size
+        size = min(size, self.max_block)
+        num = offset // size
+        if offset and offset >= len(image.data):
+            return request.make_response(coaplib.BAD_OPTION)
+
+        payload = bytes(image.data[offset:offset + size])
+        more = offset + size < len(image.data)
+        response = request.make_response(coaplib.CONTENT, payload)
+        response.add_option(coaplib.ETAG, image.etag)
+        response.add_option(coaplib.CONTENT_FORMAT,
+                            coaplib.FORMAT_OCTET_STREAM)
+        response.add_option(coaplib.BLOCK2,
+                            coaplib.block_encode(num, more, size))
+        if num == 0:
+            response.add_option(coaplib.SIZE2, len(image.data))
+
+        self.devices['[%s]:%d' % peer[:2]].add(len(payload), not more)
+        self.total.add(len(payload), not more)
+        return response
+
+    def print_stats(self):
+        print('--- %d devices, %d images served, %d bytes served, '
+              '%d bytes fetched upstream, %.0f B/s aggregate ---' % (
+                  len(self.devices), self.total.completed, self.total.bytes,
+                  self.cache.upstream_bytes, self.total.rate()))
+        for address, stats in sorted(self.devices.items()):
+            print('%-46s %6d blocks %9d bytes %8.0f B/s %s' % (
+                address, stats.blocks, stats.bytes, stats.rate(),
+                'done' if stats.completed else ''))
+
+
+async def print_stats_every(proxy, period):
+    while True:
+        await asyncio.sleep(period)
+        proxy.print_stats()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-a', '--address', default='::',
+                        help='address to listen on')
+    parser.add_argument('-p', '--port', type=int, default=5682,
+                        help='UDP port to listen on')
+    parser.add_argument('-d', '--cache-dir',
+                        help='keep images in files in this directory, '
+                             'and mmap them, instead of in memory')
+    parser.add_argument('-t', '--ttl', type=int, default=3600,
+                        help='seconds before an image is fetched again')
+    parser.add_argument('-b', '--max-block', type=int, default=1024,
+                        choices=(16, 32, 64, 128, 256, 512, 1024),
+                        help='largest block size served')
+    parser.add_argument('--upstream-timeout', type=int, default=300,
+                        help='seconds allowed to fetch an image')
+    parser.add_argument('-s', '--stats', type=int, default=0,
+                        help='print statistics every STATS seconds')
+    args = parser.parse_args()
+
+    if args.cache_dir:
+        os.makedirs(args.cache_dir, exist_ok=True)
+
+    loop = asyncio.get_event_loop()
+
+    # One dual-stack socket for devices and upstream CoAP servers alike
+    sock = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_V6ONLY, 0)
+    sock.bind((args.address, args.port))
+
+    endpoint = Endpoint()
+    upstream = Upstream(endpoint, args.upstream_timeout)
+    proxy = Proxy(Cache(upstream, args.cache_dir, args.ttl), args.max_block)
+    endpoint.on_request = proxy.handle
+
+    loop.run_until_complete(loop.create_datagram_endpoint(
+        lambda: endpoint, sock=sock))
+    if args.stats:
+        asyncio.ensure_future(print_stats_every(proxy, args.stats))
+
+    print('CoAP proxy listening on [%s]:%d' % (args.address, args.port))
+    try:
+        loop.run_forever()
+    except KeyboardInterrupt:
+        pass
+    proxy.print_stats()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,215 @@
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""asyncio CoAP endpoint shared by the host scripts.
+
+Adds the RFC 7252 message layer to the coaplib codec: Confirmable
+messages are retransmitted until acknowledged, responses are matched to
+requests by token, piggybacked or separate, and requests received again
+are answered from a cache rather than handled twice."""
+
+import asyncio
+import collections
+import random
+
+import coaplib
+
+# RFC 7252 transmission parameters
+ACK_TIMEOUT = 2.0
+ACK_RANDOM_FACTOR = 1.5
+MAX_RETRANSMIT = 4
+EXCHANGE_LIFETIME = 247
+
+# Responses kept to answer retransmitted requests without recomputing
+DEDUP_SIZE = 1024
+
+
+class ResetError(coaplib.CoapError):
+    """The peer rejected a message with a Reset."""
+
+
+class Endpoint(asyncio.DatagramProtocol):
+    """A CoAP endpoint: Confirmable exchanges with retransmission, in
+    both directions, and de-duplication of received requests."""
+
+    def __init__(self, on_request=None, ack_timeout=ACK_TIMEOUT):
+        self.transport = None
+        self.on_request = on_request
+        self.ack_timeout = ack_timeout
+        # (peer, message ID) -> future, for CON messages we sent
+        self.pending_acks = {}
+        # (peer, token) -> future, for requests we sent
+        self.pending_responses = {}
+        # (peer, token) -> callback, for resources we observe
+        self.observations = {}
+        # (peer, message ID) -> response, for requests we received
+        self.responses = collections.OrderedDict()
+        # CON messages sent again for want of an ACK, and requests the
+        # peers sent again
+        self.retransmissions = 0
+        self.duplicates = 0
+        # Message IDs are sequential, as peers de-duplicate on them
+        self.mid = random.randint(0, 0xffff)
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def connection_lost(self, exc):
+        # Nothing will be acknowledged or answered any more
+        for future in list(self.pending_acks.values()) + \
+                list(self.pending_responses.values()):
+            future.cancel()
+
+    def datagram_received(self, data, peer):
+        try:
+            msg = coaplib.Message.decode(data)
+        except coaplib.CoapError:
+            return
+
+        if msg.mtype in (coaplib.ACK, coaplib.RST):
+            future = self.pending_acks.pop((peer, msg.mid), None)
+            if future and not future.done():
+                future.set_result(msg)
+            if msg.mtype == coaplib.RST or msg.code == coaplib.EMPTY:
+                return
+
+        if msg.code == coaplib.EMPTY:
+            if msg.mtype == coaplib.CON:
+                # CoAP ping
+                self.send(coaplib.Message(coaplib.RST, coaplib.EMPTY,
+                                          msg.mid), peer)
+            return
+
+        if coaplib.is_request(msg.code):
+            self._request_received(msg, peer)
+            return
+
+        key = (peer, msg.token)
+        if msg.mtype == coaplib.CON:
+            mtype = coaplib.ACK
+            if msg.get_option(coaplib.OBSERVE) is not None and \
+                    key not in self.pending_responses and \
+                    key not in self.observations:
+                # Notification of an observation we forgot
+                mtype = coaplib.RST
+            self.send(coaplib.Message(mtype, coaplib.EMPTY, msg.mid), peer)
+        future = self.pending_responses.pop(key, None)
+        if future and not future.done():
+            future.set_result(msg)
+        elif key in self.observations:
+            self.observations[key](msg)
+
+    def _request_received(self, msg, peer):
+        key = (peer, msg.mid)
+        if key in self.responses:
+            self.duplicates += 1
+            # Retransmission: answer again, or stay quiet until the
+            # separate response is ready
+            if self.responses[key] is not None:
+                self.send(self.responses[key], peer)
+            return
+
+        self.responses[key] = None
+        while len(self.responses) > DEDUP_SIZE:
+            self.responses.popitem(last=False)
+
+        if self.on_request:
+            asyncio.ensure_future(self.on_request(self, msg, peer))
+
+    def send(self, msg, peer):
+        if not self.transport.is_closing():
+            self.transport.sendto(msg.encode(), peer)
+
+    def next_mid(self):
+        self.mid = (self.mid + 1) & 0xffff
+        return self.mid
+
+    async def send_con(self, msg, peer):
+        """Send a CON message until it is acknowledged."""
+        msg.mid = self.next_mid()
+        loop = asyncio.get_event_loop()
+        future = loop.create_future()
+        self.pending_acks[(peer, msg.mid)] = future
+        timeout = self.ack_timeout * random.uniform(1, ACK_RANDOM_FACTOR)
+        try:
+            for attempt in range(MAX_RETRANSMIT + 1):
+                if attempt:
+                    self.retransmissions += 1
+                self.send(msg, peer)
+                try:
+                    return await asyncio.wait_for(asyncio.shield(future),
+                                                  timeout)
+                except asyncio.TimeoutError:
+                    timeout *= 2
+            raise asyncio.TimeoutError()
+        finally:
+            self.pending_acks.pop((peer, msg.mid), None)
+
+    def ack(self, request, peer):
+        """Acknowledge a CON request whose response will be separate."""
+        if request.mtype != coaplib.CON:
+            return False
+        ack = coaplib.Message(coaplib.ACK, coaplib.EMPTY, request.mid)
+        self.send(ack, peer)
+        if (peer, request.mid) in self.responses:
+            self.responses[(peer, request.mid)] = ack
+        return True
+
+    def respond(self, request, peer, response):
+        """Send a response, as a CON if the request was acknowledged
+        already."""
+        key = (peer, request.mid)
+        if response.mtype == coaplib.CON:
+            asyncio.ensure_future(self._send_separate(response, peer))
+            return
+        self.send(response, peer)
+        if key in self.responses:
+            self.responses[key] = response
+
+    async def _send_separate(self, response, peer):
+        try:
+            await self.send_con(response, peer)
+        except asyncio.TimeoutError:
+            pass
+
+    async def request(self, msg, peer):
+        """Send a request and wait for its response."""
+        loop = asyncio.get_event_loop()
+        future = loop.create_future()
+        self.pending_responses[(peer, msg.token)] = future
+        try:
+            if msg.mtype == coaplib.CON:
+                ack = await self.send_con(msg, peer)
+                if ack.mtype == coaplib.RST:
+                    raise ResetError('request reset by %s' % (peer,))
+                if ack.code != coaplib.EMPTY:
+                    return ack
+            else:
+                msg.mid = self.next_mid()
+                self.send(msg, peer)
+            return await asyncio.wait_for(future, EXCHANGE_LIFETIME)
+        finally:
+            self.pending_responses.pop((peer, msg.token), None)
+
+    async def observe(self, msg, peer, callback):
+        """Send a GET request registering an observation (RFC 7641);
+        callback(notification) is called for each later notification.
+
+        Returns the response, which carries the current value."""
+        msg.add_option(coaplib.OBSERVE, 0)
+        self.observations[(peer, msg.token)] = callback
+        try:
+            response = await self.request(msg, peer)
+        except Exception:
+            self.observations.pop((peer, msg.token), None)
+            raise
+        if response.get_option(coaplib.OBSERVE) is None:
+            # Not observable: that was the only response
+            self.observations.pop((peer, msg.token), None)
+        return response
+
+    def forget(self, peer, token):
+        """Stop following an observation; the peer learns about it from
+        the Reset answering its next CON notification."""
+        self.observations.pop((peer, token), None)
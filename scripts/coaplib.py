@@ -0,0 +1,270 @@
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Minimal CoAP (RFC 7252) message codec shared by the host scripts.
+
+Only what the scripts in this directory need is implemented: message
+encoding/decoding, options, and Block1/Block2 (RFC 7959) helpers. There
+is no transport here; callers own their sockets."""
+
+import random
+import struct
+
+VERSION = 1
+
+# Message types
+CON = 0
+NON = 1
+ACK = 2
+RST = 3
+
+# Method and response codes, as (class << 5) | detail
+EMPTY = 0x00
+GET = 0x01
+POST = 0x02
+PUT = 0x03
+DELETE = 0x04
+
+CREATED = 0x41
+DELETED = 0x42
+VALID = 0x43
+CHANGED = 0x44
+CONTENT = 0x45
+CONTINUE = 0x5f
+BAD_REQUEST = 0x80
+BAD_OPTION = 0x82
+NOT_FOUND = 0x84
+METHOD_NOT_ALLOWED = 0x85
+REQUEST_ENTITY_INCOMPLETE = 0x88
+REQUEST_ENTITY_TOO_LARGE = 0x8d
+UNSUPPORTED_CONTENT_FORMAT = 0x8f
+INTERNAL_SERVER_ERROR = 0xa0
+BAD_GATEWAY = 0xa2
+SERVICE_UNAVAILABLE = 0xa3
+GATEWAY_TIMEOUT = 0xa4
+PROXYING_NOT_SUPPORTED = 0xa5
+
+# Option numbers
+IF_MATCH = 1
+URI_HOST = 3
+ETAG = 4
+OBSERVE = 6
+URI_PORT = 7
+LOCATION_PATH = 8
+URI_PATH = 11
+CONTENT_FORMAT = 12
+MAX_AGE = 14
+URI_QUERY = 15
+ACCEPT = 17
+LOCATION_QUERY = 20
+BLOCK2 = 23
+BLOCK1 = 27
+SIZE2 = 28
+PROXY_URI = 35
+PROXY_SCHEME = 39
+SIZE1 = 60
+NO_RESPONSE = 258
+
+# Content formats
+FORMAT_TEXT_PLAIN = 0
+FORMAT_LINK_FORMAT = 40
+FORMAT_OCTET_STREAM = 42
+FORMAT_OMA_PLAIN_TEXT = 1541
+FORMAT_OMA_OPAQUE = 1544
+FORMAT_OMA_TLV = 11542
+
+# Options whose values are unsigned integers
+UINT_OPTIONS = (OBSERVE, URI_PORT, CONTENT_FORMAT, MAX_AGE, ACCEPT,
+                BLOCK2, BLOCK1, SIZE2, SIZE1, NO_RESPONSE)
+
+# Options whose values are UTF-8 strings
+STRING_OPTIONS = (URI_HOST, LOCATION_PATH, URI_PATH, URI_QUERY,
+                  LOCATION_QUERY, PROXY_URI, PROXY_SCHEME)
+
+PAYLOAD_MARKER = 0xff
+
+
+class CoapError(Exception):
+    pass
+
+
+def code_str(code):
+    return '%d.%02d' % (code >> 5, code & 0x1f)
+
+
+def is_request(code):
+    return 0 < code < 32
+
+
+def encode_uint(value):
+    if value == 0:
+        return b''
+    data = bytearray()
+    while value:
+        data.insert(0, value & 0xff)
+        value >>= 8
+    return bytes(data)
+
+
+def decode_uint(data):
+    value = 0
+    for b in data:
+        value = (value << 8) | b
+    return value
+
+
+def _encode_ext(value):
+    if value < 13:
+        return value, b''
+    if value < 269:
+        return 13, bytes([value - 13])
+    return 14, struct.pack('!H', value - 269)
+
+
+class Message:
+    """A CoAP message. Options are kept as a list of (number, bytes)."""
+
+    def __init__(self, mtype=CON, code=EMPTY, mid=None, token=b'',
+                 options=None, payload=b''):
+        self.mtype = mtype
+        self.code = code
+        self.mid = random.randint(0, 0xffff) if mid is None else mid
+        self.token = token
+        self.options = list(options) if options else []
+        self.payload = payload
+
+    def add_option(self, number, value):
+        if isinstance(value, int) and not isinstance(value, bool):
+            value = encode_uint(value)
+        elif isinstance(value, str):
+            value = value.encode('utf-8')
+        self.options.append((number, bytes(value)))
+        return self
+
+    def remove_option(self, number):
+        self.options = [o for o in self.options if o[0] != number]
+
+    def get_options(self, number):
+        return [v for n, v in self.options if n == number]
+
+    def get_option(self, number, default=None):
+        values = self.get_options(number)
+        if not values:
+            return default
+        if number in UINT_OPTIONS:
+            return decode_uint(values[0])
+        if number in STRING_OPTIONS:
+            return values[0].decode('utf-8')
+        return values[0]
+
+    @property
+    def uri_path(self):
+        return '/'.join(v.decode('utf-8')
+                        for v in self.get_options(URI_PATH))
+
+    @uri_path.setter
+    def uri_path(self, path):
+        self.remove_option(URI_PATH)
+        for segment in path.strip('/').split('/'):
+            if segment:
+                self.add_option(URI_PATH, segment)
+
+    @property
+    def uri_query(self):
+        return [v.decode('utf-8') for v in self.get_options(URI_QUERY)]
+
+    def encode(self):
+        if len(self.token) > 8:
+            raise CoapError('token too long')
+        data = bytearray()
+        data.append((VERSION << 6) | (self.mtype << 4) | len(self.token))
+        data.append(self.code)
+        data += struct.pack('!H', self.mid)
+        data += self.token
+        last = 0
+        # sort is stable, so repeated options keep their order
+        for number, value in sorted(self.options, key=lambda o: o[0]):
+            delta, delta_ext = _encode_ext(number - last)
+            length, length_ext = _encode_ext(len(value))
+            data.append((delta << 4) | length)
+            data += delta_ext + length_ext + value
+            last = number
+        if self.payload:
+            data.append(PAYLOAD_MARKER)
+            data += self.payload
+        return bytes(data)
+
+    @classmethod
+    def decode(cls, data):
+        if len(data) < 4:
+            raise CoapError('message too short')
+        version = data[0] >> 6
+        if version != VERSION:
+            raise CoapError('bad version %d' % version)
+        mtype = (data[0] >> 4) & 0x3
+        tkl = data[0] & 0xf
+        if tkl > 8 or len(data) < 4 + tkl:
+            raise CoapError('bad token length')
+        code = data[1]
+        mid = struct.unpack('!H', data[2:4])[0]
+        token = bytes(data[4:4 + tkl])
+        pos = 4 + tkl
+        number = 0
+        options = []
+        payload = b''
+        while pos < len(data):
+            if data[pos] == PAYLOAD_MARKER:
+                payload = bytes(data[pos + 1:])
+                if not payload:
+                    raise CoapError('empty payload after marker')
+                break
+            delta = data[pos] >> 4
+            length = data[pos] & 0xf
+            pos += 1
+            delta, pos = cls._decode_ext(data, delta, pos)
+            length, pos = cls._decode_ext(data, length, pos)
+            if pos + length > len(data):
+                raise CoapError('truncated option')
+            number += delta
+            options.append((number, bytes(data[pos:pos + length])))
+            pos += length
+        return cls(mtype, code, mid, token, options, payload)
+
+    @staticmethod
+    def _decode_ext(data, value, pos):
+        if value == 13:
+            return data[pos] + 13, pos + 1
+        if value == 14:
+            return struct.unpack('!H', data[pos:pos + 2])[0] + 269, pos + 2
+        if value == 15:
+            raise CoapError('reserved option nibble')
+        return value, pos
+
+    def make_response(self, code, payload=b'', options=None):
+        """Piggybacked ACK for CON requests, NON response otherwise."""
+        if self.mtype == CON:
+            return Message(ACK, code, self.mid, self.token, options, payload)
+        return Message(NON, code, None, self.token, options, payload)
+
+    def __repr__(self):
+        return '<Message %s %s mid=%d token=%s path=%s len=%d>' % (
+            ('CON', 'NON', 'ACK', 'RST')[self.mtype], code_str(self.code),
+            self.mid, self.token.hex(), self.uri_path, len(self.payload))
+
+
+def block_encode(num, more, size):
+    """Encode a Block1/Block2 option value (RFC 7959)."""
+    szx = size.bit_length() - 5
+    if size not in (16, 32, 64, 128, 256, 512, 1024):
+        raise CoapError('invalid block size %d' % size)
+    return (num << 4) | (int(more) << 3) | szx
+
+
+def block_decode(value):
+    """Decode a Block1/Block2 option value into (num, more, size)."""
+    return value >> 4, bool(value & 0x8), 1 << ((value & 0x7) + 4)
+
+
+def new_token(length=4):
+    return bytes(random.getrandbits(8) for _ in range(length))
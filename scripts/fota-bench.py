@@ -0,0 +1,518 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""End-to-end firmware update benchmark over emulated links.
+
+Runs the native_posix build of the application against a minimal LwM2M
+and firmware server built into this script, with the zeth TAP interface
+shaped by netem to look like each deployment's link, and measures for
+each profile:
+
+- time to update: from writing the package URI (5/0/1) to the device
+  having downloaded the image, and from executing the update (5/0/2) to
+  its registering again;
+- bytes on air, both ways, during the download, from the interface
+  counters;
+- CoAP retransmissions, by the device (duplicate requests received) and
+  by the server;
+- flash erase and program time and slowest block write, as measured by
+  the device in firmware_block_received_cb() (diagnostics object, or
+  the "Image written" log line).
+
+native_posix has no bootloader: after executing the update, the device
+process is restarted, so the update time covers a reboot and a new
+registration but no image swap.
+
+Build the application with the overlay next to this script and the
+settings shared by the benchmarks, set up zeth with net-setup.sh from
+Zephyr's net-tools, then, as root (tc and ip are needed to shape the
+link):
+    west build -b native_posix -- \\
+        -DOVERLAY_CONFIG="tests/bench.conf scripts/fota-bench.conf"
+    sudo ./scripts/fota-bench.py -e build/zephyr/zephyr.exe -o bench.json
+
+The LTE-M profile expects the 20 s CoAP ACK timeout of the modem builds
+(CONFIG_COAP_INIT_ACK_TIMEOUT_MS); give a binary built with it with
+--exe lte-m=path. Results are written as JSON; with --baseline, a
+metric more than --tolerance worse than in an earlier result file fails
+the run."""
+
+import argparse
+import asyncio
+import collections
+import json
+import os
+import re
+import signal
+import statistics
+import subprocess
+import sys
+import time
+
+import coaplib
+from coap_endpoint import Endpoint, ResetError
+
+FORMAT_VERSION = 1
+
+SERVER_ADDR = '192.0.2.2'
+SERVER_PORT = 5683
+FIRMWARE_PATH = 'fw'
+INTERFACE = 'zeth'
+IFB_INTERFACE = 'ifb-fota'
+
+# Firmware Update object
+PACKAGE_URI = '5/0/1'
+UPDATE = '5/0/2'
+STATE = '5/0/3'
+RESULT = '5/0/5'
+STATE_DOWNLOADED = 2
+
+# Diagnostics object (src/diag.c): flash erase and program time, slowest
+# block write
+DIAG_FW_PATHS = ('26241/0/21', '26241/0/22', '26241/0/23')
+IMAGE_WRITTEN_RE = re.compile(r'Image written: (\d+) bytes in (\d+) blocks, '
+                              r'erase (\d+) us, program (\d+) us, slowest '
+                              r'block (\d+) us')
+
+Profile = collections.namedtuple('Profile', 'description netem ack_timeout')
+
+# netem parameters applied in each direction
+PROFILES = collections.OrderedDict([
+    ('ethernet', Profile('Wired Ethernet',
+                         'delay 1ms rate 100mbit', 2.0)),
+    ('thread', Profile('Thread, a few 802.15.4 hops from the border router',
+                       'delay 30ms 10ms distribution normal loss 1% '
+                       'rate 80kbit', 2.0)),
+    ('ble', Profile('BLE 6LoWPAN to a gateway',
+                    'delay 25ms 10ms distribution normal loss 0.5% '
+                    'rate 120kbit', 2.0)),
+    ('lte-m', Profile('LTE-M, idle network, 20 s ACK timeout',
+                      'delay 150ms 50ms distribution normal loss 1% '
+                      'rate 300kbit', 20.0)),
+])
+
+# Metrics compared against a baseline; all are better when lower
+METRICS = ('download_s', 'update_s', 'bytes_on_air', 'retransmissions',
+           'flash_erase_us', 'flash_program_us', 'flash_block_max_us')
+
+
+class BenchError(Exception):
+    pass
+
+
+def run(*cmd, check=True):
+    return subprocess.run(cmd, check=check, stdout=subprocess.DEVNULL,
+                          stderr=subprocess.DEVNULL).returncode
+
+
+class Link:
+    """netem on both directions of the TAP interface: egress directly,
+    ingress through an IFB device."""
+
+    def __init__(self, interface):
+        self.interface = interface
+
+    def counters(self):
+        base = '/sys/class/net/%s/statistics/' % self.interface
+        with open(base + 'rx_bytes') as rx, open(base + 'tx_bytes') as tx:
+            return int(rx.read()) + int(tx.read())
+
+    def shape(self, netem):
+        self.clear()
+        run('modprobe', 'ifb', check=False)
+        run('ip', 'link', 'add', IFB_INTERFACE, 'type', 'ifb')
+        run('ip', 'link', 'set', IFB_INTERFACE, 'up')
+        run('tc', 'qdisc', 'add', 'dev', self.interface, 'handle', 'ffff:',
+            'ingress')
+        run('tc', 'filter', 'add', 'dev', self.interface, 'parent', 'ffff:',
+            'matchall', 'action', 'mirred', 'egress', 'redirect', 'dev',
+            IFB_INTERFACE)
+        for dev in (self.interface, IFB_INTERFACE):
+            run('tc', 'qdisc', 'add', 'dev', dev, 'root', 'netem',
+                *netem.split())
+
+    def clear(self):
+        run('tc', 'qdisc', 'del', 'dev', self.interface, 'root', check=False)
+        run('tc', 'qdisc', 'del', 'dev', self.interface, 'ingress',
+            check=False)
+        run('ip', 'link', 'del', IFB_INTERFACE, check=False)
+
+
+class Server:
+    """Just enough of an LwM2M server for one device, which also serves
+    the firmware image."""
+
+    def __init__(self, image, ack_timeout):
+        self.image = image
+        self.endpoint = Endpoint(self.request_received, ack_timeout)
+        self.device = None
+        self.location = 0
+        self.registered = asyncio.Event()
+        self.registered_at = None
+        self.blocks_served = 0
+
+    async def start(self):
+        loop = asyncio.get_event_loop()
+        await loop.create_datagram_endpoint(
+            lambda: self.endpoint, local_addr=(SERVER_ADDR, SERVER_PORT))
+
+    async def stop(self):
+        self.endpoint.transport.close()
+        # The socket is closed on the next loop iteration
+        await asyncio.sleep(0)
+
+    async def request_received(self, endpoint, msg, peer):
+        path = msg.uri_path
+        options = []
+        payload = b''
+        if path == 'rd' and msg.code == coaplib.POST:
+            self.location += 1
+            self.device = peer
+            self.registered_at = time.monotonic()
+            self.registered.set()
+            code = coaplib.CREATED
+            options = [(coaplib.LOCATION_PATH, b'rd'),
+                       (coaplib.LOCATION_PATH, b'%d' % self.location)]
+        elif path.startswith('rd/'):
+            code = coaplib.CHANGED if msg.code == coaplib.POST \
+                else coaplib.DELETED
+        elif path == FIRMWARE_PATH and msg.code == coaplib.GET:
+            block2 = msg.get_option(coaplib.BLOCK2, 0)
+            num, _, size = coaplib.block_decode(block2)
+            payload = self.image[num * size:(num + 1) * size]
+            more = (num + 1) * size < len(self.image)
+            code = coaplib.CONTENT
+            options = [(coaplib.BLOCK2, coaplib.encode_uint(
+                coaplib.block_encode(num, more, size)))]
+            if num == 0:
+                options.append((coaplib.SIZE2,
+                                coaplib.encode_uint(len(self.image))))
+            self.blocks_served += 1
+        else:
+            code = coaplib.NOT_FOUND
+        endpoint.respond(msg, peer,
+                         msg.make_response(code, payload, options))
+
+    def _request(self, code, path, payload=b''):
+        msg = coaplib.Message(coaplib.CON, code, token=coaplib.new_token(),
+                              payload=payload)
+        msg.uri_path = path
+        if payload:
+            msg.add_option(coaplib.CONTENT_FORMAT,
+                           coaplib.FORMAT_OMA_PLAIN_TEXT)
+        return msg
+
+    async def request(self, code, path, payload=b''):
+        response = await self.endpoint.request(
+            self._request(code, path, payload), self.device)
+        if response.code >= coaplib.BAD_REQUEST:
+            raise BenchError('%s: %s' % (path,
+                                         coaplib.code_str(response.code)))
+        return response
+
+    async def read_int(self, path):
+        return int((await self.request(coaplib.GET, path)).payload or 0)
+
+    async def observe_int(self, path, callback):
+        msg = self._request(coaplib.GET, path)
+        response = await self.endpoint.observe(
+            msg, self.device, lambda n: callback(int(n.payload or 0)))
+        return int(response.payload or 0)
+
+
+class Device:
+    def __init__(self, exe, device_id, log_path):
+        self.exe = exe
+        self.device_id = device_id
+        self.log_path = log_path
+        self.process = None
+
+    def start(self):
+        log = open(self.log_path, 'a')
+        self.process = subprocess.Popen(
+            [self.exe, '--device-id=%d' % self.device_id],
+            stdout=log, stderr=subprocess.STDOUT, stdin=subprocess.DEVNULL)
+        log.close()
+
+    def stop(self):
+        if self.process and self.process.poll() is None:
+            self.process.send_signal(signal.SIGTERM)
+            try:
+                self.process.wait(5)
+            except subprocess.TimeoutExpired:
+                self.process.kill()
+                self.process.wait()
+        self.process = None
+
+    def flash_timing(self):
+        """Erase, program and slowest block times from the last
+        "Image written" log line."""
+        match = None
+        with open(self.log_path, errors='replace') as log:
+            for line in log:
+                match = IMAGE_WRITTEN_RE.search(line) or match
+        if not match:
+            return None
+        return [int(v) for v in match.groups()[2:]]
+
+
+async def wait_for(event, timeout, what):
+    try:
+        await asyncio.wait_for(event.wait(), timeout)
+    except asyncio.TimeoutError:
+        raise BenchError('%s: timed out after %d s' % (what, timeout))
+
+
+async def run_once(args, profile, exe, link, image, log_path):
+    server = Server(image, profile.ack_timeout)
+    await server.start()
+    device = Device(exe, args.device_id, log_path)
+    result = {}
+    try:
+        device.start()
+        started = time.monotonic()
+        await wait_for(server.registered, args.register_timeout,
+                       'registration')
+        result['register_s'] = round(server.registered_at - started, 3)
+
+        state = {'value': None}
+        downloaded = asyncio.Event()
+
+        def state_changed(value):
+            state['value'] = value
+            if value == STATE_DOWNLOADED:
+                downloaded.set()
+
+        state_changed(await server.observe_int(STATE, state_changed))
+
+        bytes_before = link.counters()
+        retrans_before = (server.endpoint.duplicates,
+                          server.endpoint.retransmissions)
+        start = time.monotonic()
+        await server.request(coaplib.PUT, PACKAGE_URI, (
+            'coap://%s:%d/%s' % (SERVER_ADDR, SERVER_PORT,
+                                 FIRMWARE_PATH)).encode())
+        await wait_for(downloaded, args.download_timeout, 'download')
+        result['download_s'] = round(time.monotonic() - start, 3)
+        result['bytes_on_air'] = link.counters() - bytes_before
+        result['device_retransmissions'] = \
+            server.endpoint.duplicates - retrans_before[0]
+        result['server_retransmissions'] = \
+            server.endpoint.retransmissions - retrans_before[1]
+        result['retransmissions'] = result['device_retransmissions'] + \
+            result['server_retransmissions']
+        result['blocks'] = server.blocks_served
+
+        try:
+            timing = [await server.read_int(p) for p in DIAG_FW_PATHS]
+        except BenchError:
+            timing = None
+        if not timing or min(timing) < 0:
+            timing = device.flash_timing()
+        if timing:
+            (result['flash_erase_us'], result['flash_program_us'],
+             result['flash_block_max_us']) = timing
+
+        # No bootloader: once the update is executed, "reboot" the
+        # device by starting it again
+        server.registered.clear()
+        start = time.monotonic()
+        await server.request(coaplib.POST, UPDATE)
+        try:
+            await asyncio.get_event_loop().run_in_executor(
+                None, device.process.wait, args.reboot_wait)
+        except subprocess.TimeoutExpired:
+            pass
+        device.stop()
+        device.start()
+        await wait_for(server.registered, args.register_timeout,
+                       'registration after the update')
+        result['update_s'] = round(server.registered_at - start, 3)
+        result['time_to_update_s'] = round(result['download_s'] +
+                                           result['update_s'], 3)
+    finally:
+        device.stop()
+        await server.stop()
+
+    return result
+
+
+def median(runs, metric):
+    values = [r[metric] for r in runs if metric in r]
+    return round(statistics.median(values), 3) if values else None
+
+
+async def bench(args, profiles, image):
+    link = Link(args.interface)
+    results = collections.OrderedDict()
+    os.makedirs(args.log_dir, exist_ok=True)
+    try:
+        for name in profiles:
+            profile = PROFILES[name]
+            exe = args.exes.get(name, args.exes.get(None))
+            link.shape(profile.netem)
+            runs = []
+            for i in range(args.runs):
+                log_path = os.path.join(args.log_dir,
+                                        '%s-%d.log' % (name, i))
+                if os.path.exists(log_path):
+                    os.unlink(log_path)
+                print('%s, run %d/%d' % (name, i + 1, args.runs))
+                try:
+                    run_result = await run_once(args, profile, exe, link,
+                                                image, log_path)
+                except (BenchError, ResetError,
+                        asyncio.TimeoutError) as e:
+                    print('  failed: %s' % (e or type(e).__name__))
+                    run_result = {'error': str(e) or type(e).__name__}
+                else:
+                    print('  ' + ', '.join('%s %s' % i
+                                           for i in run_result.items()))
+                runs.append(run_result)
+            ok = [r for r in runs if 'error' not in r]
+            results[name] = {
+                'description': profile.description,
+                'netem': profile.netem,
+                'ack_timeout_s': profile.ack_timeout,
+                'runs': runs,
+                'failures': len(runs) - len(ok),
+                'median': {m: median(ok, m) for m in
+                           METRICS + ('time_to_update_s', 'register_s')
+                           if median(ok, m) is not None},
+            }
+    finally:
+        link.clear()
+    return results
+
+
+def compare(results, baseline, tolerance):
+    """Metrics worse than the baseline by more than tolerance."""
+    regressions = []
+    for name, profile in results.items():
+        before = baseline.get('profiles', {}).get(name, {}).get('median', {})
+        for metric in METRICS:
+            new, old = profile['median'].get(metric), before.get(metric)
+            if new is None or not old:
+                continue
+            if new > old * (1 + tolerance):
+                regressions.append('%s %s: %s, was %s (+%.0f%%)' % (
+                    name, metric, new, old, (new / old - 1) * 100))
+    return regressions
+
+
+def git_describe():
+    try:
+        return subprocess.check_output(
+            ['git', 'describe', '--always', '--dirty'],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def parse_exes(parser, values):
+    exes = {}
+    for value in values:
+        profile, sep, path = value.rpartition('=')
+        if sep and profile not in PROFILES:
+            parser.error('unknown profile %s' % profile)
+        exes[profile or None] = path
+    return exes
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-e', '--exe', action='append', required=True,
+                        help='native_posix zephyr.exe, or PROFILE=path '
+                             'for one profile')
+    parser.add_argument('-p', '--profile', action='append',
+                        choices=list(PROFILES),
+                        help='profiles to run, all by default')
+    parser.add_argument('-i', '--image',
+                        help='firmware image, random bytes by default')
+    parser.add_argument('-s', '--size', type=int, default=200 * 1024,
+                        help='size of the random image')
+    parser.add_argument('-n', '--runs', type=int, default=3,
+                        help='runs per profile')
+    parser.add_argument('--device-id', type=int, default=0xbe7c,
+                        help='device ID of the native_posix device')
+    parser.add_argument('--interface', default=INTERFACE,
+                        help='TAP interface of the device')
+    parser.add_argument('--register-timeout', type=int, default=120)
+    parser.add_argument('--download-timeout', type=int, default=3600)
+    parser.add_argument('--reboot-wait', type=int, default=10,
+                        help='seconds to let the device reboot by itself')
+    parser.add_argument('--log-dir', default='fota-bench-logs',
+                        help='device logs, one per run')
+    parser.add_argument('-o', '--output', help='write the results here')
+    parser.add_argument('-b', '--baseline',
+                        help='results to compare with')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='regression threshold, as a fraction')
+    args = parser.parse_args()
+    args.exes = parse_exes(parser, args.exe)
+
+    profiles = args.profile or list(PROFILES)
+    missing = [p for p in profiles if p not in args.exes and
+               None not in args.exes]
+    if missing:
+        parser.error('no executable for %s' % ', '.join(missing))
+    if os.geteuid():
+        parser.error('shaping the link needs root')
+    if not os.path.exists('/sys/class/net/%s' % args.interface):
+        parser.error('no %s interface: run net-setup.sh first' %
+                     args.interface)
+
+    if args.image:
+        with open(args.image, 'rb') as f:
+            image = f.read()
+    else:
+        image = os.urandom(args.size)
+
+    loop = asyncio.get_event_loop()
+    try:
+        results = loop.run_until_complete(bench(args, profiles, image))
+    except subprocess.CalledProcessError as e:
+        sys.exit('Cannot shape %s: %s failed' % (args.interface,
+                                                 ' '.join(e.cmd)))
+
+    report = {
+        'version': FORMAT_VERSION,
+        'git': git_describe(),
+        'time': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'image_size': len(image),
+        'profiles': results,
+    }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+
+    print('%-10s %10s %10s %12s %8s %12s' % (
+        'profile', 'download s', 'update s', 'bytes', 'retrans',
+        'flash ms'))
+    for name, profile in results.items():
+        m = profile['median']
+        flash = None
+        if 'flash_erase_us' in m:
+            flash = (m['flash_erase_us'] + m['flash_program_us']) / 1000
+        print('%-10s %10s %10s %12s %8s %12s' % (
+            name, m.get('download_s', '-'), m.get('update_s', '-'),
+            m.get('bytes_on_air', '-'), m.get('retransmissions', '-'),
+            flash if flash is not None else '-'))
+
+    failed = any(p['failures'] for p in results.values())
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(results, json.load(f), args.tolerance)
+        for regression in regressions:
+            print('REGRESSION ' + regression)
+        failed = failed or bool(regressions)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,467 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Roll a firmware update out to a fleet of LwM2M devices through Leshan.
+
+Unlike leshan.py, which runs a thread per device polling the Firmware
+Update state (5/0/3) and result (5/0/5), this observes both resources
+and follows their notifications on the Leshan event stream, so one
+process can drive thousands of devices.
+
+The fleet is updated in stages: a canary, then waves, each stage given
+as a cumulative device count or fleet percentage (--stages 1,10%,100%).
+At most --concurrency devices are updated at once. Once at least
+--min-samples devices have finished, the rollout halts, letting updates
+in progress finish but starting no others, when the share of failures
+exceeds --max-failure-rate.
+
+Each device gets --download-timeout seconds to download the image and
+--update-timeout seconds to apply it and register again. Observations
+can be lost (Leshan drops them when a device registers again), so the
+resources are also read every --poll seconds.
+
+A summary with per-device download and update durations is written as
+JSON to --summary.
+
+Example:
+    ./fota-rollout.py -u coap://[fd11:22::1]:5682/fw.bin \\
+        -c nrf52_blenano2 --stages 1,10%,100% --summary rollout.json
+
+Requires aiohttp."""
+
+import argparse
+import asyncio
+import json
+import math
+import signal
+import sys
+import time
+
+import aiohttp
+
+# Firmware Update object, state (5/0/3) and result (5/0/5) values
+PACKAGE_URI = '5/0/1'
+UPDATE = '5/0/2'
+STATE = '5/0/3'
+RESULT = '5/0/5'
+DEVICE_TYPE = '3/0/1'
+
+STATE_IDLE = 0
+STATE_DOWNLOADING = 1
+STATE_DOWNLOADED = 2
+STATE_UPDATING = 3
+
+RESULT_INITIAL = 0
+RESULT_SUCCESS = 1
+
+
+class RolloutError(Exception):
+    pass
+
+
+class Leshan:
+    """Leshan web API client, with its event stream dispatched to the
+    devices being updated."""
+
+    def __init__(self, session, hostname):
+        self.session = session
+        self.hostname = hostname
+        self.devices = {}
+
+    def url(self, endpoint, path):
+        return '%s/api/clients/%s/%s' % (self.hostname, endpoint, path)
+
+    async def _request(self, method, url, **kwargs):
+        async with self.session.request(method, url, **kwargs) as response:
+            if response.status not in (200, 201):
+                raise RolloutError('%s %s: HTTP %d' % (method, url,
+                                                        response.status))
+            if response.content_type != 'application/json':
+                return None
+            payload = await response.json()
+        if isinstance(payload, dict) and payload.get('success') is False:
+            raise RolloutError('%s %s: %s' % (method, url,
+                                               payload.get('status')))
+        return payload
+
+    @staticmethod
+    def _value(payload):
+        return payload.get('content', {}).get('value')
+
+    async def clients(self):
+        return await self._request('GET', '%s/api/clients' % self.hostname)
+
+    async def read(self, endpoint, path):
+        return self._value(await self._request('GET',
+                                               self.url(endpoint, path)))
+
+    async def write(self, endpoint, path, value):
+        res_id = int(path.split('/')[-1])
+        await self._request('PUT', self.url(endpoint, path),
+                            json={'id': res_id, 'value': value})
+
+    async def execute(self, endpoint, path):
+        await self._request('POST', self.url(endpoint, path))
+
+    async def observe(self, endpoint, path):
+        return self._value(await self._request(
+            'POST', self.url(endpoint, path) + '/observe'))
+
+    async def cancel_observe(self, endpoint, path):
+        try:
+            await self._request('DELETE',
+                                self.url(endpoint, path) + '/observe')
+        except (RolloutError, aiohttp.ClientError):
+            pass
+
+    async def follow_events(self, connected):
+        """Dispatch NOTIFICATION and REGISTRATION events to devices."""
+        while True:
+            try:
+                async with self.session.get(
+                        '%s/event' % self.hostname,
+                        headers={'Accept': 'text/event-stream'},
+                        timeout=aiohttp.ClientTimeout(total=None)) as r:
+                    connected.set()
+                    event, data = None, []
+                    async for raw in r.content:
+                        line = raw.decode('utf-8').rstrip('\r\n')
+                        if not line:
+                            if event and data:
+                                self._dispatch(event, '\n'.join(data))
+                            event, data = None, []
+                        elif line.startswith('event:'):
+                            event = line[6:].strip()
+                        elif line.startswith('data:'):
+                            data.append(line[5:].lstrip())
+            except aiohttp.ClientError as e:
+                print('Event stream: %s' % e, file=sys.stderr)
+            # Notifications may have been missed: have devices poll
+            for device in self.devices.values():
+                device.wake()
+            await asyncio.sleep(1)
+
+    def _dispatch(self, event, data):
+        try:
+            payload = json.loads(data)
+        except ValueError:
+            return
+
+        if event == 'NOTIFICATION':
+            device = self.devices.get(payload.get('ep'))
+            value = payload.get('val', {}).get('value')
+            if device and value is not None:
+                device.notify(payload.get('res', '').strip('/'), value)
+        elif event == 'REGISTRATION':
+            device = self.devices.get(payload.get('endpoint'))
+            if device:
+                device.registered()
+
+
+class Device:
+    def __init__(self, leshan, endpoint):
+        self.leshan = leshan
+        self.endpoint = endpoint
+        self.state = None
+        self.result = None
+        self.registrations = 0
+        self._changed = asyncio.Event()
+
+        # Summary
+        self.outcome = 'pending'
+        self.error = None
+        self.download_start = None
+        self.download_end = None
+        self.update_end = None
+
+    def notify(self, path, value):
+        if path == STATE:
+            self.state = value
+        elif path == RESULT:
+            self.result = value
+        self.wake()
+
+    def registered(self):
+        self.registrations += 1
+        self.wake()
+
+    def wake(self):
+        self._changed.set()
+
+    async def poll(self):
+        self.state = await self.leshan.read(self.endpoint, STATE)
+        self.result = await self.leshan.read(self.endpoint, RESULT)
+
+    async def wait(self, condition, timeout, poll_period):
+        """Wait for condition() to hold, polling every poll_period."""
+        deadline = time.monotonic() + timeout
+        while not condition():
+            left = deadline - time.monotonic()
+            if left <= 0:
+                raise asyncio.TimeoutError()
+            self._changed.clear()
+            try:
+                await asyncio.wait_for(self._changed.wait(),
+                                       min(left, poll_period))
+            except asyncio.TimeoutError:
+                await self.poll()
+
+    def failed_result(self):
+        return self.result not in (None, RESULT_INITIAL, RESULT_SUCCESS)
+
+    async def update(self, args):
+        ep = self.endpoint
+        self.state = await self.leshan.observe(ep, STATE)
+        self.result = await self.leshan.observe(ep, RESULT)
+        if self.state != STATE_IDLE:
+            raise RolloutError('not idle (state %s)' % self.state)
+
+        self.download_start = time.time()
+        await self.leshan.write(ep, PACKAGE_URI, args.url)
+        try:
+            await self.wait(lambda: self.state == STATE_DOWNLOADED or
+                            self.failed_result(),
+                            args.download_timeout, args.poll)
+        except asyncio.TimeoutError:
+            raise RolloutError('download timed out (state %s)' % self.state)
+        self.download_end = time.time()
+        if self.state != STATE_DOWNLOADED:
+            raise RolloutError('download failed (result %s)' % self.result)
+
+        # The device reboots into the new image and registers again;
+        # Leshan drops the observations then, so poll the result
+        registrations = self.registrations
+        await self.leshan.execute(ep, UPDATE)
+        try:
+            await self.wait(lambda: self.registrations > registrations,
+                            args.update_timeout, args.poll)
+        except asyncio.TimeoutError:
+            raise RolloutError('did not register after the update')
+        self.result = await self.leshan.read(ep, RESULT)
+        self.update_end = time.time()
+        if self.result != RESULT_SUCCESS:
+            raise RolloutError('update failed (result %s)' % self.result)
+
+    async def run(self, args):
+        try:
+            await self.update(args)
+            self.outcome = 'success'
+        except (RolloutError, aiohttp.ClientError,
+                asyncio.TimeoutError) as e:
+            self.outcome = 'failed'
+            self.error = str(e) or type(e).__name__
+        finally:
+            for path in (STATE, RESULT):
+                await self.leshan.cancel_observe(self.endpoint, path)
+        print('%s: %s%s' % (self.endpoint, self.outcome,
+                            ', ' + self.error if self.error else ''))
+
+    def summary(self):
+        def duration(start, end):
+            return round(end - start, 3) if start and end else None
+
+        return {
+            'endpoint': self.endpoint,
+            'outcome': self.outcome,
+            'error': self.error,
+            'result': self.result,
+            'download_s': duration(self.download_start, self.download_end),
+            'update_s': duration(self.download_end, self.update_end),
+            'total_s': duration(self.download_start, self.update_end),
+        }
+
+
+def percentiles(values):
+    values = sorted(v for v in values if v is not None)
+    if not values:
+        return None
+
+    def pct(p):
+        return values[min(len(values) - 1,
+                          max(0, math.ceil(p / 100 * len(values)) - 1))]
+
+    return {'min': values[0], 'p50': pct(50), 'p90': pct(90),
+            'p99': pct(99), 'max': values[-1]}
+
+
+def stage_sizes(stages, fleet):
+    sizes = []
+    for stage in stages.split(','):
+        stage = stage.strip()
+        if stage.endswith('%'):
+            size = math.ceil(fleet * float(stage[:-1]) / 100)
+        else:
+            size = int(stage)
+        sizes.append(min(max(size, 1), fleet))
+    return sorted(set(sizes))
+
+
+class Rollout:
+    def __init__(self, args, leshan, devices):
+        self.args = args
+        self.leshan = leshan
+        self.devices = devices
+        self.halted = None
+        self.aborted = False
+
+    def finished(self):
+        return [d for d in self.devices
+                if d.outcome in ('success', 'failed')]
+
+    def failure_rate(self):
+        finished = self.finished()
+        failed = [d for d in finished if d.outcome == 'failed']
+        return len(failed) / len(finished) if finished else 0
+
+    def check_halt(self):
+        if self.halted or len(self.finished()) < self.args.min_samples:
+            return
+        rate = self.failure_rate()
+        if rate > self.args.max_failure_rate:
+            self.halted = 'failure rate %.0f%% over %.0f%%' % (
+                rate * 100, self.args.max_failure_rate * 100)
+            print('HALT: %s' % self.halted)
+
+    async def run_device(self, device, semaphore):
+        async with semaphore:
+            if self.halted or self.aborted:
+                device.outcome = 'skipped'
+                return
+            await device.run(self.args)
+            self.check_halt()
+
+    async def run(self):
+        semaphore = asyncio.Semaphore(self.args.concurrency)
+        started = 0
+        for size in stage_sizes(self.args.stages, len(self.devices)):
+            if self.halted or self.aborted:
+                break
+            print('Stage: updating devices %d to %d of %d' % (
+                started + 1, size, len(self.devices)))
+            wave = self.devices[started:size]
+            started = size
+            await asyncio.gather(*(self.run_device(d, semaphore)
+                                   for d in wave))
+            self.check_halt()
+
+        for device in self.devices[started:]:
+            device.outcome = 'skipped'
+
+    def summary(self):
+        devices = [d.summary() for d in self.devices]
+        counts = {}
+        for d in devices:
+            counts[d['outcome']] = counts.get(d['outcome'], 0) + 1
+        done = [d for d in devices if d['outcome'] == 'success']
+        return {
+            'url': self.args.url,
+            'halted': self.halted,
+            'aborted': self.aborted,
+            'counts': counts,
+            'failure_rate': round(self.failure_rate(), 3),
+            'download_s': percentiles(d['download_s'] for d in done),
+            'update_s': percentiles(d['update_s'] for d in done),
+            'total_s': percentiles(d['total_s'] for d in done),
+            'devices': devices,
+        }
+
+
+async def select_devices(leshan, args):
+    endpoints = [c['endpoint'] for c in await leshan.clients()
+                 if 'endpoint' in c and
+                 (not args.client or args.client in c['endpoint'])]
+    if args.device:
+        types = await asyncio.gather(
+            *(leshan.read(ep, DEVICE_TYPE) for ep in endpoints),
+            return_exceptions=True)
+        endpoints = [ep for ep, t in zip(endpoints, types)
+                     if t == args.device]
+    return sorted(endpoints)
+
+
+async def main_async(args):
+    timeout = aiohttp.ClientTimeout(total=args.request_timeout)
+    connector = aiohttp.TCPConnector(limit=args.concurrency + 1)
+    async with aiohttp.ClientSession(
+            timeout=timeout, connector=connector,
+            headers={'Content-Type': 'application/json'}) as session:
+        leshan = Leshan(session, args.hostname)
+        endpoints = await select_devices(leshan, args)
+        if not endpoints:
+            print('No devices to update')
+            return 1
+
+        devices = [Device(leshan, ep) for ep in endpoints]
+        leshan.devices = {d.endpoint: d for d in devices}
+        rollout = Rollout(args, leshan, devices)
+
+        connected = asyncio.Event()
+        events = asyncio.ensure_future(leshan.follow_events(connected))
+        await asyncio.wait_for(connected.wait(), args.request_timeout)
+
+        loop = asyncio.get_event_loop()
+
+        def abort():
+            print('Aborting: waiting for updates in progress')
+            rollout.aborted = True
+
+        loop.add_signal_handler(signal.SIGINT, abort)
+        start = time.time()
+        try:
+            await rollout.run()
+        finally:
+            events.cancel()
+
+        summary = rollout.summary()
+        summary['duration_s'] = round(time.time() - start, 3)
+        if args.summary:
+            with open(args.summary, 'w') as f:
+                json.dump(summary, f, indent=2)
+        print('%d devices: %s in %d seconds' % (
+            len(devices), ', '.join('%d %s' % (n, o) for o, n in
+                                    sorted(summary['counts'].items())),
+            summary['duration_s']))
+
+        return 0 if summary['counts'].get('success') == len(devices) else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-u', '--url', required=True,
+                        help='firmware package URI (http:// or coap://)')
+    parser.add_argument('-host', '--hostname',
+                        default='https://mgmt.foundries.io/leshan',
+                        help='Leshan server URL')
+    parser.add_argument('-c', '--client',
+                        help='only update endpoints containing this string')
+    parser.add_argument('-d', '--device', help='device type (3/0/1) filter')
+    parser.add_argument('-n', '--concurrency', type=int, default=50,
+                        help='devices updated at once')
+    parser.add_argument('-s', '--stages', default='1,10%,100%',
+                        help='cumulative device counts or percentages')
+    parser.add_argument('--max-failure-rate', type=float, default=0.1,
+                        help='failure share halting the rollout')
+    parser.add_argument('--min-samples', type=int, default=1,
+                        help='finished devices before halting is considered')
+    parser.add_argument('--download-timeout', type=int, default=1800,
+                        help='seconds allowed to download the image')
+    parser.add_argument('--update-timeout', type=int, default=600,
+                        help='seconds allowed to apply it and register')
+    parser.add_argument('--poll', type=int, default=60,
+                        help='seconds between reads when no notification '
+                             'arrives')
+    parser.add_argument('--request-timeout', type=int, default=60,
+                        help='seconds allowed for each Leshan request')
+    parser.add_argument('-o', '--summary', help='write a JSON summary here')
+    args = parser.parse_args()
+
+    loop = asyncio.get_event_loop()
+    sys.exit(loop.run_until_complete(main_async(args)))
+
+
+if __name__ == '__main__':
+    main()
@@ -1,8 +1,9 @@
 #!/usr/bin/env python3
 
 """Helper script to generate images which contain LWM2M metadata.
-Use this script to generate a binary which contains the LWM2M device ID
-and device token. (run with -h for usage).
+Use this script to generate a binary which contains the LWM2M device ID,
+DTLS pre-shared key and, optionally, raw public keys or certificates
+(run with -h for usage).
 Then flash a board as follows:
 1. Flash mcuboot, performing a chip erase
 2. Flash the LWM2M credentials binary
@@ -17,20 +18,69 @@ Using the -b argument allows you to flash different boards with different
 LWM2M credentials binaries.
 Refer to the value FLASH_AREA_CREDENTIALS_STATE_OFFSET in the Genesis build
 output file outdir/$APP/$BOARD/app/include/generated/generated_dts_board.h for
-your board for the base address of the LWM2M credentials partition."""
+your board for the base address of the LWM2M credentials partition.
+
+Layout (version 1, all integers little endian):
+    u32 magic "LWCR" | u8 version | u8 reserved | u16 length | u32 crc32
+followed by `length` bytes of records, each
+    u8 type | u16 length | value
+The CRC-32 (IEEE) covers the records. Use --legacy to write the old
+fixed layout (two NUL terminated 33 byte strings) for firmware which
+predates version 1."""
 
 
 import argparse
+import binascii
+import struct
 import sys
+import zlib
 
 LWM2M_DEVICE_ID_SIZE = 32 + 1
 LWM2M_DEVICE_TOKEN_SIZE = 32 + 1
+LWM2M_DEVICE_PSK_MAX_SIZE = 32
+
+CREDENTIALS_MAGIC = b'LWCR'
+CREDENTIALS_VERSION = 1
+HEADER_FORMAT = '<4sBBHI'
+
+TLV_DEVICE_ID = 1
+TLV_PSK = 2
+TLV_RPK_PUBLIC = 3
+TLV_RPK_PRIVATE = 4
+TLV_CERTIFICATE = 5
+TLV_CA_CERTIFICATE = 6
+
+DEFAULT_PARTITION_SIZE = 0x1000
+
+
+def build_legacy(device_id, device_token):
+    return (bytearray(device_id) + bytearray([0x00]) +
+            bytearray(device_token) + bytearray([0x00]))
+
+
+def tlv(rtype, value):
+    if len(value) > 0xffff:
+        raise ValueError('record %d too large' % rtype)
+    return struct.pack('<BH', rtype, len(value)) + value
 
 
-def write_state(device_id, device_token, out):
-    state = (bytearray(device_id) + bytearray([0x00]) +
-             bytearray(device_token) + bytearray([0x00]))
-    out.write(state)
+def build_v1(records):
+    body = b''.join(tlv(rtype, value) for rtype, value in records)
+    header = struct.pack(HEADER_FORMAT, CREDENTIALS_MAGIC,
+                         CREDENTIALS_VERSION, 0, len(body),
+                         zlib.crc32(body) & 0xffffffff)
+    return header + body
+
+
+def fail(parser, msg):
+    print(msg, file=sys.stderr)
+    parser.print_help()
+    sys.exit(1)
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        return f.read()
 
 
 def main():
@@ -41,7 +91,22 @@ def main():
     parser.add_argument('-did', '--device-id',
                         required=True, help='Device unique ID')
     parser.add_argument('-dtok', '--device-token', default='',
-                        required=False, help='Device token')
+                        required=False,
+                        help='Device token (DTLS PSK) as a hex string')
+    parser.add_argument('--rpk-public', default=None,
+                        help='DER encoded raw public key file')
+    parser.add_argument('--rpk-private', default=None,
+                        help='DER encoded raw public key private part')
+    parser.add_argument('--cert', default=None,
+                        help='DER encoded device certificate file')
+    parser.add_argument('--ca-cert', default=None,
+                        help='DER encoded server CA certificate file')
+    parser.add_argument('--partition-size', type=lambda x: int(x, 0),
+                        default=DEFAULT_PARTITION_SIZE,
+                        help='Credentials partition size (default: 0x%x)' %
+                        DEFAULT_PARTITION_SIZE)
+    parser.add_argument('--legacy', action='store_true',
+                        help='Write the unversioned layout for old firmware')
     parser.add_argument('-o', '--output',
                         default=sys.stdout,
                         help='Output file (default: stdout)')
@@ -49,25 +114,48 @@ def main():
     args = parser.parse_args(sys.argv[1:])
 
     if len(args.device_id) > LWM2M_DEVICE_ID_SIZE - 1:
-        print('Invalid device ID (length should be up to ' +
-              str(LWM2M_DEVICE_ID_SIZE - 1) + ')', file=sys.stderr)
-        parser.print_help()
-        sys.exit(1)
-
-    if len(args.device_token) > LWM2M_DEVICE_TOKEN_SIZE - 1:
-        print('Invalid device token (length should be up to ' +
-              str(LWM2M_DEVICE_TOKEN_SIZE - 1) + ')', file=sys.stderr)
-        parser.print_help()
-        sys.exit(1)
-
-    did, dtok = (x.ljust(32, '\0').encode('ascii') for x in
-                       (args.device_id, args.device_token))
+        fail(parser, 'Invalid device ID (length should be up to ' +
+             str(LWM2M_DEVICE_ID_SIZE - 1) + ')')
+
+    if args.legacy:
+        if len(args.device_token) > LWM2M_DEVICE_TOKEN_SIZE - 1:
+            fail(parser, 'Invalid device token (length should be up to ' +
+                 str(LWM2M_DEVICE_TOKEN_SIZE - 1) + ')')
+        if args.rpk_public or args.rpk_private or args.cert or args.ca_cert:
+            fail(parser, 'Keys and certificates need the versioned layout')
+
+        did, dtok = (x.ljust(32, '\0').encode('ascii') for x in
+                     (args.device_id, args.device_token))
+        image = build_legacy(did, dtok)
+    else:
+        try:
+            psk = binascii.unhexlify(args.device_token)
+        except (binascii.Error, ValueError):
+            fail(parser, 'Invalid device token (not a hex string)')
+        if len(psk) > LWM2M_DEVICE_PSK_MAX_SIZE:
+            fail(parser, 'Invalid device token (length should be up to ' +
+                 str(LWM2M_DEVICE_PSK_MAX_SIZE) + ' bytes)')
+
+        records = [(TLV_DEVICE_ID, args.device_id.encode('ascii'))]
+        if psk:
+            records.append((TLV_PSK, psk))
+        for rtype, path in ((TLV_RPK_PUBLIC, args.rpk_public),
+                            (TLV_RPK_PRIVATE, args.rpk_private),
+                            (TLV_CERTIFICATE, args.cert),
+                            (TLV_CA_CERTIFICATE, args.ca_cert)):
+            if path:
+                records.append((rtype, read_file(path)))
+        image = build_v1(records)
+
+    if len(image) > args.partition_size:
+        fail(parser, 'Credentials (%d bytes) do not fit in the partition '
+             '(%d bytes)' % (len(image), args.partition_size))
 
     if args.output is sys.stdout:
-        write_state(did, dtok, sys.stdout.buffer)
+        sys.stdout.buffer.write(image)
     else:
         with open(args.output, 'wb') as out:
-            write_state(did, dtok, out)
+            out.write(image)
 
 
 if __name__ == '__main__':
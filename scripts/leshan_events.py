@@ -0,0 +1,234 @@
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Registered endpoint index fed by the Leshan server's event stream.
+
+Instead of polling GET /api/clients, which returns every client on every
+call, the index reads the list once and then follows the server-sent
+events of the Leshan web API (GET /event): REGISTRATION, UPDATED and
+DEREGISTRATION. Scripts waiting for devices to come and go wake up as
+soon as the event arrives. NOTIFICATION events, sent for resources
+observed through the server, are passed on to notification listeners.
+
+The stream is reopened, and the list read again, whenever the connection
+drops, so events missed meanwhile cannot leave the index stale.
+
+To try it against a local server:
+    java -jar leshan-server-demo.jar
+    ./wait_for_targets.py -host http://localhost:8080 -t 1"""
+
+import json
+import logging
+import threading
+import time
+
+import requests
+
+REGISTRATION = 'REGISTRATION'
+UPDATED = 'UPDATED'
+DEREGISTRATION = 'DEREGISTRATION'
+NOTIFICATION = 'NOTIFICATION'
+
+RECONNECT_DELAY = 1
+RECONNECT_DELAY_MAX = 30
+
+
+class Registration:
+    """What the index knows about one registered endpoint."""
+
+    def __init__(self, data, when):
+        self.endpoint = data['endpoint']
+        self.registration_id = data.get('registrationId')
+        # Local time the registration, or its last update, was seen
+        self.registered = when
+        self.updated = when
+
+
+class EndpointIndex:
+    """Endpoints currently registered to a Leshan server.
+
+    Listeners added with add_listener() are called, from the event
+    thread, with (event, endpoint, registration or None, time).
+    Notification listeners are called with (endpoint, path, value,
+    time), path without a leading slash."""
+
+    def __init__(self, hostname, session=None):
+        self.hostname = hostname
+        self.session = session or requests.Session()
+        self.endpoints = {}
+        self.connected = False
+        self._listeners = []
+        self._notification_listeners = []
+        self._changed = threading.Condition()
+        self._stop = False
+        self._thread = threading.Thread(name='leshan-events',
+                                        target=self._run, daemon=True)
+
+    def start(self, timeout=30):
+        """Start following events; returns once the index is seeded."""
+        self._thread.start()
+        with self._changed:
+            if not self._changed.wait_for(lambda: self.connected, timeout):
+                raise TimeoutError('cannot reach %s' % self.hostname)
+        return self
+
+    def stop(self):
+        """Stop following events. The event thread is a daemon, left
+        blocked on the stream until the next event or exit."""
+        self._stop = True
+
+    def add_listener(self, listener):
+        self._listeners.append(listener)
+
+    def add_notification_listener(self, listener):
+        self._notification_listeners.append(listener)
+
+    def count(self, match=None):
+        with self._changed:
+            return len(self._select(match))
+
+    def snapshot(self, match=None):
+        """Registrations of the matching endpoints, by endpoint name."""
+        with self._changed:
+            return {ep: self.endpoints[ep] for ep in self._select(match)}
+
+    def wait(self, predicate, timeout=None):
+        """Wait until predicate(index) holds; returns its last value.
+
+        The predicate runs with the index locked, on every change."""
+        with self._changed:
+            return self._changed.wait_for(lambda: predicate(self), timeout)
+
+    def wait_count(self, count, match=None, timeout=None):
+        """Wait for at least count matching endpoints to be registered."""
+        return self.wait(lambda idx: len(idx._select(match)) >= count,
+                         timeout)
+
+    def wait_registered(self, previous, timeout=None):
+        """Wait for every endpoint of a snapshot to register again, e.g.
+        after a reboot: a new registration ID, not an update, counts.
+
+        Returns the endpoints which did not, empty on success."""
+        def pending(idx):
+            return [ep for ep, reg in previous.items()
+                    if ep not in idx.endpoints or
+                    idx.endpoints[ep].registration_id == reg.registration_id]
+
+        self.wait(lambda idx: not pending(idx), timeout)
+        with self._changed:
+            return pending(self)
+
+    def _select(self, match):
+        if not match:
+            return list(self.endpoints)
+        return [ep for ep in self.endpoints if match in ep]
+
+    def _seed(self):
+        response = self.session.get('%s/api/clients' % self.hostname)
+        response.raise_for_status()
+        now = time.time()
+        with self._changed:
+            known = self.endpoints
+            self.endpoints = {}
+            for data in response.json():
+                if 'endpoint' not in data:
+                    continue
+                reg = known.get(data['endpoint'])
+                if reg is None or \
+                        reg.registration_id != data.get('registrationId'):
+                    reg = Registration(data, now)
+                self.endpoints[reg.endpoint] = reg
+            self.connected = True
+            self._changed.notify_all()
+
+    def _event(self, event, data):
+        try:
+            payload = json.loads(data)
+        except ValueError:
+            return
+        if event == NOTIFICATION:
+            # {"ep": ..., "res": "/3311/0/5850", "val": {"id": ..., "value": ...}}
+            self._notification(payload)
+            return
+        if event == UPDATED:
+            # {"registration": ..., "update": ...}
+            payload = payload.get('registration', payload)
+        endpoint = payload.get('endpoint')
+        if not endpoint:
+            return
+
+        now = time.time()
+        with self._changed:
+            if event == REGISTRATION:
+                reg = Registration(payload, now)
+                self.endpoints[endpoint] = reg
+            elif event == UPDATED:
+                reg = self.endpoints.get(endpoint)
+                if reg is None:
+                    reg = Registration(payload, now)
+                    self.endpoints[endpoint] = reg
+                reg.updated = now
+            elif event == DEREGISTRATION:
+                reg = self.endpoints.get(endpoint)
+                # A late deregistration of a replaced registration
+                if reg and reg.registration_id not in (
+                        None, payload.get('registrationId')):
+                    return
+                reg = self.endpoints.pop(endpoint, None)
+            else:
+                return
+            self._changed.notify_all()
+
+        for listener in self._listeners:
+            listener(event, endpoint, reg, now)
+
+    def _notification(self, payload):
+        endpoint = payload.get('ep')
+        value = payload.get('val')
+        if not endpoint or not isinstance(value, dict):
+            return
+        now = time.time()
+        path = payload.get('res', '').strip('/')
+        for listener in self._notification_listeners:
+            listener(endpoint, path, value.get('value'), now)
+
+    def _follow(self):
+        response = self.session.get(
+            '%s/event' % self.hostname, stream=True,
+            headers={'Accept': 'text/event-stream'}, timeout=(10, None))
+        response.raise_for_status()
+
+        # Events from here on are seen: now it is safe to read the list
+        self._seed()
+
+        event, data = None, []
+        for line in response.iter_lines(decode_unicode=True):
+            if self._stop:
+                return
+            if line is None:
+                continue
+            if not line:
+                if event and data:
+                    self._event(event, '\n'.join(data))
+                event, data = None, []
+            elif line.startswith('event:'):
+                event = line[6:].strip()
+            elif line.startswith('data:'):
+                data.append(line[5:].lstrip())
+
+    def _run(self):
+        delay = RECONNECT_DELAY
+        while not self._stop:
+            try:
+                self._follow()
+                delay = RECONNECT_DELAY
+            except (requests.RequestException, ValueError) as e:
+                if self._stop:
+                    return
+                logging.warning('Leshan event stream: %s', e)
+            with self._changed:
+                self.connected = False
+            if not self._stop:
+                time.sleep(delay)
+                delay = min(delay * 2, RECONNECT_DELAY_MAX)
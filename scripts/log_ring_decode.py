@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Fetch and decode the binary log ring of a device built with CONFIG_FOTA_LOG_RING.
+
+The device stores log messages unformatted: source ID, level, timestamp,
+the address of the format string and the raw 32-bit arguments. This script
+reads the ring through the log ring LwM2M object (26242) on a Leshan
+server, or from a file holding the raw records, and formats the messages
+using the zephyr.elf the device runs, which must be the exact same build.
+
+Examples:
+    ./log_ring_decode.py -e build/zephyr/zephyr.elf \\
+        -s https://mgmt.foundries.io/leshan -c nrf52_blenano2-1234
+    ./log_ring_decode.py -e build/zephyr/zephyr.elf -i ring.bin
+
+String (%s) arguments are only recovered when they point into read-only
+data; others are printed as addresses."""
+
+import argparse
+import re
+import struct
+import sys
+
+import requests
+from elftools.elf.elffile import ELFFile
+from elftools.elf.sections import SymbolTableSection
+
+LOG_RING_OBJECT = 26242
+OLDEST = 0
+NEWEST = 1
+OFFSET = 2
+CHUNK = 3
+DROPPED = 4
+TIMESTAMP_FREQ = 5
+
+# Must match the record layout in src/log_ring.c
+REC_HDR = struct.Struct('<BBHII')
+REC_LEVEL_MASK = 0x07
+REC_HEXDUMP = 0x08
+
+LEVELS = {1: 'err', 2: 'wrn', 3: 'inf', 4: 'dbg'}
+
+# printf conversions, with the flags, width, precision and length
+# modifiers the Zephyr logger accepts
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(\.\d+)?(hh|h|ll|l|z|j|t)?'
+                        r'([diouxXcsp%])')
+
+headers = {'Content-Type': 'application/json'}
+
+
+class Image:
+    """Resolves addresses and log source IDs against an ELF file."""
+
+    def __init__(self, path):
+        self.elf = ELFFile(open(path, 'rb'))
+        self.sections = [s for s in self.elf.iter_sections()
+                         if s['sh_flags'] & 0x2 and s['sh_type'] != 'SHT_NOBITS']
+        self.sources = self._log_sources()
+
+    def _log_sources(self):
+        # Source IDs are indexes into the log_const section, which the
+        # linker sorts by name: sort the constants by address instead.
+        symtab = self.elf.get_section_by_name('.symtab')
+        if not isinstance(symtab, SymbolTableSection):
+            return []
+        consts = [(sym['st_value'], sym.name[len('log_const_'):])
+                  for sym in symtab.iter_symbols()
+                  if sym.name.startswith('log_const_')]
+        return [name for _, name in sorted(consts)]
+
+    def source(self, source_id):
+        if source_id < len(self.sources):
+            return self.sources[source_id]
+        return 'source%d' % source_id
+
+    def string(self, address):
+        for section in self.sections:
+            start = section['sh_addr']
+            if start <= address < start + section['sh_size']:
+                data = section.data()[address - start:]
+                return data[:data.find(b'\0')].decode('utf-8', 'replace')
+        return None
+
+
+def format_message(image, fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, length, conv = match.groups()
+        if conv == '%':
+            return '%'
+        if not args:
+            return match.group(0)
+        value = args.pop(0)
+        if length == 'll' and args:
+            value |= args.pop(0) << 32
+        spec = '%' + flags + width + (precision or '')
+        if conv == 's':
+            string = image.string(value)
+            return spec % string if string is not None else '<0x%08x>' % value
+        if conv == 'p':
+            return '0x%08x' % value
+        if conv == 'c':
+            return chr(value & 0xff)
+        if conv in 'di':
+            bits = 64 if length == 'll' else 32
+            if value & (1 << (bits - 1)):
+                value -= 1 << bits
+            conv = 'd'
+        elif conv == 'u':
+            conv = 'd'
+        return (spec + conv) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(image, data, freq):
+    pos = 0
+    while pos + REC_HDR.size <= len(data):
+        flags, count, source, timestamp, fmt_addr = \
+            REC_HDR.unpack_from(data, pos)
+        hexdump = flags & REC_HEXDUMP
+        length = REC_HDR.size + (count if hexdump else count * 4)
+        if pos + length > len(data):
+            # Partial record at the end of the data read so far
+            break
+
+        payload = data[pos + REC_HDR.size:pos + length]
+        fmt = image.string(fmt_addr)
+        if fmt is None:
+            fmt = '<unknown format 0x%08x>' % fmt_addr
+
+        if hexdump:
+            text = fmt + ' ' + payload.hex()
+        else:
+            text = format_message(image, fmt,
+                                  struct.unpack('<%dI' % count, payload))
+
+        print('[%10.3f] <%s> %s: %s' % (timestamp / freq if freq else 0,
+                                         LEVELS.get(flags & REC_LEVEL_MASK,
+                                                    '?'),
+                                         image.source(source), text))
+        pos += length
+
+    return pos
+
+
+def resource_url(hostname, client, res):
+    return '%s/api/clients/%s/%d/0/%d' % (hostname, client,
+                                          LOG_RING_OBJECT, res)
+
+
+def read(hostname, client, res):
+    response = requests.get(resource_url(hostname, client, res),
+                            headers=headers)
+    if response.status_code not in (200, 201):
+        sys.exit('Failed to read resource %d: %s' % (res, response))
+    return response.json()['content']['value']
+
+
+def write(hostname, client, res, value):
+    response = requests.put(resource_url(hostname, client, res),
+                            json={'id': res, 'value': value},
+                            headers=headers)
+    if response.status_code not in (200, 201):
+        sys.exit('Failed to write resource %d: %s' % (res, response))
+
+
+def behind(a, b):
+    """Whether stream position a is before b, allowing for wrap around."""
+    return 0 < (b - a) & 0xffffffff < 0x80000000
+
+
+def fetch(hostname, client, image):
+    freq = read(hostname, client, TIMESTAMP_FREQ)
+    offset = read(hostname, client, OLDEST)
+    newest = read(hostname, client, NEWEST)
+    pending = b''
+
+    while behind(offset, newest):
+        # Records evicted while reading are gone: skip to the oldest
+        oldest = read(hostname, client, OLDEST)
+        if behind(offset, oldest):
+            print('--- %d bytes lost ---' % ((oldest - offset) & 0xffffffff))
+            offset = oldest
+            pending = b''
+
+        write(hostname, client, OFFSET, offset)
+        chunk = bytes.fromhex(read(hostname, client, CHUNK))
+        if not chunk:
+            break
+
+        offset = (offset + len(chunk)) & 0xffffffff
+        pending += chunk
+        pending = pending[decode(image, pending, freq):]
+
+    print('--- %d messages dropped ---' % read(hostname, client, DROPPED))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-e', '--elf', required=True,
+                        help='zephyr.elf of the build running on the device')
+    parser.add_argument('-s', '--server', default='https://mgmt.foundries.io/leshan',
+                        help='Leshan server URL')
+    parser.add_argument('-c', '--client', help='device endpoint name')
+    parser.add_argument('-i', '--input',
+                        help='decode raw records from this file instead')
+    parser.add_argument('-f', '--freq', type=int, default=32768,
+                        help='timestamp frequency for --input, in Hz')
+    args = parser.parse_args()
+
+    image = Image(args.elf)
+
+    if args.input:
+        with open(args.input, 'rb') as f:
+            decode(image, f.read(), args.freq)
+    elif args.client:
+        fetch(args.server, args.client, image)
+    else:
+        parser.error('either --client or --input is required')
+
+
+if __name__ == '__main__':
+    main()
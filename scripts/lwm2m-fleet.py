@@ -0,0 +1,755 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Simulate a fleet of LwM2M devices running this application.
+
+Every simulated device is a CoAP endpoint with its own UDP socket, all in
+one process, which registers to the LwM2M server the way the firmware
+does:
+
+- endpoint name "<prefix>:sn:<serial>", where the serial number is
+  derived from a device ID exactly as the native_posix build derives it
+  from --device-id, so simulated and native_posix devices do not clash;
+- Device (3), Firmware Update (5), Temperature (3303) and Light
+  Control (3311) objects, readable and observable in plain text or TLV;
+- Firmware Update pulls the package URI written to 5/0/1 block-wise
+  over coap://, or accepts it pushed to 5/0/0, then executing 5/0/2 or
+  3/0/4 reboots the device, which registers again.
+
+Registrations are paced with --rate, and --storm re-registers the whole
+fleet at once, as after a power cut, every so many seconds. Observed
+temperatures are notified every --notify seconds; --downloads bounds the
+firmware downloads running at once.
+
+The latency of every exchange with the server (registration, update,
+notification acknowledgement, firmware block) is recorded, and
+percentiles are printed every --report seconds and at exit, and written
+to --json.
+
+Example, 1000 devices against a local Leshan:
+    ./lwm2m-fleet.py -s localhost -n 1000 --rate 100 --notify 10"""
+
+import argparse
+import asyncio
+import json
+import math
+import random
+import resource
+import signal
+import socket
+import struct
+import time
+import urllib.parse
+
+import coaplib
+from coap_endpoint import Endpoint, ResetError
+
+LWM2M_VERSION = '1.0'
+BLOCK_SIZE = 256
+
+# Firmware Update state (5/0/3) and result (5/0/5)
+STATE_IDLE = 0
+STATE_DOWNLOADING = 1
+STATE_DOWNLOADED = 2
+STATE_UPDATING = 3
+RESULT_DEFAULT = 0
+RESULT_SUCCESS = 1
+RESULT_INVALID_URI = 7
+
+TLV_RESOURCE = 0xc0
+
+METHODS = {coaplib.GET: 'get', coaplib.POST: 'post', coaplib.PUT: 'put',
+           coaplib.DELETE: 'delete'}
+
+
+def serial_number(device_id):
+    """product_id_init(): hash of the hex device ID words."""
+    h = 0
+    for c in b'%08x' % device_id:
+        h = (h * 37 + c) & 0xffffffff
+    return '%08x' % h
+
+
+def tlv_encode_value(value):
+    if isinstance(value, bool):
+        return bytes([value])
+    if isinstance(value, int):
+        for size, fmt in ((1, '!b'), (2, '!h'), (4, '!i')):
+            if -(1 << (size * 8 - 1)) <= value < (1 << (size * 8 - 1)):
+                return struct.pack(fmt, value)
+        return struct.pack('!q', value)
+    if isinstance(value, float):
+        return struct.pack('!d', value)
+    if isinstance(value, str):
+        return value.encode('utf-8')
+    return bytes(value)
+
+
+def tlv_encode(res_id, value):
+    data = tlv_encode_value(value)
+    header = TLV_RESOURCE
+    id_bytes = bytes([res_id])
+    if res_id > 0xff:
+        header |= 0x20
+        id_bytes = struct.pack('!H', res_id)
+    if len(data) < 8:
+        header |= len(data)
+        length = b''
+    elif len(data) <= 0xff:
+        header |= 0x08
+        length = bytes([len(data)])
+    elif len(data) <= 0xffff:
+        header |= 0x10
+        length = struct.pack('!H', len(data))
+    else:
+        header |= 0x18
+        length = struct.pack('!I', len(data))[1:]
+    return bytes([header]) + id_bytes + length + data
+
+
+def tlv_decode(data):
+    """Resources of a TLV payload, as (id, bytes)."""
+    pos = 0
+    while pos < len(data):
+        header = data[pos]
+        pos += 1
+        id_len = 2 if header & 0x20 else 1
+        res_id = int.from_bytes(data[pos:pos + id_len], 'big')
+        pos += id_len
+        length_type = (header >> 3) & 0x3
+        if length_type:
+            length = int.from_bytes(data[pos:pos + length_type], 'big')
+            pos += length_type
+        else:
+            length = header & 0x7
+        yield res_id, bytes(data[pos:pos + length])
+        pos += length
+
+
+def decode_value(current, data, text):
+    """Decode a written value to the type of the current one."""
+    if isinstance(current, bool):
+        return data.strip() in (b'1', b'true') if text else data != b'\0'
+    if isinstance(current, int):
+        return int(data) if text else int.from_bytes(data, 'big',
+                                                      signed=True)
+    if isinstance(current, float):
+        if text:
+            return float(data)
+        return struct.unpack('!d' if len(data) == 8 else '!f', data)[0]
+    if isinstance(current, str):
+        return data.decode('utf-8')
+    return data
+
+
+def text_encode(value):
+    if isinstance(value, bool):
+        return b'1' if value else b'0'
+    if isinstance(value, (bytes, bytearray)):
+        return bytes(value)
+    return str(value).encode('utf-8')
+
+
+class Stats:
+    """Latencies and errors by exchange."""
+
+    def __init__(self):
+        self.latencies = {}
+        self.errors = {}
+        self.counters = {}
+
+    def record(self, name, seconds):
+        self.latencies.setdefault(name, []).append(seconds)
+
+    def error(self, name):
+        self.errors[name] = self.errors.get(name, 0) + 1
+
+    def count(self, name, n=1):
+        self.counters[name] = self.counters.get(name, 0) + n
+
+    @staticmethod
+    def percentiles(values):
+        values = sorted(values)
+
+        def pct(p):
+            return values[min(len(values) - 1,
+                              max(0, math.ceil(p / 100 * len(values)) - 1))]
+
+        return {'count': len(values), 'p50': pct(50), 'p90': pct(90),
+                'p99': pct(99), 'max': values[-1]}
+
+    def summary(self):
+        return {
+            'latency_ms': {name: {k: (round(v * 1000, 1) if k != 'count'
+                                      else v)
+                                  for k, v in self.percentiles(values).items()}
+                           for name, values in sorted(self.latencies.items())
+                           if values},
+            'errors': dict(sorted(self.errors.items())),
+            'counters': dict(sorted(self.counters.items())),
+        }
+
+    def print(self, fleet):
+        summary = self.summary()
+        print('%d/%d registered, %d downloading, %d CON retransmissions' % (
+            fleet.registered(), len(fleet.devices), fleet.downloading,
+            fleet.retransmissions()))
+        print('  %-14s %7s %9s %9s %9s %9s %7s' % (
+            'exchange', 'count', 'p50 ms', 'p90 ms', 'p99 ms', 'max ms',
+            'errors'))
+        names = sorted(set(summary['latency_ms']) | set(summary['errors']))
+        for name in names:
+            lat = summary['latency_ms'].get(name, {})
+            print('  %-14s %7d %9s %9s %9s %9s %7d' % (
+                name, lat.get('count', 0), lat.get('p50', '-'),
+                lat.get('p90', '-'), lat.get('p99', '-'),
+                lat.get('max', '-'), summary['errors'].get(name, 0)))
+
+
+class Observation:
+    def __init__(self, token, content_format):
+        self.token = token
+        self.content_format = content_format
+        self.seq = 2
+
+
+class Device:
+    def __init__(self, fleet, device_id):
+        self.fleet = fleet
+        self.args = fleet.args
+        self.serial = serial_number(device_id)
+        self.endpoint_name = '%s:sn:%s' % (self.args.prefix, self.serial)
+        self.endpoint = None
+        self.location = None
+        self.observations = {}
+        self.reboot_event = asyncio.Event()
+        self.firmware = bytearray()
+        self.version = self.args.firmware_version
+        self.resources = {
+            (3, 0, 0): 'Zephyr',
+            (3, 0, 1): self.args.board,
+            (3, 0, 2): self.serial,
+            (3, 0, 3): self.version,
+            (3, 0, 17): 'Zephyr OMA-LWM2M Client',
+            (5, 0, 1): '',
+            (5, 0, 3): STATE_IDLE,
+            (5, 0, 5): RESULT_DEFAULT,
+            (5, 0, 9): 2,
+            (3303, 0, 5700): round(random.uniform(18, 26), 2),
+            (3303, 0, 5701): 'Cel',
+            (3311, 0, 5850): False,
+        }
+        # Write handlers by resource; other resources are read-only
+        self.writable = {
+            (5, 0, 1): self.package_uri_written,
+            (3311, 0, 5850): None,
+        }
+        self.executable = {
+            (3, 0, 4): self.reboot,
+            (5, 0, 2): self.update,
+        }
+
+    @property
+    def objects(self):
+        return sorted({(o, i) for o, i, _ in self.resources})
+
+    def set(self, path, value):
+        if self.resources.get(path) == value:
+            return
+        self.resources[path] = value
+        if path in self.observations:
+            asyncio.ensure_future(self.notify(path))
+
+    # Registration interface
+
+    async def rd_request(self, name, code, path, queries=(), payload=b''):
+        msg = coaplib.Message(coaplib.CON, code, token=coaplib.new_token())
+        msg.uri_path = path
+        for query in queries:
+            msg.add_option(coaplib.URI_QUERY, query)
+        if payload:
+            msg.add_option(coaplib.CONTENT_FORMAT,
+                           coaplib.FORMAT_LINK_FORMAT)
+            msg.payload = payload
+        start = time.monotonic()
+        try:
+            response = await self.endpoint.request(msg, self.fleet.server)
+        except (asyncio.TimeoutError, ResetError):
+            self.fleet.stats.error(name)
+            return None
+        if response.code >= coaplib.BAD_REQUEST:
+            self.fleet.stats.error(name)
+            return None
+        self.fleet.stats.record(name, time.monotonic() - start)
+        return response
+
+    async def register(self):
+        links = ','.join('</%d/%d>' % obj for obj in self.objects)
+        response = await self.rd_request(
+            'register', coaplib.POST, 'rd',
+            ('ep=%s' % self.endpoint_name, 'lt=%d' % self.args.lifetime,
+             'lwm2m=%s' % LWM2M_VERSION, 'b=U'),
+            ('<>;rt="oma.lwm2m",' + links).encode())
+        if response is None:
+            return False
+        self.location = '/'.join(v.decode('utf-8') for v in
+                                 response.get_options(coaplib.LOCATION_PATH))
+        return True
+
+    async def deregister(self):
+        if self.location:
+            await self.rd_request('deregister', coaplib.DELETE,
+                                  self.location)
+            self.location = None
+
+    async def open(self):
+        loop = asyncio.get_event_loop()
+        self.endpoint = Endpoint(self.request_received)
+        await loop.create_datagram_endpoint(
+            lambda: self.endpoint, family=self.fleet.family,
+            local_addr=(self.fleet.local_address, 0))
+
+    def close(self):
+        if self.endpoint:
+            self.fleet.closed_retransmissions += \
+                self.endpoint.retransmissions
+            self.endpoint.transport.close()
+            self.endpoint = None
+
+    async def run(self, delay):
+        await asyncio.sleep(delay)
+        while not self.fleet.stopping:
+            await self.open()
+            self.observations = {}
+            backoff = 1
+            while not await self.register():
+                if self.fleet.stopping:
+                    return
+                await asyncio.sleep(backoff * random.uniform(1, 1.5))
+                backoff = min(backoff * 2, 60)
+
+            await self.registered()
+            self.close()
+            if self.fleet.stopping:
+                return
+            # Boot time of the rebooted device
+            await asyncio.sleep(self.args.boot_time *
+                                random.uniform(0.8, 1.2))
+
+    async def registered(self):
+        """Registration updates and notifications until a reboot."""
+        self.reboot_event.clear()
+        self.fleet.stats.count('registrations')
+        update_period = self.args.lifetime * 0.9
+        next_update = time.monotonic() + update_period
+        next_notify = time.monotonic() + self.args.notify
+        while not self.fleet.stopping:
+            now = time.monotonic()
+            wake = min(next_update, next_notify) - now
+            try:
+                await asyncio.wait_for(self.reboot_event.wait(),
+                                       max(wake, 0))
+                break
+            except asyncio.TimeoutError:
+                pass
+
+            now = time.monotonic()
+            if now >= next_notify:
+                next_notify = now + self.args.notify
+                temp = self.resources[(3303, 0, 5700)]
+                self.set((3303, 0, 5700),
+                         round(temp + random.uniform(-0.5, 0.5), 2))
+            if now >= next_update:
+                next_update = now + update_period
+                if not await self.rd_request('update', coaplib.POST,
+                                             self.location):
+                    # Registration lost: start again
+                    self.location = None
+                    return
+        if self.fleet.stopping:
+            await self.deregister()
+        else:
+            # Rebooted without deregistering, as the firmware does
+            self.location = None
+
+    # Device management and information reporting interface
+
+    def read_payload(self, path, accept):
+        """Payload and content format of a resource or instance read."""
+        if len(path) == 3:
+            value = self.resources[path]
+            if accept == coaplib.FORMAT_OMA_TLV:
+                return tlv_encode(path[2], value), accept
+            if isinstance(value, (bytes, bytearray)):
+                return bytes(value), coaplib.FORMAT_OMA_OPAQUE
+            return text_encode(value), coaplib.FORMAT_OMA_PLAIN_TEXT
+        payload = b''.join(tlv_encode(r, v)
+                           for (o, i, r), v in sorted(self.resources.items())
+                           if (o, i) == path[:2] and
+                           (len(path) == 1 or i == path[1]))
+        return payload, coaplib.FORMAT_OMA_TLV
+
+    def exists(self, path):
+        return any(key[:len(path)] == path
+                   for key in list(self.resources) + list(self.executable))
+
+    async def request_received(self, endpoint, msg, peer):
+        self.fleet.stats.count('server_%s' % METHODS.get(msg.code, 'other'))
+        try:
+            path = tuple(int(p) for p in msg.uri_path.split('/') if p)
+        except ValueError:
+            path = ()
+        options = []
+        payload = b''
+
+        if not path or len(path) > 3 or not self.exists(path):
+            code = coaplib.NOT_FOUND
+        elif msg.code == coaplib.GET:
+            payload, fmt = self.read_payload(
+                path, msg.get_option(coaplib.ACCEPT))
+            code = coaplib.CONTENT
+            options.append((coaplib.CONTENT_FORMAT,
+                            coaplib.encode_uint(fmt)))
+            observe = msg.get_option(coaplib.OBSERVE)
+            if observe == 0 and len(path) == 3:
+                self.observations[path] = Observation(msg.token, fmt)
+                options.append((coaplib.OBSERVE, coaplib.encode_uint(1)))
+            elif observe == 1:
+                self.observations.pop(path, None)
+        elif msg.code == coaplib.POST and path in self.executable:
+            code = coaplib.CHANGED
+            asyncio.ensure_future(self.executable[path]())
+        elif msg.code == coaplib.PUT and not msg.payload:
+            # Write-Attributes: accepted, notifications keep --notify
+            code = coaplib.CHANGED
+        elif msg.code == coaplib.PUT and path == (5, 0, 0):
+            code, options = self.package_block_written(msg)
+        elif msg.code in (coaplib.PUT, coaplib.POST):
+            code = self.write(path, msg)
+        else:
+            code = coaplib.METHOD_NOT_ALLOWED
+
+        endpoint.respond(msg, peer, msg.make_response(code, payload,
+                                                      options))
+
+    def write(self, path, msg):
+        fmt = msg.get_option(coaplib.CONTENT_FORMAT)
+        if fmt == coaplib.FORMAT_OMA_TLV:
+            values = list(tlv_decode(msg.payload))
+            text = False
+        elif len(path) == 3:
+            values = [(path[2], msg.payload)]
+            text = fmt in (None, coaplib.FORMAT_OMA_PLAIN_TEXT,
+                           coaplib.FORMAT_TEXT_PLAIN)
+        else:
+            return coaplib.UNSUPPORTED_CONTENT_FORMAT
+
+        written = []
+        for res_id, data in values:
+            key = path[:2] + (res_id,)
+            if key not in self.writable:
+                return coaplib.METHOD_NOT_ALLOWED
+            try:
+                written.append((key, decode_value(self.resources[key],
+                                                  data, text)))
+            except (ValueError, struct.error, UnicodeDecodeError):
+                return coaplib.BAD_REQUEST
+
+        for key, value in written:
+            self.set(key, value)
+            if self.writable[key]:
+                self.writable[key](value)
+        return coaplib.CHANGED
+
+    async def notify(self, path):
+        observation = self.observations.get(path)
+        if not observation or not self.endpoint:
+            return
+        payload, fmt = self.read_payload(path, observation.content_format)
+        observation.seq = (observation.seq + 1) & 0xffffff
+        # Firmware state changes must not be lost
+        mtype = coaplib.CON if path[0] == 5 else self.args.notify_type
+        msg = coaplib.Message(mtype, coaplib.CONTENT,
+                              token=observation.token, payload=payload)
+        msg.add_option(coaplib.OBSERVE, observation.seq)
+        msg.add_option(coaplib.CONTENT_FORMAT, fmt)
+        self.fleet.stats.count('notifications')
+        if mtype != coaplib.CON:
+            msg.mid = self.endpoint.next_mid()
+            self.endpoint.send(msg, self.fleet.server)
+            return
+
+        start = time.monotonic()
+        try:
+            ack = await self.endpoint.send_con(msg, self.fleet.server)
+        except asyncio.TimeoutError:
+            self.fleet.stats.error('notify')
+            return
+        if ack.mtype == coaplib.RST:
+            # The server forgot the observation
+            self.observations.pop(path, None)
+            return
+        self.fleet.stats.record('notify', time.monotonic() - start)
+
+    # Firmware update
+
+    def package_uri_written(self, uri):
+        if not uri:
+            self.set((5, 0, 3), STATE_IDLE)
+            self.set((5, 0, 5), RESULT_DEFAULT)
+            return
+        if urllib.parse.urlsplit(uri).scheme != 'coap':
+            self.set((5, 0, 5), RESULT_INVALID_URI)
+            return
+        asyncio.ensure_future(self.download(uri))
+
+    def package_block_written(self, msg):
+        """Push delivery: Block1 writes to 5/0/0."""
+        block1 = msg.get_option(coaplib.BLOCK1)
+        num, more, size = coaplib.block_decode(block1 or 0)
+        if num == 0:
+            self.firmware = bytearray()
+            self.set((5, 0, 3), STATE_DOWNLOADING)
+            self.set((5, 0, 5), RESULT_DEFAULT)
+        self.firmware += msg.payload
+        self.fleet.stats.count('firmware_bytes', len(msg.payload))
+        options = []
+        if block1 is not None:
+            options.append((coaplib.BLOCK1, coaplib.encode_uint(block1)))
+        if block1 is not None and more:
+            return coaplib.CONTINUE, options
+        self.set((5, 0, 3), STATE_DOWNLOADED)
+        return coaplib.CHANGED, options
+
+    async def download(self, uri):
+        self.set((5, 0, 3), STATE_DOWNLOADING)
+        self.set((5, 0, 5), RESULT_DEFAULT)
+        async with self.fleet.download_slots:
+            self.fleet.downloading += 1
+            try:
+                await self.fetch(uri)
+                self.set((5, 0, 3), STATE_DOWNLOADED)
+            except (OSError, asyncio.TimeoutError, coaplib.CoapError) as e:
+                self.fleet.stats.error('download')
+                print('%s: download failed: %s' % (self.endpoint_name,
+                                                    e or type(e).__name__))
+                # Connection lost during download
+                self.set((5, 0, 3), STATE_IDLE)
+                self.set((5, 0, 5), 9)
+            finally:
+                self.fleet.downloading -= 1
+
+    async def fetch(self, uri):
+        parts = urllib.parse.urlsplit(uri)
+        loop = asyncio.get_event_loop()
+        infos = await loop.getaddrinfo(parts.hostname, parts.port or 5683,
+                                       type=socket.SOCK_DGRAM)
+        family, _, _, _, peer = infos[0]
+        # Firmware is pulled from a separate context, as on the device
+        endpoint = Endpoint()
+        await loop.create_datagram_endpoint(
+            lambda: endpoint, family=family,
+            local_addr=('::' if family == socket.AF_INET6 else '0.0.0.0', 0))
+        self.firmware = bytearray()
+        start = time.monotonic()
+        num = 0
+        try:
+            while True:
+                msg = coaplib.Message(coaplib.CON, coaplib.GET,
+                                      token=coaplib.new_token())
+                msg.uri_path = urllib.parse.unquote(parts.path)
+                msg.add_option(coaplib.BLOCK2, coaplib.block_encode(
+                    num, False, self.args.block_size))
+                block_start = time.monotonic()
+                response = await endpoint.request(msg, peer)
+                if response.code != coaplib.CONTENT:
+                    raise coaplib.CoapError(coaplib.code_str(response.code))
+                self.fleet.stats.record('block',
+                                        time.monotonic() - block_start)
+                self.fleet.stats.count('firmware_bytes',
+                                       len(response.payload))
+                self.firmware += response.payload
+                block2 = response.get_option(coaplib.BLOCK2)
+                if block2 is None or not coaplib.block_decode(block2)[1]:
+                    break
+                num += 1
+        finally:
+            self.fleet.closed_retransmissions += endpoint.retransmissions
+            endpoint.transport.close()
+        self.fleet.stats.record('download', time.monotonic() - start)
+
+    async def update(self):
+        if self.resources[(5, 0, 3)] != STATE_DOWNLOADED:
+            return
+        self.set((5, 0, 3), STATE_UPDATING)
+        await asyncio.sleep(self.args.flash_time)
+        self.version = '%s+%d' % (self.args.firmware_version,
+                                  len(self.firmware))
+        self.resources[(3, 0, 3)] = self.version
+        await self.reboot()
+        self.resources[(5, 0, 3)] = STATE_IDLE
+        self.resources[(5, 0, 5)] = RESULT_SUCCESS
+
+    async def reboot(self):
+        # The response must leave before the device goes away
+        await asyncio.sleep(0.1)
+        self.fleet.stats.count('reboots')
+        self.reboot_event.set()
+
+
+class Fleet:
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.devices = [Device(self, args.first_id + i)
+                        for i in range(args.count)]
+        self.download_slots = asyncio.Semaphore(args.downloads)
+        self.downloading = 0
+        self.closed_retransmissions = 0
+        self.stopping = False
+        self.server = None
+        self.family = None
+        self.local_address = None
+
+    def registered(self):
+        return sum(1 for d in self.devices if d.location)
+
+    def retransmissions(self):
+        return self.closed_retransmissions + sum(
+            d.endpoint.retransmissions for d in self.devices if d.endpoint)
+
+    async def resolve(self):
+        loop = asyncio.get_event_loop()
+        infos = await loop.getaddrinfo(self.args.server, self.args.port,
+                                       type=socket.SOCK_DGRAM)
+        self.family, _, _, _, self.server = infos[0]
+        self.local_address = '::' if self.family == socket.AF_INET6 \
+            else '0.0.0.0'
+
+    async def storms(self):
+        while True:
+            await asyncio.sleep(self.args.storm)
+            print('Registration storm: rebooting %d devices' %
+                  self.registered())
+            for device in self.devices:
+                if device.location:
+                    device.reboot_event.set()
+
+    async def reports(self):
+        while True:
+            await asyncio.sleep(self.args.report)
+            self.stats.print(self)
+
+    async def run(self):
+        await self.resolve()
+        tasks = []
+        for i, device in enumerate(self.devices):
+            delay = i / self.args.rate if self.args.rate else 0
+            tasks.append(asyncio.ensure_future(device.run(delay)))
+        background = [asyncio.ensure_future(self.reports())]
+        if self.args.storm:
+            background.append(asyncio.ensure_future(self.storms()))
+
+        stop = asyncio.Event()
+        loop = asyncio.get_event_loop()
+        loop.add_signal_handler(signal.SIGINT, stop.set)
+        loop.add_signal_handler(signal.SIGTERM, stop.set)
+        try:
+            await asyncio.wait_for(stop.wait(), self.args.duration)
+        except asyncio.TimeoutError:
+            pass
+
+        print('Stopping: deregistering %d devices' % self.registered())
+        self.stopping = True
+        for task in background:
+            task.cancel()
+        for device in self.devices:
+            device.reboot_event.set()
+        await asyncio.wait(tasks, timeout=30)
+        for device in self.devices:
+            device.close()
+
+
+def raise_file_limit(count):
+    # One socket per device, and one more per download
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    wanted = count * 2 + 64
+    if soft != resource.RLIM_INFINITY and soft < wanted:
+        limit = wanted if hard == resource.RLIM_INFINITY \
+            else min(wanted, hard)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (limit, hard))
+        if limit < wanted:
+            print('Warning: only %d file descriptors for %d devices' % (
+                limit, count))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-s', '--server', default='localhost',
+                        help='LwM2M server host')
+    parser.add_argument('-p', '--port', type=int, default=5683,
+                        help='LwM2M server port')
+    parser.add_argument('-n', '--count', type=int, default=100,
+                        help='devices to simulate')
+    parser.add_argument('--first-id', type=int, default=0x10000,
+                        help='device ID of the first device, the others '
+                             'follow')
+    parser.add_argument('--prefix', default='zmp',
+                        help='endpoint name prefix '
+                             '(CONFIG_FOTA_ENDPOINT_PREFIX)')
+    parser.add_argument('--board', default='native_posix',
+                        help='device type reported in 3/0/1')
+    parser.add_argument('--firmware-version', default='0.0.0',
+                        help='firmware version reported in 3/0/3')
+    parser.add_argument('--lifetime', type=int, default=300,
+                        help='registration lifetime in seconds')
+    parser.add_argument('--rate', type=float, default=50,
+                        help='registrations per second at start, 0 for '
+                             'all at once')
+    parser.add_argument('--storm', type=float,
+                        help='reboot every device each STORM seconds')
+    parser.add_argument('--boot-time', type=float, default=2,
+                        help='seconds from reboot to registration')
+    parser.add_argument('--notify', type=float, default=30,
+                        help='seconds between temperature notifications')
+    parser.add_argument('--notify-type', choices=('con', 'non'),
+                        default='non', help='temperature notification type')
+    parser.add_argument('--downloads', type=int, default=10,
+                        help='firmware downloads running at once')
+    parser.add_argument('--block-size', type=int, default=BLOCK_SIZE,
+                        choices=(16, 32, 64, 128, 256, 512, 1024),
+                        help='firmware download block size '
+                             '(CONFIG_LWM2M_COAP_BLOCK_SIZE)')
+    parser.add_argument('--flash-time', type=float, default=1,
+                        help='seconds from update execution to reboot')
+    parser.add_argument('-d', '--duration', type=float,
+                        help='seconds to run, until interrupted by default')
+    parser.add_argument('--report', type=float, default=10,
+                        help='seconds between progress reports')
+    parser.add_argument('-j', '--json', help='write the final report here')
+    args = parser.parse_args()
+    args.notify_type = coaplib.CON if args.notify_type == 'con' \
+        else coaplib.NON
+
+    raise_file_limit(args.count)
+    loop = asyncio.get_event_loop()
+    fleet = Fleet(args)
+    start = time.monotonic()
+    loop.run_until_complete(fleet.run())
+
+    fleet.stats.print(fleet)
+    if args.json:
+        summary = fleet.stats.summary()
+        summary['devices'] = args.count
+        summary['duration_s'] = round(time.monotonic() - start, 3)
+        summary['retransmissions'] = fleet.retransmissions()
+        with open(args.json, 'w') as f:
+            json.dump(summary, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
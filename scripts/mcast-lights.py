@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Switch or dim every light in a CoAP multicast group with one packet.
+
+Devices built with CONFIG_FOTA_MCAST_GROUP join the groups listed in
+CONFIG_FOTA_MCAST_GROUP_ADDRS (site-local "All CoAP Nodes", ff05::fd, by
+default) and apply group writes to the Light Control object. Requests are
+sent as NON and the devices do not answer them: the new state is reported
+back lazily through the observations the LwM2M server already holds.
+
+A unicast address may be given instead of a group to address a single
+device; with --confirm the request is sent as CON and acknowledged.
+
+Example, driving native_posix instances attached to a zeth interface:
+    ./mcast-lights.py -i zeth on
+    ./mcast-lights.py -g ff05::fd -i zeth dim 30
+    ./mcast-lights.py -g 2001:db8::1 --confirm off"""
+
+import argparse
+import socket
+import struct
+import sys
+
+import coaplib
+
+LIGHT_OBJECT = 3311
+ON_OFF = 5850
+DIMMER = 5851
+
+
+def build_request(path, value, confirm):
+    msg = coaplib.Message(coaplib.CON if confirm else coaplib.NON,
+                          coaplib.PUT, token=coaplib.new_token())
+    msg.uri_path = path
+    msg.add_option(coaplib.CONTENT_FORMAT, coaplib.FORMAT_TEXT_PLAIN)
+    if not confirm:
+        # RFC 7967: tell any unicast receiver we want no 2.xx answer
+        msg.add_option(coaplib.NO_RESPONSE, 2)
+    msg.payload = str(value).encode('ascii')
+    return msg
+
+
+def send(args, path, value):
+    sock = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM)
+    if args.interface:
+        ifindex = socket.if_nametoindex(args.interface)
+        sock.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_MULTICAST_IF,
+                        struct.pack('@I', ifindex))
+    sock.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_MULTICAST_HOPS,
+                    args.hops)
+
+    msg = build_request(path, value, args.confirm)
+    sock.sendto(msg.encode(), (args.group, args.port, 0,
+                               socket.if_nametoindex(args.interface)
+                               if args.interface else 0))
+    print('sent %s %s=%s to [%s]:%d' % ('CON' if args.confirm else 'NON',
+                                       path, value, args.group, args.port))
+
+    if not args.confirm:
+        return 0
+
+    sock.settimeout(args.timeout)
+    try:
+        data, peer = sock.recvfrom(1500)
+    except socket.timeout:
+        print('no response', file=sys.stderr)
+        return 1
+
+    response = coaplib.Message.decode(data)
+    print('%s from %s' % (coaplib.code_str(response.code), peer[0]))
+    return 0 if response.code == coaplib.CHANGED else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='CoAP group control for Light Control objects')
+    parser.add_argument('-g', '--group', default='ff05::fd',
+                        help='IPv6 group (or unicast) address')
+    parser.add_argument('-p', '--port', type=int, default=5683,
+                        help='Destination UDP port')
+    parser.add_argument('-i', '--interface', default=None,
+                        help='Outgoing interface for multicast')
+    parser.add_argument('-n', '--instance', type=int, default=0,
+                        help='Light Control object instance')
+    parser.add_argument('--hops', type=int, default=8,
+                        help='Multicast hop limit')
+    parser.add_argument('--confirm', action='store_true',
+                        help='Send as CON and wait for the ACK')
+    parser.add_argument('--timeout', type=float, default=5,
+                        help='Response timeout in seconds (with --confirm)')
+    parser.add_argument('action', choices=('on', 'off', 'dim'))
+    parser.add_argument('level', nargs='?', type=int,
+                        help='Dimmer level 0-100 (for "dim")')
+    args = parser.parse_args()
+
+    if args.action == 'dim':
+        if args.level is None or not 0 <= args.level <= 100:
+            parser.error('"dim" needs a level between 0 and 100')
+        path = '%d/%d/%d' % (LIGHT_OBJECT, args.instance, DIMMER)
+        value = args.level
+    else:
+        path = '%d/%d/%d' % (LIGHT_OBJECT, args.instance, ON_OFF)
+        value = 1 if args.action == 'on' else 0
+
+    sys.exit(send(args, path, value))
+
+
+if __name__ == '__main__':
+    main()
@@ -1,15 +1,38 @@
-# Copyright (c) 2018 Foundries.io
+# Copyright (c) 2018-2019 Foundries.io
 #
 # SPDX-License-Identifier: Apache-2.0
 
+"""Reset soak test: reboot every target through 3/0/4, over and over.
+
+Each loop waits for the targets, executes Reboot (3/0/4) on all of them
+at once and times, from the Leshan event stream, how long each takes
+to register again: from the reboot request to the new registration. Deregistrations seen in between are timestamped
+too. A loop fails when a target has not registered again within
+DELAY + 5 * WAIT seconds.
+
+p50/p95/p99/max reboot-to-registered latencies are printed per loop and
+per device type (3/0/1), and for the whole run per type and per
+device. With --boot-time, the device's own boot-to-registered time
+(diagnostics resource 26241/0/24) is read after each reboot and
+reported alongside. --json saves every sample."""
+
 import argparse
-import requests
+import concurrent.futures
 import json
-import time
+import math
+import requests
 import signal
 import sys
+import threading
+import time
+
+from leshan_events import EndpointIndex, REGISTRATION, DEREGISTRATION
+
+__version__ = 3.0
 
-__version__ = 1.0
+DEVICE_TYPE = '3/0/1'
+REBOOT = '3/0/4'
+BOOT_REGISTERED = '26241/0/24'
 
 headers = { 'Content-Type': 'application/json'}
 
@@ -21,51 +44,111 @@ def signal_handler(signal, frame):
     print('Script aborting ...')
     aborted = True
 
-def post(url):
-    response = requests.post(url, headers=headers)
-    if response.status_code in (200, 201):
-        return True
-    else:
-        print(response)
-        return False
-
-def get(url):
-    response = requests.get(url, headers=headers)
-    if response.status_code in (200, 201):
-        try:
-            return response.json()
-        except:
-            return None
-    else:
-        print(response)
+def percentiles(values):
+    values = sorted(values)
+    if not values:
         return None
 
-def put(url, data):
-    response = requests.put(url, json=data, headers=headers)
-    if response.status_code in (200, 201):
-        return True
-    else:
-        print(response)
-        return False
-
-def count_targets(hostname):
-    target_count = 0
-    client_list_url = '%s/api/clients'  % (hostname)
-    response = get(client_list_url)
-    if response:
-        for target in response:
-            # perform get to make sure target is connected
-            endpoint_url = '%s/api/clients/%s/3/0/2' % (hostname, target['endpoint'])
-            endpoint_serial = get(endpoint_url)
-            if endpoint_serial is not None:
-                target_count += 1
-
-    return target_count
-
-def run(targets, hostname, num_loops, loop_delay, max_waits):
+    def pct(p):
+        return values[min(len(values) - 1, max(0, math.ceil(p / 100 * len(values)) - 1))]
+
+    return {'count': len(values), 'p50': pct(50), 'p95': pct(95),
+            'p99': pct(99), 'max': values[-1]}
+
+def print_table(title, groups):
+    print('  %s' % title)
+    print('    %-32s %5s %8s %8s %8s %8s' % ('', 'n', 'p50 s', 'p95 s', 'p99 s', 'max s'))
+    for name in sorted(groups):
+        p = percentiles(groups[name])
+        if p:
+            print('    %-32s %5d %8.2f %8.2f %8.2f %8.2f' % (name, p['count'], p['p50'], p['p95'], p['p99'], p['max']))
+
+class Soak:
+    """Reboot timestamps of one loop, filled from the event stream."""
+
+    def __init__(self, hostname, index):
+        self.hostname = hostname
+        self.index = index
+        self.session = requests.Session()
+        self.session.headers.update(headers)
+        self.lock = threading.Lock()
+        self.device_types = {}
+        self.rebooted = {}
+        self.deregistered = {}
+        self.registered = {}
+        index.add_listener(self.event)
+
+    def event(self, event, endpoint, reg, when):
+        with self.lock:
+            if endpoint not in self.rebooted:
+                return
+            if event == DEREGISTRATION:
+                self.deregistered.setdefault(endpoint, when)
+            elif event == REGISTRATION:
+                self.registered.setdefault(endpoint, when)
+
+    def read(self, endpoint, path):
+        response = self.session.get('%s/api/clients/%s/%s' % (self.hostname, endpoint, path))
+        if response.status_code != 200:
+            return None
+        return response.json().get('content', {}).get('value')
+
+    def device_type(self, endpoint):
+        if endpoint not in self.device_types:
+            self.device_types[endpoint] = self.read(endpoint, DEVICE_TYPE) or 'unknown'
+        return self.device_types[endpoint]
+
+    def reboot(self, endpoint):
+        # The device cannot reboot before the request is sent, but it
+        # can be back before the response is handled here
+        sent = time.time()
+        response = self.session.post('%s/api/clients/%s/%s' % (self.hostname, endpoint, REBOOT))
+        if response.status_code not in (200, 201):
+            print('  %s: reboot failed: %s' % (endpoint, response))
+            return
+        with self.lock:
+            self.rebooted[endpoint] = sent
+
+    def start(self, endpoints):
+        with self.lock:
+            self.rebooted = dict.fromkeys(endpoints, None)
+            self.deregistered = {}
+            self.registered = {}
+        with concurrent.futures.ThreadPoolExecutor(32) as pool:
+            list(pool.map(self.device_type, endpoints))
+            list(pool.map(self.reboot, endpoints))
+        with self.lock:
+            for endpoint in [ep for ep, t in self.rebooted.items() if t is None]:
+                del self.rebooted[endpoint]
+
+    def latencies(self):
+        """Reboot to registered seconds by endpoint."""
+        with self.lock:
+            return {ep: self.registered[ep] - t for ep, t in self.rebooted.items()
+                    if ep in self.registered and self.registered[ep] >= t}
+
+    def boot_times(self, endpoints):
+        """Device boot to registered seconds by endpoint."""
+        with concurrent.futures.ThreadPoolExecutor(32) as pool:
+            values = pool.map(lambda ep: self.read(ep, BOOT_REGISTERED), endpoints)
+        return {ep: v / 1000 for ep, v in zip(endpoints, values)
+                if isinstance(v, int) and v >= 0}
+
+def by_type(soak, samples):
+    groups = {}
+    for endpoint, value in samples.items():
+        groups.setdefault(soak.device_type(endpoint), []).append(value)
+    return groups
+
+def run(targets, hostname, num_loops, loop_delay, max_waits, boot_time, results):
     global aborted
     global test_fail
 
+    index = EndpointIndex(hostname).start()
+    soak = Soak(hostname, index)
+    # Same overall limit as when the server was polled every 5 seconds
+    reset_timeout = loop_delay + max_waits * 5
+
     loop_counter = 0
     test_fail = False
     while aborted == False and (num_loops == 0 or loop_counter < num_loops):
@@ -73,49 +156,39 @@ def run(targets, hostname, num_loops, loop_delay, max_waits):
         print("BEGIN Reset Loop %d" % loop_counter)
 
         # wait for connections
-        run = True
-        while run == True and aborted == False:
-            target_count = count_targets(hostname)
-            if target_count >= targets:
-                print("  Found %d targets prior to reset" % targets)
-                run = False
-            else:
-                print("  Only found %d targets, sleeping..." % target_count)
-                time.sleep(5)
+        while aborted == False and not index.wait_count(targets, timeout=1):
+            pass
 
         if aborted == False:
-            client_list_url = '%s/api/clients'  % (hostname)
-            response = get(client_list_url)
-
-        if aborted == False and response:
+            print("  Found %d targets prior to reset" % index.count())
+            previous = index.snapshot()
             print("  Resetting targets")
-            for target in response:
-                if 'endpoint' in target:
-                    # send reset to targets
-                    endpoint_url = '%s/api/clients/%s/3/0/4' % (hostname, target['endpoint'])
-                    post(endpoint_url)
-
-            if aborted == False:
-                print("  Waiting for %d seconds post reset." % loop_delay)
-                time.sleep(loop_delay)
-
-            if aborted == False:
-                # wait for connections again
-                run = True
-                wait_count = 0
-                while run == True and aborted == False:
-                    target_count = count_targets(hostname)
-                    if target_count >= targets:
-                        print("  Found %d targets after reset" % targets)
-                        run = False
-                    else:
-                        wait_count += 1
-                        if wait_count <= max_waits:
-                            print("  Only found %d targets, sleeping... (%d waits left)" % (target_count, max_waits - wait_count))
-                            time.sleep(5)
-                        else:
-                            aborted = True
-                            test_fail = True
+            soak.start(list(previous))
+
+            # wait for every reset target to register again
+            print("  Waiting up to %d seconds for targets to register again" % reset_timeout)
+            deadline = time.time() + reset_timeout
+            missing = previous
+            while aborted == False and missing and time.time() < deadline:
+                missing = index.wait_registered(previous, timeout=min(1, deadline - time.time()))
+
+            latencies = soak.latencies()
+            loop = {'loop': loop_counter, 'reboot_to_registered': latencies,
+                    'deregistered': {ep: t - soak.rebooted[ep] for ep, t in soak.deregistered.items()
+                                     if soak.rebooted.get(ep)},
+                    'missing': sorted(missing)}
+            print_table('Reboot to registered', by_type(soak, latencies))
+            if boot_time:
+                loop['boot_to_registered'] = soak.boot_times(list(latencies))
+                print_table('Device boot to registered', by_type(soak, loop['boot_to_registered']))
+            results['loops'].append(loop)
+
+            if aborted == False and missing:
+                print("  %d targets did not register again: %s" % (len(missing), ' '.join(missing)))
+                aborted = True
+                test_fail = True
+            elif aborted == False:
+                print("  Found %d targets after reset" % len(previous))
 
         if test_fail:
             print("END Reset Loop %d: FAILED!!" % loop_counter)
@@ -124,7 +197,23 @@ def run(targets, hostname, num_loops, loop_delay, max_waits):
         else:
             print("END Reset Loop %d: SUCCESS" % loop_counter)
 
-    return loop_counter
+    index.stop()
+    results['device_types'] = soak.device_types
+    return soak, loop_counter
+
+def print_summary(soak, results):
+    samples = {}
+    for loop in results['loops']:
+        for endpoint, value in loop['reboot_to_registered'].items():
+            samples.setdefault(endpoint, []).append(value)
+    if not samples:
+        return
+
+    groups = {}
+    for endpoint, values in samples.items():
+        groups.setdefault(soak.device_type(endpoint), []).extend(values)
+    print_table('All loops, by device type', groups)
+    print_table('All loops, by device', samples)
 
 def main():
     global aborted
@@ -133,16 +222,23 @@ def main():
     # add process interrupt handler
     signal.signal(signal.SIGINT, signal_handler)
 
-    description = 'Simple Leshan API Wrapper to wait for targets to connect and then reset them'
-    parser = argparse.ArgumentParser(description=description)
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--version', action='version', version='%(prog)s ' + str(__version__))
     parser.add_argument('-t', '--targets', help='Number of Leshan Targets to wait for', type=int, required=True)
     parser.add_argument('-host', '--hostname', help='Leshan Server URL', default='https://mgmt.foundries.io/leshan')
     parser.add_argument('-l', '--loops', help='Number of loop executions', type=int, default=0)
-    parser.add_argument('-d', '--delay', help='Wait delay between loops (in seconds)', type=int, default=45)
-    parser.add_argument('-w', '--wait', help='Max waits for fail', type=int, default=6)
+    parser.add_argument('-d', '--delay', help='Seconds targets are expected to take to reboot', type=int, default=45)
+    parser.add_argument('-w', '--wait', help='Extra 5 second periods allowed after DELAY before failing', type=int, default=6)
+    parser.add_argument('-b', '--boot-time', help='Also read the device boot to registered time', action='store_true')
+    parser.add_argument('-j', '--json', help='Write every sample to this file')
     args = parser.parse_args()
-    loop_counter = run(args.targets, args.hostname, args.loops, args.delay, args.wait)
+    results = {'hostname': args.hostname, 'loops': []}
+    soak, loop_counter = run(args.targets, args.hostname, args.loops, args.delay, args.wait, args.boot_time, results)
     print("---------------------")
+    print_summary(soak, results)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2)
     if test_fail:
         print("Failed during loop %d." % loop_counter)
         sys.exit(1)
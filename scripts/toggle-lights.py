@@ -7,12 +7,16 @@ import signal
 import argparse
 import requests
 import json
+import math
+import queue
 import time
 import logging
 import threading
 import datetime
 
-# Script Version 1.1
+from leshan_events import EndpointIndex
+
+# Script Version 1.2
 
 headers = { 'Content-Type': 'application/json'}
 thread_wait = .25
@@ -162,6 +166,294 @@ def run(client, hostname, device, max_threads, num_loops, loop_delay):
 
     exit(0)
 
+# Benchmark mode: write the light and time the round trip until the
+# device's notification for the same resource comes back through the
+# server's event stream.
+LIGHT = '3311/0/5850'
+DEVICE_TYPE = '3/0/1'
+NETWORK_BEARER = '4/0/0'
+
+# Connectivity Monitoring network bearers (LwM2M 1.0 E.4)
+bearer_names = {0: 'gsm', 2: 'wcdma', 5: 'lte-tdd', 6: 'lte-fdd', 7: 'nb-iot',
+                21: 'wlan', 22: 'bluetooth', 23: '802.15.4', 41: 'ethernet'}
+
+# Histogram bucket upper bounds, in ms
+buckets = [10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000]
+
+def percentiles(values):
+    values = sorted(values)
+    if not values:
+        return None
+
+    def pct(p):
+        return values[min(len(values) - 1, max(0, math.ceil(p / 100 * len(values)) - 1))]
+
+    return {'count': len(values), 'p50': pct(50), 'p90': pct(90),
+            'p99': pct(99), 'max': values[-1]}
+
+def histogram(values):
+    counts = [0] * (len(buckets) + 1)
+    for v in values:
+        counts[next((i for i, b in enumerate(buckets) if v <= b), len(buckets))] += 1
+    return counts
+
+class BenchTarget:
+    """One light under test. At most one toggle is in flight, so the
+    notification carrying the written value confirms it."""
+
+    def __init__(self, hostname, endpoint):
+        self.endpoint = endpoint
+        self.url = '%s/api/clients/%s/%s' % (hostname, endpoint, LIGHT)
+        self.session = requests.Session()
+        self.session.headers.update(headers)
+        self.network = 'unknown'
+        self.device_type = 'unknown'
+        self.value = None
+        self.pmin_set = False
+        self.expected = None
+        self.confirmed_at = None
+        self.confirmed = threading.Event()
+        self.lock = threading.Lock()
+
+    def read(self, url):
+        try:
+            response = self.session.get(url, timeout=30)
+        except requests.RequestException:
+            return None
+        if response.status_code != 200:
+            return None
+        return response.json().get('content', {}).get('value')
+
+    def setup(self, hostname):
+        base = '%s/api/clients/%s' % (hostname, self.endpoint)
+        bearer = self.read('%s/%s' % (base, NETWORK_BEARER))
+        if bearer is not None:
+            self.network = bearer_names.get(bearer, 'bearer-%s' % bearer)
+        self.device_type = self.read('%s/%s' % (base, DEVICE_TYPE)) or 'unknown'
+        # Notify on every change instead of waiting for the server's pmin
+        response = self.session.put(self.url + '/attributes', params={'pmin': 0}, timeout=30)
+        self.pmin_set = response.status_code == 200
+        response = self.session.post(self.url + '/observe', timeout=30)
+        if response.status_code != 200:
+            logging.error('%s: cannot observe %s: %s', self.endpoint, LIGHT, response)
+            return False
+        self.value = response.json().get('content', {}).get('value')
+        return self.value is not None
+
+    def cancel(self):
+        try:
+            self.session.delete(self.url + '/observe', timeout=30)
+        except requests.RequestException:
+            pass
+        if not self.pmin_set:
+            return
+        # A pmin without value removes ours: the server's applies again
+        try:
+            self.session.put(self.url + '/attributes?pmin', timeout=30)
+            self.pmin_set = False
+        except requests.RequestException:
+            logging.warning('%s: pmin left at 0 on %s', self.endpoint, LIGHT)
+
+    def notified(self, value, when):
+        with self.lock:
+            if self.expected is not None and value == self.expected and \
+                    self.confirmed_at is None:
+                self.confirmed_at = when
+                self.confirmed.set()
+
+    def toggle(self, timeout):
+        """Returns (outcome, write ms, confirm ms)."""
+        value = not self.value
+        with self.lock:
+            self.expected = value
+            self.confirmed_at = None
+            self.confirmed.clear()
+
+        start = time.time()
+        try:
+            response = self.session.put(self.url, data=json.dumps({'id': 5850, 'value': value}),
+                                        timeout=timeout)
+        except requests.RequestException:
+            return 'failed', None, None
+        written = (time.time() - start) * 1000
+        # Leshan answers 200 with the CoAP response code as status
+        try:
+            changed = response.status_code == 200 and response.json().get('status') == 'CHANGED'
+        except ValueError:
+            changed = False
+        if not changed:
+            return 'failed', written, None
+        self.value = value
+
+        if not self.confirmed.wait(max(0, timeout - written / 1000)):
+            with self.lock:
+                self.expected = None
+            return 'timeout', written, None
+        with self.lock:
+            self.expected = None
+            return 'ok', written, (self.confirmed_at - start) * 1000
+
+def bench_step(targets, rate, duration, max_threads, timeout):
+    """Toggle for duration seconds at rate toggles/s, 0 for as fast as
+    max_threads concurrent toggles allow."""
+    idle = queue.Queue()
+    for target in targets:
+        idle.put(target)
+    slots = threading.Semaphore(max_threads)
+    lock = threading.Lock()
+    samples = []
+    step = {'rate': rate, 'duration': duration, 'sent': 0, 'dropped': 0}
+
+    def worker(target):
+        outcome, written, confirmed = target.toggle(timeout)
+        with lock:
+            samples.append((target, outcome, written, confirmed))
+        idle.put(target)
+        slots.release()
+
+    threads = []
+    start = time.time()
+    deadline = start + duration
+    tick = start
+    while aborted == False and time.time() < deadline:
+        if rate > 0:
+            # Open loop: a toggle every 1/rate seconds, dropped when every
+            # light is busy or every thread in use
+            tick += 1.0 / rate
+            time.sleep(max(0, tick - time.time()))
+            if not slots.acquire(blocking=False):
+                step['dropped'] += 1
+                continue
+            try:
+                target = idle.get_nowait()
+            except queue.Empty:
+                slots.release()
+                step['dropped'] += 1
+                continue
+        else:
+            if not slots.acquire(timeout=thread_wait):
+                continue
+            try:
+                target = idle.get(timeout=thread_wait)
+            except queue.Empty:
+                slots.release()
+                continue
+        step['sent'] += 1
+        t = threading.Thread(name=target.endpoint, target=worker, args=(target,))
+        threads.append(t)
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+
+    outcomes = [s[1] for s in samples]
+    step['confirmed'] = outcomes.count('ok')
+    step['failed'] = outcomes.count('failed')
+    step['timeouts'] = outcomes.count('timeout')
+    step['confirmed_per_s'] = step['confirmed'] / elapsed if elapsed else 0
+
+    def group(key):
+        groups = {}
+        for target, outcome, written, confirmed in samples:
+            g = groups.setdefault(key(target), {'write_ms': [], 'confirm_ms': [],
+                                                'failed': 0, 'timeouts': 0})
+            if written is not None and outcome != 'failed':
+                g['write_ms'].append(written)
+            if outcome == 'ok':
+                g['confirm_ms'].append(confirmed)
+            elif outcome == 'failed':
+                g['failed'] += 1
+            else:
+                g['timeouts'] += 1
+        for g in groups.values():
+            g['write'] = percentiles(g['write_ms'])
+            g['confirm'] = percentiles(g['confirm_ms'])
+            g['histogram'] = histogram(g['confirm_ms'])
+        return groups
+
+    step['networks'] = group(lambda t: t.network)
+    step['devices'] = group(lambda t: t.endpoint)
+    return step
+
+def print_step(step, verbose):
+    print('Rate %s for %d s: %d sent, %d confirmed (%.1f/s), %d failed, %d timed out, %d dropped' %
+          ('%g/s' % step['rate'] if step['rate'] else 'saturation', step['duration'], step['sent'], step['confirmed'],
+           step['confirmed_per_s'], step['failed'], step['timeouts'], step['dropped']))
+
+    def table(title, groups):
+        print('  %-24s %5s %8s %8s %8s %8s %8s %8s %8s' %
+              (title, 'n', 'write50', 'write90', 'write99', 'conf50', 'conf90', 'conf99', 'confmax'))
+        for name in sorted(groups):
+            w, c = groups[name]['write'], groups[name]['confirm']
+            if not c:
+                print('  %-24s %5d %s' % (name, 0, 'no confirmed toggle'))
+                continue
+            print('  %-24s %5d %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f' %
+                  (name, c['count'], w['p50'], w['p90'], w['p99'],
+                   c['p50'], c['p90'], c['p99'], c['max']))
+
+    table('network (ms)', step['networks'])
+    if verbose:
+        table('device (ms)', step['devices'])
+    for name in sorted(step['networks']):
+        counts = step['networks'][name]['histogram']
+        total = sum(counts)
+        if not total:
+            continue
+        print('  %s confirm latency' % name)
+        for i, count in enumerate(counts):
+            label = '<= %d ms' % buckets[i] if i < len(buckets) else '> %d ms' % buckets[-1]
+            print('    %-12s %6d %s' % (label, count, '#' * int(round(40 * count / total))))
+
+def bench(client, hostname, device, max_threads, rates, duration, timeout, verbose, json_file):
+    index = EndpointIndex(hostname).start()
+    endpoints = [client] if client else list(index.snapshot())
+    targets = {}
+    for endpoint in endpoints:
+        target = BenchTarget(hostname, endpoint)
+        if not target.setup(hostname) or \
+                (device and target.device_type != device):
+            target.cancel()
+            continue
+        targets[endpoint] = target
+    if not targets:
+        logging.error('no light to toggle')
+        exit(1)
+
+    def notified(endpoint, path, value, when):
+        if path == LIGHT and endpoint in targets:
+            targets[endpoint].notified(value, when)
+    index.add_notification_listener(notified)
+
+    networks = {}
+    for target in targets.values():
+        networks[target.network] = networks.get(target.network, 0) + 1
+    logging.info('benchmarking %d lights: %s', len(targets),
+                 ', '.join('%d %s' % (n, name) for name, n in sorted(networks.items())))
+
+    results = {'hostname': hostname, 'threads': max_threads, 'buckets_ms': buckets,
+               'lights': {ep: {'network': t.network, 'device_type': t.device_type}
+                          for ep, t in targets.items()},
+               'steps': []}
+    for rate in rates:
+        if aborted:
+            break
+        step = bench_step(list(targets.values()), rate, duration, max_threads, timeout)
+        print_step(step, verbose)
+        for groups in (step['networks'], step['devices']):
+            for g in groups.values():
+                del g['write_ms']
+                del g['confirm_ms']
+        results['steps'].append(step)
+
+    for target in targets.values():
+        target.cancel()
+    index.stop()
+    if json_file:
+        with open(json_file, 'w') as f:
+            json.dump(results, f, indent=2)
+    exit(1 if aborted else 0)
+
 def main():
     description = 'Simple Leshan API wrapper for light toggle'
     parser = argparse.ArgumentParser(description=description)
@@ -171,7 +463,18 @@ def main():
     parser.add_argument('-t', '--threads', help='Maximum threads', default=1)
     parser.add_argument('-l', '--loops', help='Number of loop executions', default=0)
     parser.add_argument('-w', '--wait', help='Wait delay between loops (in seconds)', default=1)
+    parser.add_argument('-b', '--bench', help='Benchmark: seconds to toggle at each rate, confirming through observe', type=int, default=0)
+    parser.add_argument('-r', '--rates', help='Benchmark toggles per second, comma separated; 0 for saturation', default='0')
+    parser.add_argument('--timeout', help='Benchmark seconds to wait for a confirmation', type=float, default=10)
+    parser.add_argument('-v', '--verbose', help='Benchmark latencies per device too', action='store_true')
+    parser.add_argument('-j', '--json', help='Write the benchmark results to this file')
     args = parser.parse_args()
+    if args.bench:
+        rates = [float(r) for r in args.rates.split(',')]
+        logging.info('client:%s hostname:%s device:%s threads:%d rates:%s seconds:%d',
+            args.client, args.hostname, args.device, int(args.threads), args.rates, args.bench)
+        bench(args.client, args.hostname, args.device, int(args.threads), rates, args.bench,
+              args.timeout, args.verbose, args.json)
     logging.info('client:%s hostname:%s device:%s threads:%d loops:%d delay:%d',
         args.client, args.hostname, args.device, int(args.threads), int(args.loops), int(args.wait))
     run(args.client, args.hostname, args.device, int(args.threads), int(args.loops), int(args.wait))
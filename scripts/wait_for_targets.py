@@ -1,60 +1,47 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018-2019 Foundries.io
+#
+# SPDX-License-Identifier: Apache-2.0
+
 import argparse
-import requests
-import json
-import time
+import sys
 
-__version__ = 1.0
+from leshan_events import EndpointIndex
 
-headers = { 'Content-Type': 'application/json'}
+__version__ = 2.0
 
-def post(url):
-    response = requests.post(url, headers=headers)
-    if response.status_code == 200 or 201:
-        return True
-    else:
-        print response
-        return False
 
-def get(url):
-    response = requests.get(url, headers=headers)
-    if response.status_code == 200 or 201:
-        try:
-            payload = json.loads(response.content)
-	    return payload
-        except:
-            return None
-    else:
-        print response
-        return None
-
-def put(url, data):
-    response = requests.put(url, data=json.dumps(data), headers=headers)
-    if response.status_code == 200 or 201:
-        return True
-    else:
-        print response
+def run(targets, hostname, match, timeout):
+    index = EndpointIndex(hostname).start()
+
+    def report(event, endpoint, reg, when):
+        print('%s %s (%d registered)' % (event, endpoint,
+                                          index.count(match)))
+
+    index.add_listener(report)
+    print('%d targets registered' % index.count(match))
+    if not index.wait_count(targets, match, timeout):
+        print('Only %d targets after %d seconds' % (index.count(match),
+                                                    timeout))
         return False
 
-def run(targets, hostname):
-    run = True
-    while run:
-        client_list_url = '%s/api/clients'  % (hostname)
-        response = get(client_list_url)
-        if response:
-            if len(response) >= targets:
-                print "Matched number of targets"
-                run = False
-            else:
-                print "Only %s target matches, sleeping..." % len(response)
-                time.sleep(5)
+    print('Matched number of targets')
+    return True
+
 
 def main():
     description = 'Simple Leshan API Wrapper for waiting for targets to connect'
-    parser = argparse.ArgumentParser(version=__version__, description=description)
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument('--version', action='version',
+                        version='%(prog)s ' + str(__version__))
     parser.add_argument('-t', '--targets', help='Number of Leshan Targets to wait for', type=int, required=True)
     parser.add_argument('-host', '--hostname', help='Leshan Server URL', default='https://mgmt.foundries.io/leshan')
+    parser.add_argument('-c', '--client', help='Only count endpoints containing this string')
+    parser.add_argument('-T', '--timeout', help='Seconds to wait, forever by default', type=int)
     args = parser.parse_args()
-    run(args.targets, args.hostname)
+    if not run(args.targets, args.hostname, args.client, args.timeout):
+        sys.exit(1)
+
 
 if __name__ == '__main__':
     main()
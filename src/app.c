@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016-2017 Linaro Limited
+ * Copyright (c) 2018-2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_app
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <tc_util.h>
+
+#include "app.h"
+#include "app_work_queue.h"
+#include "lwm2m.h"
+#include "light_control.h"
+#include "settings.h"
+#include "obs_sched.h"
+#include "sensors.h"
+#if defined(CONFIG_FOTA_DIAG)
+#include "mem_stats.h"
+#endif
+#if defined(CONFIG_FOTA_CPU_STATS)
+#include "cpu_stats.h"
+#endif
+
+/* Log a failed step, and report every step in the BIST if asked to */
+static int step_result(bool bist, const char *name, int ret)
+{
+	if (bist) {
+		Z_TC_END_RESULT(ret ? TC_FAIL : TC_PASS, name);
+	}
+
+	if (ret) {
+		LOG_ERR("%s failed: %d", name, ret);
+	}
+
+	return ret;
+}
+
+int app_init(bool bist)
+{
+	int result = TC_PASS;
+	int ret;
+
+	app_wq_init();
+
+#if defined(CONFIG_FOTA_DIAG)
+	/* Start early so pool minima cover registration too */
+	mem_stats_init();
+#endif
+#if defined(CONFIG_FOTA_CPU_STATS)
+	cpu_stats_init();
+#endif
+
+	if (bist) {
+		TC_START("Running Built in Self Test (BIST)");
+	}
+
+	LOG_INF("Initializing LWM2M IPSO Sensors");
+	ret = step_result(bist, "init_temp_device", sensors_init());
+	if (ret) {
+		goto fail;
+	}
+
+	LOG_INF("Initializing IPSO Light Control");
+	ret = step_result(bist, "init_light_control", init_light_control());
+	if (ret) {
+		goto fail;
+	}
+
+	/* Not fatal: the application runs on defaults without settings */
+	LOG_INF("Initializing FOTA settings");
+	if (step_result(bist, "fota_settings_init", fota_settings_init())) {
+		result = TC_FAIL;
+	}
+
+	/*
+	 * Only load the settings registration depends on here; the rest
+	 * is loaded from the work queue once networking has been set up.
+	 */
+	fota_settings_load_early();
+
+	if (bist) {
+		TC_END_REPORT(result);
+	}
+
+	ret = lwm2m_init(app_work_q);
+	if (ret) {
+		LOG_ERR("lwm2m_init failed: %d", ret);
+		return ret;
+	}
+
+	fota_settings_load_deferred();
+
+	obs_sched_start();
+
+	return 0;
+
+fail:
+	if (bist) {
+		TC_END_REPORT(TC_FAIL);
+	}
+
+	return ret;
+}
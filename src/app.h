@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_APP_H__
+#define FOTA_APP_H__
+
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief Application start up
+ *
+ * Brings up everything the application needs, in order, up to and
+ * including LwM2M, so that main() and the test suites which link the
+ * application start it the same way.
+ */
+
+/**
+ * @brief Initialize the application.
+ *
+ * Initializes the application work queue and queues the work which
+ * starts LwM2M once networking is up. Nothing runs until the caller
+ * hands a thread to app_wq_run().
+ *
+ * @param bist Report each step as a Built in Self Test result.
+ * @return 0 on success, negative errno if a step failed; the failing
+ *         step is logged.
+ */
+int app_init(bool bist);
+
+#endif	/* FOTA_APP_H__ */
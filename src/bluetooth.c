@@ -29,6 +29,8 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include <bluetooth/conn.h>
 
 #include "product_id.h"
+#include "bluetooth.h"
+#include "settings.h"
 
 static void set_own_bt_addr(bt_addr_le_t *addr)
 {
@@ -69,27 +71,189 @@ static void set_bluetooth_led(bool state)
 #endif
 }
 
+/* Delay between attempts to restart advertising */
+#define READVERTISE_RETRY_MS	K_SECONDS(1)
+
+static struct k_delayed_work advertise_work;
+static struct k_delayed_work reconnect_timeout_work;
+static s64_t disconnected_at;
+static bool network_disabled;
+
+static void advertise(struct k_work *work)
+{
+	/* TODO: use a better way to select BT interface */
+	struct net_if *iface = net_if_get_default();
+	int ret;
+
+	ret = net_mgmt(NET_REQUEST_BT_ADVERTISE, iface, "on", 0);
+	if (ret < 0 && ret != -EALREADY) {
+		LOG_ERR("Error starting advertise:%d, retrying", ret);
+		k_delayed_work_submit(&advertise_work, READVERTISE_RETRY_MS);
+	}
+}
+
+#if defined(CONFIG_FOTA_BT_CONN_PARAMS)
+static struct bt_conn *default_conn;
+static struct k_work conn_param_work;
+static struct k_delayed_work bulk_stall_work;
+static bool bulk_transfer;
+static s64_t conn_param_requested_at;
+
+static void conn_param_update(struct k_work *work)
+{
+	struct bt_le_conn_param param = {
+		.timeout = CONFIG_FOTA_BT_SUPERVISION_TIMEOUT,
+	};
+	struct bt_conn *conn = NULL;
+	unsigned int key;
+	int ret;
+
+	key = irq_lock();
+	if (default_conn) {
+		conn = bt_conn_ref(default_conn);
+	}
+	irq_unlock(key);
+
+	if (!conn) {
+		return;
+	}
+
+	if (bulk_transfer) {
+		param.interval_min = CONFIG_FOTA_BT_BULK_INTERVAL_MIN;
+		param.interval_max = CONFIG_FOTA_BT_BULK_INTERVAL_MAX;
+		param.latency = 0;
+	} else {
+		param.interval_min = CONFIG_FOTA_BT_IDLE_INTERVAL_MIN;
+		param.interval_max = CONFIG_FOTA_BT_IDLE_INTERVAL_MAX;
+		param.latency = CONFIG_FOTA_BT_IDLE_LATENCY;
+	}
+
+	LOG_DBG("Requesting %s connection parameters",
+		bulk_transfer ? "bulk" : "idle");
+	conn_param_requested_at = k_uptime_get();
+	ret = bt_conn_le_param_update(conn, &param);
+	if (ret < 0 && ret != -EALREADY) {
+		LOG_ERR("Connection parameter update failed: %d", ret);
+	}
+
+	bt_conn_unref(conn);
+}
+
+static void bulk_stall(struct k_work *work)
+{
+	LOG_WRN("No firmware data for %d s, leaving bulk transfer mode",
+		CONFIG_FOTA_BT_BULK_STALL_TIMEOUT);
+	bt_network_bulk_transfer(false);
+}
+
+static void le_param_updated(struct bt_conn *conn, u16_t interval,
+			     u16_t latency, u16_t timeout)
+{
+	LOG_INF("BT LE interval %u.%02u ms, latency %u, timeout %u ms "
+		"(%u ms after request)",
+		interval * 5 / 4, interval * 125 % 100, latency, timeout * 10,
+		(u32_t)(k_uptime_get() - conn_param_requested_at));
+}
+
+void bt_network_bulk_transfer(bool active)
+{
+	if (active) {
+		/* Called for every block: keep pushing the stall timer out */
+		k_delayed_work_submit(&bulk_stall_work,
+				K_SECONDS(CONFIG_FOTA_BT_BULK_STALL_TIMEOUT));
+	} else {
+		k_delayed_work_cancel(&bulk_stall_work);
+	}
+
+	if (bulk_transfer == active) {
+		return;
+	}
+
+	bulk_transfer = active;
+	k_work_submit(&conn_param_work);
+}
+#else
+void bt_network_bulk_transfer(bool active)
+{
+	ARG_UNUSED(active);
+}
+#endif /* CONFIG_FOTA_BT_CONN_PARAMS */
+
+static void reconnect_timeout(struct k_work *work)
+{
+	LOG_ERR("BT LE not reconnected after %d s, rebooting!",
+		CONFIG_FOTA_BT_RECONNECT_TIMEOUT);
+	fota_settings_commit();
+	LOG_PANIC();
+	sys_reboot(0);
+}
+
 static void connected(struct bt_conn *conn, u8_t err)
 {
 	if (err) {
 		LOG_ERR("BT LE Connection failed: %u", err);
+		/* Advertising stops on a failed connection too */
+		k_delayed_work_submit(&advertise_work, K_NO_WAIT);
+		return;
+	}
+
+	set_bluetooth_led(1);
+	k_delayed_work_cancel(&reconnect_timeout_work);
+
+#if defined(CONFIG_FOTA_BT_CONN_PARAMS)
+	if (!default_conn) {
+		default_conn = bt_conn_ref(conn);
+	}
+	/* Apply the parameters for the current mode to the new link */
+	k_work_submit(&conn_param_work);
+#endif
+
+	if (disconnected_at) {
+		LOG_INF("BT LE Reconnected after %u ms",
+			(u32_t)k_uptime_delta(&disconnected_at));
+		disconnected_at = 0;
 	} else {
 		LOG_INF("BT LE Connected");
-		set_bluetooth_led(1);
 	}
 }
 
 static void disconnected(struct bt_conn *conn, u8_t reason)
 {
-	LOG_ERR("BT LE Disconnected (reason %u), rebooting!", reason);
+	/*
+	 * Keep the network interface and the LwM2M session: the 6LoWPAN
+	 * interface comes back up once the central reconnects, and the
+	 * LwM2M client then resumes with a Registration Update.
+	 */
 	set_bluetooth_led(0);
-	LOG_PANIC();
-	sys_reboot(0);
+
+#if defined(CONFIG_FOTA_BT_CONN_PARAMS)
+	if (default_conn == conn) {
+		bt_conn_unref(default_conn);
+		default_conn = NULL;
+	}
+#endif
+
+	if (network_disabled) {
+		LOG_INF("BT LE Disconnected (reason %u)", reason);
+		return;
+	}
+
+	LOG_WRN("BT LE Disconnected (reason %u), advertising", reason);
+	disconnected_at = k_uptime_get();
+
+	k_delayed_work_submit(&advertise_work, K_NO_WAIT);
+	if (CONFIG_FOTA_BT_RECONNECT_TIMEOUT > 0) {
+		k_delayed_work_submit(&reconnect_timeout_work,
+				K_SECONDS(CONFIG_FOTA_BT_RECONNECT_TIMEOUT));
+	}
 }
 
 static struct bt_conn_cb conn_callbacks = {
 	.connected = connected,
 	.disconnected = disconnected,
+#if defined(CONFIG_FOTA_BT_CONN_PARAMS)
+	.le_param_updated = le_param_updated,
+#endif
 };
 
 static int bt_network_init(struct device *dev)
@@ -108,6 +272,12 @@ static int bt_network_init(struct device *dev)
 		bt_addr.a.val[5], bt_addr.a.val[4], bt_addr.a.val[3],
 		bt_addr.a.val[2], bt_addr.a.val[1], bt_addr.a.val[0]);
 	ret = bt_set_id_addr(&bt_addr);
+	k_delayed_work_init(&advertise_work, advertise);
+	k_delayed_work_init(&reconnect_timeout_work, reconnect_timeout);
+#if defined(CONFIG_FOTA_BT_CONN_PARAMS)
+	k_work_init(&conn_param_work, conn_param_update);
+	k_delayed_work_init(&bulk_stall_work, bulk_stall);
+#endif
 	bt_conn_cb_register(&conn_callbacks);
 
 	return ret;
@@ -119,6 +289,10 @@ int bt_network_disable(void)
 	struct net_if *iface = net_if_get_default();
 	int ret;
 
+	/* Going down on purpose: don't bring the link back up */
+	network_disabled = true;
+	k_delayed_work_cancel(&reconnect_timeout_work);
+
 	ret = net_mgmt(NET_REQUEST_BT_DISCONNECT, iface, NULL, 0);
 	if (ret < 0) {
 		LOG_ERR("Disconnect failed:%d", ret);
@@ -7,6 +7,16 @@
 #ifndef FOTA_BLUETOOTH_H__
 #define FOTA_BLUETOOTH_H__
 
+#include <stdbool.h>
+
 int bt_network_disable(void);
 
+/*
+ * Switch the connection to bulk transfer parameters (short interval,
+ * no slave latency) while active, and back to the idle ones otherwise.
+ * Call with true for every block received: the idle parameters are
+ * restored if no block arrives for CONFIG_FOTA_BT_BULK_STALL_TIMEOUT.
+ */
+void bt_network_bulk_transfer(bool active);
+
 #endif	/* FOTA_BLUETOOTH_H__ */
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap_rto.h"
+
+/* Variance multipliers of the strong and weak estimators */
+#define STRONG_K		4
+#define WEAK_K			1
+
+/* Weak samples from more retransmissions are too ambiguous to use */
+#define WEAK_MAX_TRANSMISSIONS	3
+
+#define RTO_MAX			K_SECONDS(60)
+#define RTO_AGING_LOW		K_SECONDS(1)
+#define RTO_AGING_HIGH		K_SECONDS(3)
+#define RTO_AGED_BASE		K_SECONDS(1)
+
+/* RFC 6298 smoothing: alpha = 1/8, beta = 1/4 */
+static u32_t estimator_update(struct coap_rto_estimator *est, u32_t rtt,
+			      u32_t k)
+{
+	u32_t delta;
+
+	if (!est->valid) {
+		est->srtt = rtt;
+		est->rttvar = rtt / 2;
+		est->valid = true;
+	} else {
+		delta = abs((s32_t)(est->srtt - rtt));
+		est->rttvar = (3 * est->rttvar + delta) / 4;
+		est->srtt = (7 * est->srtt + rtt) / 8;
+	}
+
+	return est->srtt + k * est->rttvar;
+}
+
+void coap_rto_init(struct coap_rto *rto, u32_t initial)
+{
+	memset(rto, 0, sizeof(*rto));
+	rto->rto = initial;
+	rto->updated = k_uptime_get();
+}
+
+void coap_rto_sample(struct coap_rto *rto, u32_t rtt, int transmissions)
+{
+	u32_t est;
+
+	if (transmissions == 1) {
+		est = estimator_update(&rto->strong, rtt, STRONG_K);
+		rto->rto = (rto->rto + est) / 2;
+	} else if (transmissions <= WEAK_MAX_TRANSMISSIONS) {
+		est = estimator_update(&rto->weak, rtt, WEAK_K);
+		rto->rto = (3 * rto->rto + est) / 4;
+	} else {
+		return;
+	}
+
+	rto->rto = MIN(rto->rto, RTO_MAX);
+	rto->updated = k_uptime_get();
+}
+
+u32_t coap_rto_get(struct coap_rto *rto)
+{
+	s64_t idle = k_uptime_get() - rto->updated;
+
+	/* Forget short estimates after 16 RTOs, long ones after 4 */
+	if (rto->rto < RTO_AGING_LOW && idle > 16 * rto->rto) {
+		rto->rto *= 2;
+		rto->updated = k_uptime_get();
+	} else if (rto->rto > RTO_AGING_HIGH && idle > 4 * rto->rto) {
+		rto->rto = RTO_AGED_BASE + rto->rto / 2;
+		rto->updated = k_uptime_get();
+	}
+
+	return rto->rto;
+}
+
+u32_t coap_rto_backoff(u32_t timeout)
+{
+	if (timeout < RTO_AGING_LOW) {
+		timeout *= 3;
+	} else if (timeout > RTO_AGING_HIGH) {
+		timeout += timeout / 2;
+	} else {
+		timeout *= 2;
+	}
+
+	return MIN(timeout, RTO_MAX);
+}
+
+u32_t coap_rto_srtt(const struct coap_rto *rto)
+{
+	if (rto->strong.valid) {
+		return rto->strong.srtt;
+	}
+
+	if (rto->weak.valid) {
+		return rto->weak.srtt;
+	}
+
+	return COAP_RTO_SRTT_UNKNOWN;
+}
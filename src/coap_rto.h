@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_COAP_RTO_H__
+#define FOTA_COAP_RTO_H__
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+/**
+ * @file
+ * @brief CoAP retransmission timeout estimation
+ *
+ * CoCoA style (draft-ietf-core-cocoa) RTO estimator for one CoAP peer.
+ * Exchanges answered on their first transmission feed a strong
+ * estimator, those answered after one or two retransmissions a weak
+ * one, and both are blended into an overall RTO which ages back
+ * towards a neutral value when the peer has not been heard from.
+ */
+
+/** Smoothed RTT reported before any exchange has been measured */
+#define COAP_RTO_SRTT_UNKNOWN	UINT32_MAX
+
+struct coap_rto_estimator {
+	/* Smoothed RTT and RTT variance, in milliseconds */
+	u32_t srtt;
+	u32_t rttvar;
+	bool valid;
+};
+
+struct coap_rto {
+	struct coap_rto_estimator strong;
+	struct coap_rto_estimator weak;
+	/* Overall RTO, in milliseconds */
+	u32_t rto;
+	/* Uptime of the last RTO update, in milliseconds */
+	s64_t updated;
+};
+
+/**
+ * @brief Reset an estimator.
+ *
+ * @param initial RTO used until the first measurement, in milliseconds.
+ */
+void coap_rto_init(struct coap_rto *rto, u32_t initial);
+
+/**
+ * @brief Feed the round trip time of a completed exchange.
+ *
+ * @param rtt Time from the first transmission to the answer, in
+ *        milliseconds.
+ * @param transmissions Number of times the request was sent.
+ */
+void coap_rto_sample(struct coap_rto *rto, u32_t rtt, int transmissions);
+
+/**
+ * @brief Get the timeout to use for the first transmission.
+ *
+ * Applies aging first, so an estimate which was not refreshed for a
+ * while drifts back towards the default.
+ */
+u32_t coap_rto_get(struct coap_rto *rto);
+
+/**
+ * @brief Get the timeout of the next retransmission.
+ *
+ * Uses CoCoA's variable backoff factor: short timeouts back off
+ * faster than long ones.
+ *
+ * @param timeout Timeout of the previous transmission, in milliseconds.
+ */
+u32_t coap_rto_backoff(u32_t timeout);
+
+/**
+ * @brief Get the smoothed RTT, in milliseconds.
+ *
+ * @return Strong estimate if any, else weak, else COAP_RTO_SRTT_UNKNOWN.
+ */
+u32_t coap_rto_srtt(const struct coap_rto *rto);
+
+#endif	/* FOTA_COAP_RTO_H__ */
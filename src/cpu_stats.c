@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_cpu_stats
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <string.h>
+
+#include "cpu_stats.h"
+
+#define WINDOW		K_SECONDS(CONFIG_FOTA_CPU_STATS_WINDOW)
+
+struct cpu_thread {
+	k_tid_t tid;
+	bool idle;
+	/* Cycles run since boot, and in the current window */
+	u64_t cycles;
+	u64_t window;
+	/* Share of the last window, in permille */
+	u16_t load;
+};
+
+/*
+ * Threads are added as they are first switched in, and never removed:
+ * application threads are never destroyed.
+ */
+static struct cpu_thread threads[CONFIG_FOTA_MEM_STATS_MAX_THREADS];
+static int thread_count;
+/* Threads which did not fit */
+static struct cpu_thread others;
+
+/* Thread running since switched_in, NULL before accounting starts */
+static struct cpu_thread *running;
+static u32_t switched_in;
+static u32_t window_start;
+static u16_t busy_load;
+
+static struct k_delayed_work window_work;
+
+/*
+ * The kernel calls these on every context switch, with interrupts
+ * locked. They are provided by CONFIG_TRACING_CPU_STATS and wrapped at
+ * link time (see app.cmake), so the kernel's own totals keep working.
+ */
+void __real_sys_trace_thread_switched_in(void);
+void __real_sys_trace_thread_switched_out(void);
+
+static struct cpu_thread *thread_get(k_tid_t tid)
+{
+	struct cpu_thread *t;
+	int i;
+
+	for (i = 0; i < thread_count; i++) {
+		if (threads[i].tid == tid) {
+			return &threads[i];
+		}
+	}
+
+	if (thread_count == ARRAY_SIZE(threads)) {
+		return &others;
+	}
+
+	t = &threads[thread_count++];
+	t->tid = tid;
+	t->idle = k_thread_priority_get(tid) == K_IDLE_PRIO;
+
+	return t;
+}
+
+/* Charge the running thread up to now; call with interrupts locked */
+static void charge(u32_t now)
+{
+	u32_t cycles = now - switched_in;
+
+	if (running) {
+		running->cycles += cycles;
+		running->window += cycles;
+	}
+
+	switched_in = now;
+}
+
+void __wrap_sys_trace_thread_switched_out(void)
+{
+	charge(k_cycle_get_32());
+	__real_sys_trace_thread_switched_out();
+}
+
+void __wrap_sys_trace_thread_switched_in(void)
+{
+	if (running) {
+		running = thread_get(k_current_get());
+		switched_in = k_cycle_get_32();
+	}
+	__real_sys_trace_thread_switched_in();
+}
+
+static void thread_window_end(struct cpu_thread *t, u32_t total)
+{
+	t->load = total ? t->window * 1000 / total : 0;
+	t->window = 0;
+}
+
+static void window_end(struct k_work *work)
+{
+	unsigned int key;
+	u32_t now, total;
+	u16_t idle = 0;
+	int i;
+
+	key = irq_lock();
+
+	now = k_cycle_get_32();
+	charge(now);
+	total = now - window_start;
+	window_start = now;
+
+	for (i = 0; i < thread_count; i++) {
+		thread_window_end(&threads[i], total);
+		if (threads[i].idle) {
+			idle = threads[i].load;
+		}
+	}
+
+	thread_window_end(&others, total);
+	busy_load = total ? 1000 - idle : 0;
+
+	irq_unlock(key);
+
+	k_delayed_work_submit(&window_work, WINDOW);
+}
+
+u16_t cpu_stats_load(void)
+{
+	return busy_load;
+}
+
+void cpu_stats_threads(cpu_stats_cb_t cb, void *user_data)
+{
+	struct cpu_thread copy[ARRAY_SIZE(threads) + 1];
+	struct cpu_thread_stats stats;
+	unsigned int key;
+	int i, count;
+
+	/* Report from a copy, so callbacks run with interrupts enabled */
+	key = irq_lock();
+	charge(k_cycle_get_32());
+	count = thread_count;
+	memcpy(copy, threads, count * sizeof(threads[0]));
+	if (others.cycles) {
+		copy[count++] = others;
+	}
+	irq_unlock(key);
+
+	for (i = 0; i < count; i++) {
+		stats.tid = copy[i].tid;
+		stats.load = copy[i].load;
+		stats.run_ms = SYS_CLOCK_HW_CYCLES_TO_NS64(copy[i].cycles) /
+			       NSEC_PER_MSEC;
+#if defined(CONFIG_THREAD_NAME)
+		stats.name = stats.tid ? k_thread_name_get(stats.tid) : NULL;
+#else
+		stats.name = NULL;
+#endif
+		cb(&stats, user_data);
+	}
+}
+
+void cpu_stats_init(void)
+{
+	unsigned int key;
+
+	k_delayed_work_init(&window_work, window_end);
+
+	/* The caller's thread runs from now on */
+	key = irq_lock();
+	window_start = k_cycle_get_32();
+	switched_in = window_start;
+	running = thread_get(k_current_get());
+	irq_unlock(key);
+
+	k_delayed_work_submit(&window_work, WINDOW);
+
+	LOG_INF("Accounting CPU usage on context switches");
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_CPU_STATS_H__
+#define FOTA_CPU_STATS_H__
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+
+/**
+ * @file
+ * @brief Per-thread CPU usage accounting
+ *
+ * The cycles each thread runs are accumulated at every context switch,
+ * from the kernel's tracing hooks, and each thread's share is computed
+ * over windows of CONFIG_FOTA_CPU_STATS_WINDOW seconds. No timer is
+ * involved, so an idle CPU stays asleep. Time spent in interrupts is
+ * charged to the thread they interrupted.
+ */
+
+/**
+ * @brief CPU usage of a thread.
+ */
+struct cpu_thread_stats {
+	k_tid_t tid;
+	/** Thread name, NULL if thread names are not enabled */
+	const char *name;
+	/** Share of the last window the thread ran, in permille */
+	u16_t load;
+	/** Time the thread ran since boot, in milliseconds */
+	u32_t run_ms;
+};
+
+/**
+ * @brief Called by cpu_stats_threads() for each thread.
+ *
+ * Time of threads which did not fit the table are reported last,
+ * with a NULL @a tid.
+ */
+typedef void (*cpu_stats_cb_t)(const struct cpu_thread_stats *stats,
+			       void *user_data);
+
+/**
+ * @brief Get the share of the last window the CPU was not idle.
+ *
+ * @return Load in permille.
+ */
+u16_t cpu_stats_load(void);
+
+/**
+ * @brief Report the CPU usage of every thread seen running.
+ */
+void cpu_stats_threads(cpu_stats_cb_t cb, void *user_data);
+
+/**
+ * @brief Start accounting, from the calling thread.
+ */
+void cpu_stats_init(void);
+
+#endif	/* FOTA_CPU_STATS_H__ */
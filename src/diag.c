@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_diag
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <init.h>
+#include <net/lwm2m.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+
+/* LwM2M engine internals, needed to define a custom object */
+#include "lwm2m_object.h"
+#include "lwm2m_engine.h"
+
+#include "diag.h"
+#include "mem_stats.h"
+#include "lwm2m_servers.h"
+#include "fw_writer.h"
+#include "lwm2m.h"
+#if defined(CONFIG_FOTA_CPU_STATS)
+#include "cpu_stats.h"
+#endif
+
+/* Longest per-thread CPU usage string; further threads are left out */
+#define CPU_THREADS_LEN	128
+
+/*
+ * Resources of the diagnostics object. All of them are read-only
+ * integers but the per-thread CPU usage string; values which cannot
+ * be measured in the current configuration read as -1 (or empty).
+ */
+enum diag_res_id {
+	/* Minimal libc malloc() arena, in bytes */
+	DIAG_LIBC_HEAP_SIZE_ID,
+	DIAG_LIBC_HEAP_USED_ID,
+	DIAG_LIBC_HEAP_PEAK_ID,
+	/* mbedTLS heap, in bytes */
+	DIAG_MBEDTLS_HEAP_SIZE_ID,
+	DIAG_MBEDTLS_HEAP_USED_ID,
+	DIAG_MBEDTLS_HEAP_PEAK_ID,
+	/* Smallest stack headroom of any thread, in bytes */
+	DIAG_STACK_MIN_UNUSED_ID,
+	/* Fewest free network packets and buffers seen since boot */
+	DIAG_NET_PKT_RX_MIN_FREE_ID,
+	DIAG_NET_PKT_TX_MIN_FREE_ID,
+	DIAG_NET_BUF_RX_MIN_FREE_ID,
+	DIAG_NET_BUF_TX_MIN_FREE_ID,
+	/* Failed allocations from each network pool */
+	DIAG_NET_PKT_RX_ALLOC_FAILURES_ID,
+	DIAG_NET_PKT_TX_ALLOC_FAILURES_ID,
+	DIAG_NET_BUF_RX_ALLOC_FAILURES_ID,
+	DIAG_NET_BUF_TX_ALLOC_FAILURES_ID,
+	/* Packets dropped by the network stack */
+	DIAG_NET_DROPS_ID,
+	/* Index of the LwM2M server in use, its smoothed RTT and RTO in ms */
+	DIAG_LWM2M_SERVER_ID,
+	DIAG_LWM2M_SERVER_RTT_ID,
+	DIAG_LWM2M_SERVER_RTO_ID,
+	/* CPU busy in the last window, in permille */
+	DIAG_CPU_LOAD_ID,
+	/* "name:permille" of each thread which ran in the last window */
+	DIAG_CPU_THREADS_ID,
+	/*
+	 * Flash erase and program time of the last firmware image, and
+	 * longest single block write, in microseconds
+	 */
+	DIAG_FW_ERASE_US_ID,
+	DIAG_FW_PROGRAM_US_ID,
+	DIAG_FW_BLOCK_MAX_US_ID,
+	/* Uptime at the first registration since boot, in ms */
+	DIAG_BOOT_REGISTERED_MS_ID,
+
+	DIAG_MAX_ID
+};
+
+static struct lwm2m_engine_obj diag_obj;
+static struct lwm2m_engine_obj_field fields[] = {
+	OBJ_FIELD_DATA(DIAG_LIBC_HEAP_SIZE_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_LIBC_HEAP_USED_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_LIBC_HEAP_PEAK_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_MBEDTLS_HEAP_SIZE_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_MBEDTLS_HEAP_USED_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_MBEDTLS_HEAP_PEAK_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_STACK_MIN_UNUSED_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_PKT_RX_MIN_FREE_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_PKT_TX_MIN_FREE_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_BUF_RX_MIN_FREE_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_BUF_TX_MIN_FREE_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_PKT_RX_ALLOC_FAILURES_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_PKT_TX_ALLOC_FAILURES_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_BUF_RX_ALLOC_FAILURES_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_BUF_TX_ALLOC_FAILURES_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_NET_DROPS_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_LWM2M_SERVER_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_LWM2M_SERVER_RTT_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_LWM2M_SERVER_RTO_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_CPU_LOAD_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_CPU_THREADS_ID, R, STRING),
+	OBJ_FIELD_DATA(DIAG_FW_ERASE_US_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_FW_PROGRAM_US_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_FW_BLOCK_MAX_US_ID, R, S32),
+	OBJ_FIELD_DATA(DIAG_BOOT_REGISTERED_MS_ID, R, S32),
+};
+
+BUILD_ASSERT_MSG(ARRAY_SIZE(fields) == DIAG_MAX_ID,
+		 "Diagnostics object fields out of sync with resource IDs");
+BUILD_ASSERT_MSG(DIAG_FW_ERASE_US_ID == 21 && DIAG_FW_BLOCK_MAX_US_ID == 23,
+		 "fota-bench.py reads flash timing from resources 21-23");
+
+static struct lwm2m_engine_obj_inst inst;
+static struct lwm2m_engine_res res[DIAG_MAX_ID];
+static struct lwm2m_engine_res_inst res_inst[DIAG_MAX_ID];
+static s32_t values[DIAG_MAX_ID];
+static char cpu_threads[CPU_THREADS_LEN];
+
+static s32_t heap_value(int (*get)(struct mem_heap_stats *stats),
+			u16_t res_id, u16_t size_id)
+{
+	struct mem_heap_stats stats;
+	int ret;
+
+	ret = get(&stats);
+	if (res_id == size_id) {
+		return stats.size ? stats.size : -1;
+	}
+
+	if (ret) {
+		return -1;
+	}
+
+	return res_id == size_id + 1 ? stats.used : stats.peak;
+}
+
+static s32_t net_pool_value(enum mem_net_pool pool, bool failures)
+{
+	struct mem_pool_stats stats;
+
+	if (mem_stats_net_pool(pool, &stats)) {
+		return -1;
+	}
+
+	return failures ? stats.alloc_failures : stats.min_free;
+}
+
+static s32_t net_drops_value(void)
+{
+	u32_t drops;
+
+	if (mem_stats_net_drops(&drops)) {
+		return -1;
+	}
+
+	return drops;
+}
+
+static s32_t server_rtt_value(void)
+{
+	u32_t rtt = lwm2m_servers_rtt(lwm2m_servers_current());
+
+	return rtt == LWM2M_SERVER_RTT_UNKNOWN ? -1 : rtt;
+}
+
+static s32_t fw_write_value(u16_t res_id)
+{
+	struct fw_writer_stats stats;
+
+	fw_writer_stats_get(&stats);
+	if (!stats.blocks) {
+		return -1;
+	}
+
+	switch (res_id) {
+	case DIAG_FW_ERASE_US_ID:
+		return stats.erase_us;
+	case DIAG_FW_PROGRAM_US_ID:
+		return stats.program_us;
+	default:
+		return stats.block_max_us;
+	}
+}
+
+#if defined(CONFIG_FOTA_CPU_STATS)
+static const char *cpu_thread_label(const struct cpu_thread_stats *stats,
+				    char *buf, size_t size)
+{
+	if (!stats->tid) {
+		return "others";
+	}
+
+	if (stats->name && stats->name[0]) {
+		return stats->name;
+	}
+
+	snprintk(buf, size, "%p", stats->tid);
+
+	return buf;
+}
+
+static void cpu_thread_append(const struct cpu_thread_stats *stats,
+			      void *user_data)
+{
+	size_t *len = user_data;
+	char label[12];
+
+	if (!stats->load || *len >= sizeof(cpu_threads)) {
+		return;
+	}
+
+	*len += snprintk(cpu_threads + *len, sizeof(cpu_threads) - *len,
+			 "%s%s:%u", *len ? " " : "",
+			 cpu_thread_label(stats, label, sizeof(label)),
+			 stats->load);
+}
+#endif
+
+static size_t cpu_threads_value(void)
+{
+	size_t len = 0;
+
+	cpu_threads[0] = '\0';
+#if defined(CONFIG_FOTA_CPU_STATS)
+	cpu_stats_threads(cpu_thread_append, &len);
+#endif
+
+	/* Drop a truncated entry */
+	if (len >= sizeof(cpu_threads)) {
+		len = sizeof(cpu_threads) - 1;
+		while (len && cpu_threads[len] != ' ') {
+			len--;
+		}
+		cpu_threads[len] = '\0';
+	}
+
+	return len;
+}
+
+static s32_t diag_value(u16_t res_id)
+{
+	switch (res_id) {
+	case DIAG_LIBC_HEAP_SIZE_ID:
+	case DIAG_LIBC_HEAP_USED_ID:
+	case DIAG_LIBC_HEAP_PEAK_ID:
+		return heap_value(mem_stats_libc_heap, res_id,
+				  DIAG_LIBC_HEAP_SIZE_ID);
+	case DIAG_MBEDTLS_HEAP_SIZE_ID:
+	case DIAG_MBEDTLS_HEAP_USED_ID:
+	case DIAG_MBEDTLS_HEAP_PEAK_ID:
+		return heap_value(mem_stats_mbedtls_heap, res_id,
+				  DIAG_MBEDTLS_HEAP_SIZE_ID);
+	case DIAG_STACK_MIN_UNUSED_ID:
+		return mem_stats_stacks(NULL, NULL);
+	case DIAG_NET_PKT_RX_MIN_FREE_ID:
+	case DIAG_NET_PKT_TX_MIN_FREE_ID:
+	case DIAG_NET_BUF_RX_MIN_FREE_ID:
+	case DIAG_NET_BUF_TX_MIN_FREE_ID:
+		return net_pool_value(res_id - DIAG_NET_PKT_RX_MIN_FREE_ID,
+				      false);
+	case DIAG_NET_PKT_RX_ALLOC_FAILURES_ID:
+	case DIAG_NET_PKT_TX_ALLOC_FAILURES_ID:
+	case DIAG_NET_BUF_RX_ALLOC_FAILURES_ID:
+	case DIAG_NET_BUF_TX_ALLOC_FAILURES_ID:
+		return net_pool_value(res_id -
+				      DIAG_NET_PKT_RX_ALLOC_FAILURES_ID,
+				      true);
+	case DIAG_NET_DROPS_ID:
+		return net_drops_value();
+	case DIAG_LWM2M_SERVER_ID:
+		return lwm2m_servers_current();
+	case DIAG_LWM2M_SERVER_RTT_ID:
+		return server_rtt_value();
+	case DIAG_LWM2M_SERVER_RTO_ID:
+		return lwm2m_servers_rto(lwm2m_servers_current());
+	case DIAG_CPU_LOAD_ID:
+#if defined(CONFIG_FOTA_CPU_STATS)
+		return cpu_stats_load();
+#else
+		return -1;
+#endif
+	case DIAG_FW_ERASE_US_ID:
+	case DIAG_FW_PROGRAM_US_ID:
+	case DIAG_FW_BLOCK_MAX_US_ID:
+		return fw_write_value(res_id);
+	case DIAG_BOOT_REGISTERED_MS_ID:
+		return lwm2m_boot_registered_ms() ?
+			lwm2m_boot_registered_ms() : -1;
+	default:
+		return -1;
+	}
+}
+
+static void *diag_read_cb(u16_t obj_inst_id, u16_t res_id, u16_t res_inst_id,
+			  size_t *data_len)
+{
+	if (res_id >= DIAG_MAX_ID) {
+		*data_len = 0;
+		return NULL;
+	}
+
+	if (res_id == DIAG_CPU_THREADS_ID) {
+		*data_len = cpu_threads_value();
+		return cpu_threads;
+	}
+
+	values[res_id] = diag_value(res_id);
+	*data_len = sizeof(values[res_id]);
+
+	return &values[res_id];
+}
+
+static struct lwm2m_engine_obj_inst *diag_create(u16_t obj_inst_id)
+{
+	int i = 0, j = 0, id;
+
+	if (inst.obj) {
+		LOG_ERR("Can not create instance - already existing: %u",
+			obj_inst_id);
+		return NULL;
+	}
+
+	init_res_instance(res_inst, ARRAY_SIZE(res_inst));
+
+	/* Single-instance resources: one resource instance each */
+	for (id = 0; id < DIAG_MAX_ID; id++) {
+		if (id == DIAG_CPU_THREADS_ID) {
+			INIT_OBJ_RES_DATA(id, res, i, res_inst, j,
+					  cpu_threads, sizeof(cpu_threads));
+		} else {
+			INIT_OBJ_RES_DATA(id, res, i, res_inst, j,
+					  &values[id], sizeof(values[id]));
+		}
+	}
+
+	inst.resources = res;
+	inst.resource_count = i;
+
+	return &inst;
+}
+
+static int diag_obj_init(struct device *dev)
+{
+	diag_obj.obj_id = DIAG_OBJ_ID;
+	diag_obj.fields = fields;
+	diag_obj.field_count = ARRAY_SIZE(fields);
+	diag_obj.max_instance_count = 1;
+	diag_obj.create_cb = diag_create;
+	lwm2m_register_obj(&diag_obj);
+
+	return 0;
+}
+
+SYS_INIT(diag_obj_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+
+int diag_init(void)
+{
+	char path[sizeof("65535/65535/65535")];
+	int ret, id;
+
+	snprintk(path, sizeof(path), "%u/0", DIAG_OBJ_ID);
+	ret = lwm2m_engine_create_obj_inst(path);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (id = 0; id < DIAG_MAX_ID; id++) {
+		snprintk(path, sizeof(path), "%u/0/%u", DIAG_OBJ_ID, id);
+		ret = lwm2m_engine_register_read_callback(path, diag_read_cb);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+#if defined(CONFIG_SHELL)
+static void print_heap(const struct shell *shell, const char *name,
+		       int (*get)(struct mem_heap_stats *stats))
+{
+	struct mem_heap_stats stats;
+
+	if (get(&stats)) {
+		shell_print(shell, "%-10s %6u bytes, usage unknown", name,
+			    stats.size);
+		return;
+	}
+
+	shell_print(shell, "%-10s %6u bytes, %6u used, %6u peak", name,
+		    stats.size, stats.used, stats.peak);
+}
+
+static void print_stack(const char *name, size_t size, size_t unused,
+			void *user_data)
+{
+	const struct shell *shell = user_data;
+
+	shell_print(shell, "%-20s %6zu bytes, %6zu unused (%zu%% used)",
+		    name ? name : "?", size, unused,
+		    size ? (size - unused) * 100 / size : 0);
+}
+
+static int cmd_diag_mem(const struct shell *shell, size_t argc, char **argv)
+{
+	static const char * const pool_names[] = {
+		[MEM_NET_PKT_RX] = "pkt rx",
+		[MEM_NET_PKT_TX] = "pkt tx",
+		[MEM_NET_BUF_RX] = "buf rx",
+		[MEM_NET_BUF_TX] = "buf tx",
+	};
+	struct mem_pool_stats pool;
+	int i;
+
+	shell_print(shell, "Heaps:");
+	print_heap(shell, "libc", mem_stats_libc_heap);
+	print_heap(shell, "mbedTLS", mem_stats_mbedtls_heap);
+
+	shell_print(shell, "Network pools:");
+	for (i = 0; i < MEM_NET_POOL_COUNT; i++) {
+		if (mem_stats_net_pool(i, &pool)) {
+			continue;
+		}
+
+		shell_print(shell, "%-10s %3u blocks, %3u free, %3u min free, "
+			    "%u failed allocations", pool_names[i], pool.count,
+			    pool.free, pool.min_free, pool.alloc_failures);
+	}
+
+	shell_print(shell, "Stacks:");
+	if (mem_stats_stacks(print_stack, (void *)shell) < 0) {
+		shell_print(shell, "Enable CONFIG_FOTA_DIAG_STACKS "
+			    "to report stack usage");
+	}
+
+	return 0;
+}
+
+static int cmd_diag_net(const struct shell *shell, size_t argc, char **argv)
+{
+	u32_t drops;
+
+	if (mem_stats_net_drops(&drops)) {
+		shell_print(shell, "Enable CONFIG_NET_STATISTICS_USER_API "
+			    "to count dropped packets");
+		return 0;
+	}
+
+	shell_print(shell, "Dropped packets: %u", drops);
+
+	return 0;
+}
+
+static int cmd_diag_servers(const struct shell *shell, size_t argc,
+			    char **argv)
+{
+	u32_t rtt;
+	int i;
+
+	for (i = 0; i < lwm2m_servers_count(); i++) {
+		rtt = lwm2m_servers_rtt(i);
+		if (rtt == LWM2M_SERVER_RTT_UNKNOWN) {
+			shell_print(shell, "%c %s, RTT unknown, RTO %u ms",
+				    i == lwm2m_servers_current() ? '*' : ' ',
+				    lwm2m_servers_host(i), lwm2m_servers_rto(i));
+		} else {
+			shell_print(shell, "%c %s, RTT %u ms, RTO %u ms",
+				    i == lwm2m_servers_current() ? '*' : ' ',
+				    lwm2m_servers_host(i), rtt,
+				    lwm2m_servers_rto(i));
+		}
+	}
+
+	return 0;
+}
+
+#if defined(CONFIG_FOTA_CPU_STATS)
+static void print_cpu_thread(const struct cpu_thread_stats *stats,
+			     void *user_data)
+{
+	const struct shell *shell = user_data;
+	char label[12];
+
+	shell_print(shell, "%-20s %3u.%u%%, %10u ms",
+		    cpu_thread_label(stats, label, sizeof(label)),
+		    stats->load / 10, stats->load % 10, stats->run_ms);
+}
+
+static int cmd_diag_cpu(const struct shell *shell, size_t argc, char **argv)
+{
+	u16_t load = cpu_stats_load();
+
+	shell_print(shell, "CPU busy %u.%u%% over the last %d s",
+		    load / 10, load % 10, CONFIG_FOTA_CPU_STATS_WINDOW);
+	cpu_stats_threads(print_cpu_thread, (void *)shell);
+
+	return 0;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_diag,
+#if defined(CONFIG_FOTA_CPU_STATS)
+	SHELL_CMD(cpu, NULL, "Show CPU usage per thread", cmd_diag_cpu),
+#endif
+	SHELL_CMD(mem, NULL, "Show RAM usage", cmd_diag_mem),
+	SHELL_CMD(net, NULL, "Show network drop counters", cmd_diag_net),
+	SHELL_CMD(servers, NULL, "Show LwM2M servers", cmd_diag_servers),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(diag, &sub_diag, "Application diagnostics", NULL);
+#endif /* CONFIG_SHELL */
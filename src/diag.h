@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_DIAG_H__
+#define FOTA_DIAG_H__
+
+/* Private LwM2M object carrying the application's diagnostics */
+#define DIAG_OBJ_ID	26241
+
+/**
+ * @brief Create the diagnostics object instance (DIAG_OBJ_ID/0).
+ *
+ * Must be called after the LwM2M engine has been initialized, and
+ * before the client registers so the object is announced.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+int diag_init(void);
+
+#endif	/* FOTA_DIAG_H__ */
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_fw_writer
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <string.h>
+#include <flash.h>
+#include <flash_map.h>
+
+#include "fw_writer.h"
+
+#define FW_SLOT_ID	DT_FLASH_AREA_IMAGE_1_ID
+
+/*
+ * Keeping the page buffer a multiple of the CoAP block size means a
+ * full block always fits in the space left, so blocks never straddle
+ * a flush.
+ */
+BUILD_ASSERT_MSG(CONFIG_FOTA_FW_WRITE_BUF_SIZE %
+		 CONFIG_LWM2M_COAP_BLOCK_SIZE == 0,
+		 "CONFIG_FOTA_FW_WRITE_BUF_SIZE must be a multiple of "
+		 "CONFIG_LWM2M_COAP_BLOCK_SIZE");
+
+struct fw_writer {
+	struct device *flash;
+	const struct flash_area *fa;
+	/* Bytes of the image programmed so far */
+	size_t programmed;
+	/* Offset, relative to the slot, up to which flash is erased */
+	off_t erased;
+	/* Bytes staged in buf */
+	size_t fill;
+	u8_t buf[CONFIG_FOTA_FW_WRITE_BUF_SIZE] __aligned(4);
+};
+
+static struct fw_writer writer;
+static struct fw_writer_stats write_stats;
+
+static u32_t us_since(u32_t start)
+{
+	return (u32_t)(SYS_CLOCK_HW_CYCLES_TO_NS64(k_cycle_get_32() - start) /
+		       NSEC_PER_USEC);
+}
+
+static int erase(off_t start, size_t size)
+{
+	u32_t cycles = k_cycle_get_32();
+	int ret;
+
+	ret = flash_area_erase(writer.fa, start, size);
+	write_stats.erase_us += us_since(cycles);
+
+	return ret;
+}
+
+static int erase_up_to(off_t end)
+{
+	struct flash_pages_info page;
+	off_t start;
+	int ret;
+
+	while (writer.erased < end) {
+		ret = flash_get_page_info_by_offs(writer.flash,
+						  writer.fa->fa_off +
+						  writer.erased, &page);
+		if (ret) {
+			return ret;
+		}
+
+		start = page.start_offset - writer.fa->fa_off;
+		ret = erase(start, page.size);
+		if (ret) {
+			LOG_ERR("Failed to erase sector at 0x%lx: %d",
+				(long)start, ret);
+			return ret;
+		}
+
+		writer.erased = start + page.size;
+	}
+
+	return 0;
+}
+
+static int program(void)
+{
+	size_t len = writer.fill;
+	u32_t cycles;
+	u8_t align;
+	int ret;
+
+	if (!len) {
+		return 0;
+	}
+
+	/* Only the last chunk can be short: pad it to the write size */
+	align = flash_area_align(writer.fa);
+	if (align > 1 && len % align) {
+		memset(&writer.buf[len], 0xff, align - len % align);
+		len += align - len % align;
+	}
+
+	if (writer.programmed + len > writer.fa->fa_size) {
+		return -EFBIG;
+	}
+
+	ret = erase_up_to(writer.programmed + len);
+	if (ret) {
+		return ret;
+	}
+
+	cycles = k_cycle_get_32();
+	ret = flash_area_write(writer.fa, writer.programmed, writer.buf, len);
+	write_stats.program_us += us_since(cycles);
+	if (ret) {
+		LOG_ERR("Failed to write at 0x%zx: %d", writer.programmed, ret);
+		return ret;
+	}
+
+	writer.programmed += writer.fill;
+	writer.fill = 0;
+
+	return 0;
+}
+
+int fw_writer_start(struct device *flash)
+{
+	struct flash_pages_info trailer;
+	int ret;
+
+	fw_writer_abort();
+
+	ret = flash_area_open(FW_SLOT_ID, &writer.fa);
+	if (ret) {
+		return ret;
+	}
+
+	writer.flash = flash;
+	memset(&write_stats, 0, sizeof(write_stats));
+
+	/* MCUboot reads the upgrade request from the slot's last sector */
+	ret = flash_get_page_info_by_offs(flash, writer.fa->fa_off +
+					  writer.fa->fa_size - 1, &trailer);
+	if (!ret) {
+		ret = erase(trailer.start_offset - writer.fa->fa_off,
+			    trailer.size);
+	}
+
+	if (ret) {
+		LOG_ERR("Failed to erase image trailer: %d", ret);
+		fw_writer_abort();
+	}
+
+	return ret;
+}
+
+u8_t *fw_writer_get_buf(size_t *len)
+{
+	*len = sizeof(writer.buf) - writer.fill;
+
+	return &writer.buf[writer.fill];
+}
+
+int fw_writer_write(const u8_t *data, size_t len, bool flush)
+{
+	u32_t cycles = k_cycle_get_32();
+	int ret;
+
+	if (!writer.fa) {
+		return -EINVAL;
+	}
+
+	write_stats.blocks++;
+
+	if (len > sizeof(writer.buf) - writer.fill) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Blocks written in place by the caller need no copy */
+	if (data != &writer.buf[writer.fill]) {
+		memmove(&writer.buf[writer.fill], data, len);
+	}
+
+	writer.fill += len;
+
+	if (writer.fill == sizeof(writer.buf) || flush) {
+		ret = program();
+		if (ret) {
+			goto out;
+		}
+	}
+
+	if (flush) {
+		/* Image complete: keep the byte count, release the slot */
+		flash_area_close(writer.fa);
+		writer.fa = NULL;
+	}
+
+	ret = 0;
+
+out:
+	if (ret) {
+		fw_writer_abort();
+	}
+
+	write_stats.block_max_us = MAX(write_stats.block_max_us,
+				       us_since(cycles));
+
+	return ret;
+}
+
+int fw_writer_erase_ahead(size_t size)
+{
+	int ret;
+
+	if (!writer.fa) {
+		return -EINVAL;
+	}
+
+	if (size > writer.fa->fa_size) {
+		ret = -EFBIG;
+	} else {
+		ret = erase_up_to(size);
+	}
+
+	if (ret) {
+		fw_writer_abort();
+	}
+
+	return ret;
+}
+
+void fw_writer_abort(void)
+{
+	if (writer.fa) {
+		flash_area_close(writer.fa);
+	}
+
+	writer.fa = NULL;
+	writer.programmed = 0;
+	writer.erased = 0;
+	writer.fill = 0;
+}
+
+size_t fw_writer_bytes_written(void)
+{
+	return writer.programmed + writer.fill;
+}
+
+void fw_writer_stats_get(struct fw_writer_stats *stats)
+{
+	*stats = write_stats;
+}
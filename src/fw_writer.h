@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_FW_WRITER_H__
+#define FOTA_FW_WRITER_H__
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <device.h>
+
+/**
+ * @file
+ * @brief Firmware image writer
+ *
+ * Writes a firmware image to the secondary (update) image slot, one
+ * block at a time, erasing flash sectors just before they are first
+ * written. Blocks are staged in a page buffer owned by the writer;
+ * callers which can fill that buffer directly (see fw_writer_get_buf())
+ * save a copy of each block.
+ */
+
+/** Flash timing of the image being, or last, written */
+struct fw_writer_stats {
+	/* Blocks passed to fw_writer_write() */
+	u32_t blocks;
+	/* Time spent erasing and programming, in microseconds */
+	u32_t erase_us;
+	u32_t program_us;
+	/* Longest single fw_writer_write() call, in microseconds */
+	u32_t block_max_us;
+};
+
+/**
+ * @brief Start writing a new image.
+ *
+ * Discards any partially written image and erases the sector holding
+ * the image trailer, so that the upgrade can be requested afterwards.
+ *
+ * @param flash Flash device containing the image slot.
+ * @return 0 on success, negative errno otherwise.
+ */
+int fw_writer_start(struct device *flash);
+
+/**
+ * @brief Get the free space of the page buffer.
+ *
+ * At least CONFIG_LWM2M_COAP_BLOCK_SIZE bytes are available as long as
+ * every block but the last is CONFIG_LWM2M_COAP_BLOCK_SIZE long.
+ *
+ * @param len Set to the number of bytes available.
+ * @return Pointer to the first free byte of the page buffer.
+ */
+u8_t *fw_writer_get_buf(size_t *len);
+
+/**
+ * @brief Append a block to the image.
+ *
+ * If @a data is the pointer returned by fw_writer_get_buf(), the block
+ * is already in place and is not copied.
+ *
+ * @param data Block data.
+ * @param len Block length.
+ * @param flush True for the last block: write out everything buffered.
+ * @return 0 on success, negative errno otherwise. On error, the image
+ *         is abandoned and fw_writer_start() must be called again.
+ */
+int fw_writer_write(const u8_t *data, size_t len, bool flush);
+
+/**
+ * @brief Erase the slot ahead of the image.
+ *
+ * Erases every sector up to @a size bytes into the slot now, instead of
+ * each one just before it is first written, e.g. once the image size is
+ * known. Sectors already erased are skipped.
+ *
+ * @param size Bytes of the slot to erase, at most the slot size.
+ * @return 0 on success, negative errno otherwise. On error, the image
+ *         is abandoned and fw_writer_start() must be called again.
+ */
+int fw_writer_erase_ahead(size_t size);
+
+/**
+ * @brief Abandon the image being written.
+ */
+void fw_writer_abort(void);
+
+/**
+ * @brief Get the number of bytes accepted for the current image.
+ */
+size_t fw_writer_bytes_written(void);
+
+/**
+ * @brief Get the flash timing of the current or last image.
+ *
+ * Counters are reset by fw_writer_start(), and kept once the image is
+ * complete or abandoned.
+ *
+ * @param stats Filled with the counters.
+ */
+void fw_writer_stats_get(struct fw_writer_stats *stats);
+
+#endif	/* FOTA_FW_WRITER_H__ */
@@ -1,37 +1,356 @@
 /*
  * Copyright (c) 2017 Linaro Limited
+ * Copyright (c) 2019 Foundries.io
  *
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#define LOG_MODULE_NAME fota_credentials
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
 #include "lwm2m_credentials.h"
 
+#include <zephyr.h>
+#include <ctype.h>
+#include <string.h>
 #include <flash.h>
+#include <crc32.h>
+#include <misc/byteorder.h>
 
 #define LWM2M_CREDENTIALS_BASE DT_FLASH_AREA_LWM2M_CREDENTIALS_OFFSET
+#define LWM2M_CREDENTIALS_SIZE DT_FLASH_AREA_LWM2M_CREDENTIALS_SIZE
+
+/* "LWCR", as stored little endian on flash */
+#define LWM2M_CREDENTIALS_MAGIC		0x5243574c
+#define LWM2M_CREDENTIALS_VERSION	1
+
+/**
+ * @brief On-flash header of the versioned credentials layout.
+ *
+ * All fields are little endian. The header is followed by `length`
+ * bytes of TLV records, protected by `crc` (CRC-32/IEEE).
+ */
+struct lwm2m_credentials_header {
+	u32_t magic;
+	u8_t version;
+	u8_t reserved;
+	u16_t length;
+	u32_t crc;
+} __packed;
+
+/**
+ * @brief On-flash TLV record header; `len` bytes of value follow.
+ */
+struct lwm2m_credentials_tlv {
+	u8_t type;
+	u16_t len;
+} __packed;
+
+enum lwm2m_credentials_tlv_type {
+	TLV_DEVICE_ID = 1,
+	TLV_PSK = 2,
+	TLV_RPK_PUBLIC = 3,
+	TLV_RPK_PRIVATE = 4,
+	TLV_CERTIFICATE = 5,
+	TLV_CA_CERTIFICATE = 6,
+};
 
 /**
- * @brief On-flash representation of lwm2m credentials data.
+ * @brief On-flash representation of the legacy (unversioned) layout.
  */
-struct lwm2m_credentials_data {
+struct lwm2m_credentials_legacy {
 	/** Device's unique ID in LWM2M */
 	char device_id[LWM2M_DEVICE_ID_SIZE];
-	/** Device's DTLS token in LWM2M */
+	/** Device's DTLS token in LWM2M, as a hex string */
 	char device_token[LWM2M_DEVICE_TOKEN_SIZE];
 };
 
-int lwm2m_get_device_id(struct device *flash,
-			char device_id[LWM2M_DEVICE_ID_SIZE])
+static struct lwm2m_credentials credentials;
+static int load_result = -EAGAIN;
+
+static int hex_to_bin(const char *src, u8_t *dst, size_t dst_len)
+{
+	size_t src_len, i, j = 0;
+	u8_t c = 0;
+
+	src_len = strlen(src);
+	for (i = 0; i < src_len; i++) {
+		if (isdigit(src[i])) {
+			c += src[i] - '0';
+		} else if (isxdigit(src[i])) {
+			c += src[i] - (isupper(src[i]) ? 'A' - 10 : 'a' - 10);
+		} else {
+			return -EINVAL;
+		}
+		if (i % 2) {
+			if (j >= dst_len) {
+				return -E2BIG;
+			}
+			dst[j++] = c;
+			c = 0;
+		} else {
+			c = c << 4;
+		}
+	}
+
+	return j;
+}
+
+static bool valid_device_id(const char *id, size_t len)
+{
+	size_t i;
+
+	if (len == 0 || len >= LWM2M_DEVICE_ID_SIZE) {
+		return false;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (!isprint((unsigned char)id[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static int load_legacy(struct device *flash)
+{
+	struct lwm2m_credentials_legacy legacy;
+	int ret;
+
+	ret = flash_read(flash, LWM2M_CREDENTIALS_BASE, &legacy,
+			 sizeof(legacy));
+	if (ret) {
+		return ret;
+	}
+
+	/* Erased flash reads back as 0xff, which fails both checks */
+	if (legacy.device_id[LWM2M_DEVICE_ID_SIZE - 1] == '\0' &&
+	    valid_device_id(legacy.device_id, strlen(legacy.device_id))) {
+		strcpy(credentials.device_id, legacy.device_id);
+	}
+
+	if (legacy.device_token[LWM2M_DEVICE_TOKEN_SIZE - 1] == '\0') {
+		ret = hex_to_bin(legacy.device_token, credentials.psk,
+				 sizeof(credentials.psk));
+		if (ret == LWM2M_DEVICE_TOKEN_HEX_SIZE) {
+			credentials.psk_len = ret;
+		}
+	}
+
+	if (!credentials.device_id[0] && !credentials.psk_len) {
+		return -ENOENT;
+	}
+
+	credentials.version = 0;
+
+	return 0;
+}
+
+static int check_crc(struct device *flash, off_t offset, size_t len,
+		     u32_t expected)
+{
+	u8_t buf[64];
+	size_t chunk;
+	u32_t crc = 0;
+	int ret;
+
+	while (len) {
+		chunk = MIN(len, sizeof(buf));
+		ret = flash_read(flash, offset, buf, chunk);
+		if (ret) {
+			return ret;
+		}
+
+		crc = crc32_ieee_update(crc, buf, chunk);
+		offset += chunk;
+		len -= chunk;
+	}
+
+	return crc == expected ? 0 : -EBADMSG;
+}
+
+static int parse_tlv(struct device *flash, off_t offset,
+		     const struct lwm2m_credentials_tlv *tlv)
+{
+	enum lwm2m_credentials_blob blob;
+	u16_t len = sys_le16_to_cpu(tlv->len);
+	int ret;
+
+	switch (tlv->type) {
+	case TLV_DEVICE_ID:
+		if (len >= sizeof(credentials.device_id)) {
+			return -EBADMSG;
+		}
+
+		ret = flash_read(flash, offset, credentials.device_id, len);
+		if (ret) {
+			return ret;
+		}
+
+		credentials.device_id[len] = '\0';
+		if (!valid_device_id(credentials.device_id, len)) {
+			credentials.device_id[0] = '\0';
+			return -EBADMSG;
+		}
+
+		return 0;
+
+	case TLV_PSK:
+		if (len > sizeof(credentials.psk)) {
+			return -EBADMSG;
+		}
+
+		ret = flash_read(flash, offset, credentials.psk, len);
+		if (ret) {
+			return ret;
+		}
+
+		credentials.psk_len = len;
+		return 0;
+
+	case TLV_RPK_PUBLIC:
+		blob = LWM2M_CRED_RPK_PUBLIC;
+		break;
+	case TLV_RPK_PRIVATE:
+		blob = LWM2M_CRED_RPK_PRIVATE;
+		break;
+	case TLV_CERTIFICATE:
+		blob = LWM2M_CRED_CERTIFICATE;
+		break;
+	case TLV_CA_CERTIFICATE:
+		blob = LWM2M_CRED_CA_CERTIFICATE;
+		break;
+
+	default:
+		/* Unknown records are skipped for forward compatibility */
+		LOG_DBG("Skipping credentials record type %u", tlv->type);
+		return 0;
+	}
+
+	credentials.blob[blob].offset = offset;
+	credentials.blob[blob].len = len;
+
+	return 0;
+}
+
+static int load_tlv(struct device *flash,
+		    const struct lwm2m_credentials_header *hdr)
+{
+	struct lwm2m_credentials_tlv tlv;
+	off_t offset = LWM2M_CREDENTIALS_BASE + sizeof(*hdr);
+	off_t end = offset + sys_le16_to_cpu(hdr->length);
+	int ret;
+
+	if (hdr->version != LWM2M_CREDENTIALS_VERSION) {
+		LOG_ERR("Unsupported credentials version %u", hdr->version);
+		return -EBADMSG;
+	}
+
+	if (sys_le16_to_cpu(hdr->length) >
+	    LWM2M_CREDENTIALS_SIZE - sizeof(*hdr)) {
+		return -EBADMSG;
+	}
+
+	ret = check_crc(flash, offset, sys_le16_to_cpu(hdr->length),
+			sys_le32_to_cpu(hdr->crc));
+	if (ret) {
+		return ret;
+	}
+
+	while (offset < end) {
+		if (end - offset < sizeof(tlv)) {
+			return -EBADMSG;
+		}
+
+		ret = flash_read(flash, offset, &tlv, sizeof(tlv));
+		if (ret) {
+			return ret;
+		}
+
+		offset += sizeof(tlv);
+		if (end - offset < sys_le16_to_cpu(tlv.len)) {
+			return -EBADMSG;
+		}
+
+		ret = parse_tlv(flash, offset, &tlv);
+		if (ret) {
+			return ret;
+		}
+
+		offset += sys_le16_to_cpu(tlv.len);
+	}
+
+	credentials.version = hdr->version;
+
+	return 0;
+}
+
+int lwm2m_credentials_load(struct device *flash)
+{
+	struct lwm2m_credentials_header hdr;
+	int ret;
+
+	if (load_result != -EAGAIN) {
+		return load_result;
+	}
+
+	memset(&credentials, 0, sizeof(credentials));
+
+	ret = flash_read(flash, LWM2M_CREDENTIALS_BASE, &hdr, sizeof(hdr));
+	if (ret) {
+		return ret;
+	}
+
+	if (sys_le32_to_cpu(hdr.magic) == LWM2M_CREDENTIALS_MAGIC) {
+		ret = load_tlv(flash, &hdr);
+	} else {
+		ret = load_legacy(flash);
+	}
+
+	if (ret) {
+		memset(&credentials, 0, sizeof(credentials));
+		if (ret == -EBADMSG) {
+			LOG_ERR("Credentials partition is corrupt");
+		}
+	} else {
+		LOG_INF("Loaded credentials (layout version %u)",
+			credentials.version);
+	}
+
+	load_result = ret;
+
+	return ret;
+}
+
+const struct lwm2m_credentials *lwm2m_credentials_get(void)
 {
-	off_t offset = LWM2M_CREDENTIALS_BASE +
-		offsetof(struct lwm2m_credentials_data, device_id);
-	return flash_read(flash, offset, device_id, LWM2M_DEVICE_ID_SIZE);
+	return load_result ? NULL : &credentials;
 }
 
-int lwm2m_get_device_token(struct device *flash,
-			   char device_token[LWM2M_DEVICE_TOKEN_SIZE])
+int lwm2m_credentials_read_blob(struct device *flash,
+				enum lwm2m_credentials_blob type,
+				u8_t *buf, size_t len)
 {
-	off_t offset = LWM2M_CREDENTIALS_BASE +
-		offsetof(struct lwm2m_credentials_data, device_token);
-	return flash_read(flash, offset, device_token, LWM2M_DEVICE_TOKEN_SIZE);
+	int ret;
+
+	if (load_result || type >= LWM2M_CRED_BLOB_COUNT ||
+	    !credentials.blob[type].len) {
+		return -ENOENT;
+	}
+
+	if (credentials.blob[type].len > len) {
+		return -ENOMEM;
+	}
+
+	ret = flash_read(flash, credentials.blob[type].offset, buf,
+			 credentials.blob[type].len);
+	if (ret) {
+		return ret;
+	}
+
+	return credentials.blob[type].len;
 }
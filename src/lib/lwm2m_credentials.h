@@ -1,5 +1,6 @@
 /*
  * Copyright (c) 2017 Linaro Limited
+ * Copyright (c) 2019 Foundries.io
  *
  * SPDX-License-Identifier: Apache-2.0
  */
@@ -12,32 +13,82 @@
 #define LWM2M_DEVICE_ID_SIZE (32 + 1)
 #define LWM2M_DEVICE_TOKEN_SIZE (32 + 1)
 #define LWM2M_DEVICE_TOKEN_HEX_SIZE (16)
+#define LWM2M_DEVICE_PSK_MAX_SIZE (32)
 
 /**
- * @brief Get a copy of this device's unique ID.
+ * @brief Credentials which are too large to be cached in RAM.
  *
- * The argument array must be large enough to contain a
- * null-terminated string of size LWM2M_DEVICE_ID_SIZE.
+ * Their location within the credentials partition is recorded when
+ * the partition is parsed; use lwm2m_credentials_read_blob() to read
+ * them when they are needed.
+ */
+enum lwm2m_credentials_blob {
+	/** Raw public key (RPK), DER encoded */
+	LWM2M_CRED_RPK_PUBLIC,
+	/** Raw public key private part, DER encoded */
+	LWM2M_CRED_RPK_PRIVATE,
+	/** Device certificate, DER encoded */
+	LWM2M_CRED_CERTIFICATE,
+	/** Server CA certificate, DER encoded */
+	LWM2M_CRED_CA_CERTIFICATE,
+
+	LWM2M_CRED_BLOB_COUNT,
+};
+
+/**
+ * @brief Parsed contents of the credentials partition.
+ */
+struct lwm2m_credentials {
+	/** Layout version found on flash, 0 for the legacy layout */
+	u8_t version;
+	/** Device's unique ID in LWM2M, empty if not provisioned */
+	char device_id[LWM2M_DEVICE_ID_SIZE];
+	/** Device's binary DTLS pre-shared key */
+	u8_t psk[LWM2M_DEVICE_PSK_MAX_SIZE];
+	/** Length of psk, 0 if not provisioned */
+	size_t psk_len;
+	/** Flash offset and length of each blob, length 0 if absent */
+	struct {
+		off_t offset;
+		u16_t len;
+	} blob[LWM2M_CRED_BLOB_COUNT];
+};
+
+/**
+ * @brief Parse the credentials partition into the RAM cache.
+ *
+ * The versioned layout written by scripts/gen_cred_partition.py is
+ * checked against its CRC before any of it is used. Partitions in the
+ * original fixed layout (two 33 byte strings) are still accepted.
+ * This only needs to be called once; later calls return the cached
+ * result.
  *
  * @param flash Flash device containing the data.
- * @param device_id Pointer to character array to copy the data into.
- * @return flash_read() return code
+ * @return 0 on success, -ENOENT if the partition is not provisioned,
+ *         -EBADMSG if it is corrupt, or a flash_read() error.
  */
-int lwm2m_get_device_id(struct device *flash,
-			char device_id[LWM2M_DEVICE_ID_SIZE]);
+int lwm2m_credentials_load(struct device *flash);
 
 /**
- * @brief Get a copy of this device's DTLS login token.
+ * @brief Get the credentials parsed by lwm2m_credentials_load().
  *
- * The argument array must be large enough to contain a
- * null-terminated string of size LWM2M_DEVICE_TOKEN_SIZE.
+ * @return Pointer to the cached credentials, or NULL if they have not
+ *         been loaded successfully.
+ */
+const struct lwm2m_credentials *lwm2m_credentials_get(void);
+
+/**
+ * @brief Read a credential blob from the credentials partition.
  *
  * @param flash Flash device containing the data.
- * @param device_token Pointer to character array to copy the data
- *                     into.
- * @return flash_read() return code
+ * @param type Blob to read.
+ * @param buf Buffer to copy the blob into.
+ * @param len Size of buf.
+ * @return Length of the blob, -ENOENT if it is not provisioned,
+ *         -ENOMEM if buf is too small, or a flash_read() error.
  */
-int lwm2m_get_device_token(struct device *flash,
-			   char device_token[LWM2M_DEVICE_TOKEN_SIZE]);
+int lwm2m_credentials_read_blob(struct device *flash,
+				enum lwm2m_credentials_blob type,
+				u8_t *buf, size_t len);
 
 #endif	/* FOTA_LWM2M_CREDENTIALS_H__ */
@@ -30,6 +30,35 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #elif defined(CONFIG_SOC_SERIES_KINETIS_K6X)
 #define DEVICE_ID_BASE		(&SIM->UIDH)
 #define DEVICE_ID_LENGTH	4
+#elif defined(CONFIG_BOARD_NATIVE_POSIX)
+/* Set with --device-id, so several instances can register at once */
+#define DEVICE_ID_BASE		(&native_device_id)
+#define DEVICE_ID_LENGTH	1
+#endif
+
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+#include "cmdline.h"
+
+static u32_t native_device_id;
+
+static void add_device_id_option(void)
+{
+	static struct args_struct_t device_id_options[] = {
+		{
+			.option = "device-id",
+			.name = "id",
+			.type = 'u',
+			.dest = (void *)&native_device_id,
+			.descript = "Hardware ID the serial number and "
+				    "LwM2M endpoint name derive from",
+		},
+		ARG_TABLE_ENDMARKER
+	};
+
+	native_add_command_line_opts(device_id_options);
+}
+
+NATIVE_TASK(add_device_id_option, PRE_BOOT_1, 10);
 #endif
 
 static struct product_id_t product_id = {
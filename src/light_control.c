@@ -1,6 +1,6 @@
 /*
  * Copyright (c) 2016-2017 Linaro Limited
- * Copyright (c) 2017-2018 Foundries.io
+ * Copyright (c) 2017-2019 Foundries.io
  *
  * SPDX-License-Identifier: Apache-2.0
  */
@@ -13,9 +13,21 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #include <zephyr.h>
 #include <gpio.h>
+#if defined(CONFIG_FOTA_LIGHT_PWM)
+#include <pwm.h>
+#endif
 #include <net/lwm2m.h>
 
+#include "obs_sched.h"
+
 /* Defines for the IPSO light-control elements */
+#if defined(CONFIG_FOTA_LIGHT_VIRTUAL)
+#define LED_DEV		"(none)"
+#elif defined(CONFIG_FOTA_LIGHT_PWM)
+#define LED_DEV		DT_ALIAS_PWM_LED0_PWMS_CONTROLLER
+#define LED_PWM_CHANNEL	DT_ALIAS_PWM_LED0_PWMS_CHANNEL
+#define LED_PWM_PERIOD	CONFIG_FOTA_LIGHT_PWM_PERIOD_USEC
+#else
 #ifndef DT_ALIAS_LED0_GPIOS_CONTROLLER
 #ifdef LED0_GPIO_PORT
 #define DT_ALIAS_LED0_GPIOS_CONTROLLER 	LED0_GPIO_PORT
@@ -26,90 +38,282 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #endif
 #endif
 
-#define LED_GPIO_PORT	DT_ALIAS_LED0_GPIOS_CONTROLLER
+#define LED_DEV		DT_ALIAS_LED0_GPIOS_CONTROLLER
 #define LED_GPIO_PIN	DT_ALIAS_LED0_GPIOS_PIN
 #define LED_GPIO_FLAGS	DT_ALIAS_LED0_GPIOS_FLAGS
+#endif /* CONFIG_FOTA_LIGHT_PWM */
+
+#define LIGHT_ON_OFF_PATH	"3311/0/5850"
+#define LIGHT_DIMMER_PATH	"3311/0/5851"
+#define LIGHT_ON_TIME_PATH	"3311/0/5852"
+
+#define LIGHT_OBJ_ID		3311
+#define LIGHT_ON_TIME_RES_ID	5852
+
+#define DIMMER_MAX		100
+
+struct light_state {
+	/* Last values written by the server */
+	u8_t on_off;
+	u8_t dimmer;
+
+	/* Values currently applied to the LED */
+	u8_t led_on_off;
+	u8_t led_dimmer;
+
+	/* On-time accumulator, in milliseconds of uptime */
+	s64_t on_since;
+	s64_t on_time_ms;
+	s32_t on_time;
+};
 
 static struct device *led_dev;
-static u8_t led_current;
+static struct light_state light;
+
+/* Coalesces bursts of writes into a single LED update */
+static struct k_delayed_work update_work;
+static atomic_t update_pending;
+
+static struct obs_source on_time_source = {
+	.obj_id = LIGHT_OBJ_ID,
+	.obj_inst_id = 0,
+	.res_id = LIGHT_ON_TIME_RES_ID,
+};
+
+static int led_set(u8_t on_off, u8_t dimmer)
+{
+#if defined(CONFIG_FOTA_LIGHT_VIRTUAL)
+	LOG_DBG("Light %s, dimmer %u", on_off ? "on" : "off", dimmer);
+
+	return 0;
+#elif defined(CONFIG_FOTA_LIGHT_PWM)
+	u32_t pulse = on_off ? LED_PWM_PERIOD * dimmer / DIMMER_MAX : 0;
+
+	if (IS_ENABLED(CONFIG_FOTA_LED_GPIO_INVERTED)) {
+		pulse = LED_PWM_PERIOD - pulse;
+	}
+
+	return pwm_pin_set_usec(led_dev, LED_PWM_CHANNEL, LED_PWM_PERIOD,
+				pulse);
+#else
+	ARG_UNUSED(dimmer);
+
+	return gpio_pin_write(led_dev, LED_GPIO_PIN,
+			      IS_ENABLED(CONFIG_FOTA_LED_GPIO_INVERTED) ?
+				!on_off : on_off);
+#endif
+}
+
+static void on_time_account(u8_t on_off)
+{
+	s64_t now = k_uptime_get();
+	unsigned int key;
+
+	key = irq_lock();
+	if (light.led_on_off && !on_off) {
+		light.on_time_ms += now - light.on_since;
+	} else if (!light.led_on_off && on_off) {
+		light.on_since = now;
+	}
+	irq_unlock(key);
+}
+
+static void light_update(struct k_work *work)
+{
+	u8_t on_off, dimmer;
+	int ret;
+
+	/*
+	 * Clear the pending flag before sampling the requested state, so
+	 * that a write racing with this handler schedules another update
+	 * instead of being lost.
+	 */
+	atomic_clear(&update_pending);
+	on_off = light.on_off;
+	dimmer = light.dimmer;
+
+	if (on_off == light.led_on_off && dimmer == light.led_dimmer) {
+		return;
+	}
+
+	ret = led_set(on_off, dimmer);
+	if (ret) {
+		/*
+		 * We need an extra hook in LWM2M to better handle
+		 * failures before writing the data value and not in
+		 * post_write_cb, as there is not much that can be
+		 * done here.
+		 */
+		LOG_ERR("Fail to set LED: %d", ret);
+		return;
+	}
+
+	on_time_account(on_off);
+	light.led_on_off = on_off;
+	light.led_dimmer = dimmer;
+
+	/* Notified on the next observation tick with everything else */
+	obs_sched_notify(&on_time_source);
+}
+
+static void light_schedule_update(void)
+{
+	/*
+	 * Only the first write of a burst arms the timer: later writes
+	 * ride along, which bounds the delay between any write and the
+	 * LED change to CONFIG_FOTA_LIGHT_COALESCE_MS.
+	 */
+	if (!atomic_set(&update_pending, 1)) {
+		k_delayed_work_submit(&update_work,
+				      CONFIG_FOTA_LIGHT_COALESCE_MS);
+	}
+}
 
 /* TODO: Move to a pre write hook that can handle ret codes once available */
 static int on_off_cb(u16_t obj_inst_id, u16_t res_id, u16_t res_inst_id,
 		     u8_t *data, u16_t data_len,
 		     bool last_block, size_t total_size)
 {
-	int ret = 0;
-	u8_t led_val;
-
 	if (data_len != 1) {
 		LOG_ERR("Length of on_off callback data is incorrect! (%u)",
 			data_len);
 		return -EINVAL;
 	}
 
-	led_val = *data;
-	if (led_val != led_current) {
-		ret = gpio_pin_write(led_dev, LED_GPIO_PIN,
-				     IS_ENABLED(CONFIG_FOTA_LED_GPIO_INVERTED) ?
-					!led_val : led_val);
-		if (ret) {
-			/*
-			 * We need an extra hook in LWM2M to better handle
-			 * failures before writing the data value and not in
-			 * post_write_cb, as there is not much that can be
-			 * done here.
-			 */
-			LOG_ERR("Fail to write to GPIO %d", LED_GPIO_PIN);
-			return ret;
-		}
+	light.on_off = *data ? 1 : 0;
+	light_schedule_update();
 
-		led_current = led_val;
-		/* TODO: Move to be set by the IPSO object itself */
-		lwm2m_engine_set_s32("3311/0/5852", 0);
+	return 0;
+}
+
+static int dimmer_cb(u16_t obj_inst_id, u16_t res_id, u16_t res_inst_id,
+		     u8_t *data, u16_t data_len,
+		     bool last_block, size_t total_size)
+{
+	if (data_len != 1) {
+		LOG_ERR("Length of dimmer callback data is incorrect! (%u)",
+			data_len);
+		return -EINVAL;
 	}
 
-	return ret;
+	light.dimmer = MIN(*data, DIMMER_MAX);
+	light_schedule_update();
+
+	return 0;
+}
+
+static void *on_time_read_cb(u16_t obj_inst_id, u16_t res_id,
+			     u16_t res_inst_id, size_t *data_len)
+{
+	s64_t on_time_ms;
+	unsigned int key;
+
+	key = irq_lock();
+	on_time_ms = light.on_time_ms;
+	if (light.led_on_off) {
+		on_time_ms += k_uptime_get() - light.on_since;
+	}
+	irq_unlock(key);
+
+	light.on_time = (s32_t)(on_time_ms / MSEC_PER_SEC);
+	*data_len = sizeof(light.on_time);
+
+	obs_sched_read(&on_time_source);
+
+	return &light.on_time;
+}
+
+static int on_time_write_cb(u16_t obj_inst_id, u16_t res_id,
+			    u16_t res_inst_id, u8_t *data, u16_t data_len,
+			    bool last_block, size_t total_size)
+{
+	unsigned int key;
+	u16_t i;
+
+	/* Writing 0 resets the counter, other values are ignored */
+	for (i = 0; i < data_len; i++) {
+		if (data[i]) {
+			return 0;
+		}
+	}
+
+	key = irq_lock();
+	light.on_time_ms = 0;
+	light.on_since = k_uptime_get();
+	irq_unlock(key);
+
+	return 0;
 }
 
 int init_light_control(void)
 {
 	int ret;
 
-	led_dev = device_get_binding(LED_GPIO_PORT);
-	LOG_INF("%s LED GPIO port %s", led_dev ? "Found" : "Did not find",
-		LED_GPIO_PORT);
+#if defined(CONFIG_FOTA_LIGHT_VIRTUAL)
+	LOG_INF("Light Control has no LED");
+#else
+	led_dev = device_get_binding(LED_DEV);
+	LOG_INF("%s LED device %s", led_dev ? "Found" : "Did not find",
+		LED_DEV);
 
 	if (!led_dev) {
 		LOG_ERR("No LED device found.");
 		ret = -ENODEV;
 		goto fail;
 	}
+#endif
 
+#if !defined(CONFIG_FOTA_LIGHT_PWM) && !defined(CONFIG_FOTA_LIGHT_VIRTUAL)
 	ret = gpio_pin_configure(led_dev, LED_GPIO_PIN,
 				 GPIO_DIR_OUT | LED_GPIO_FLAGS);
 	if (ret) {
 		LOG_ERR("Error configuring LED GPIO.");
 		goto fail;
 	}
+#endif
 
-	ret = gpio_pin_write(led_dev, LED_GPIO_PIN,
-			     IS_ENABLED(CONFIG_FOTA_LED_GPIO_INVERTED) ? 1 : 0);
+	light.dimmer = DIMMER_MAX;
+	light.led_dimmer = DIMMER_MAX;
+	ret = led_set(0, light.dimmer);
 	if (ret) {
-		LOG_ERR("Error setting LED GPIO.");
+		LOG_ERR("Error setting LED.");
 		goto fail;
 	}
 
+	k_delayed_work_init(&update_work, light_update);
+	obs_sched_add(&on_time_source);
+
 	ret = lwm2m_engine_create_obj_inst("3311/0");
 	if (ret < 0) {
 		goto fail;
 	}
 
-	ret = lwm2m_engine_register_post_write_callback("3311/0/5850",
+	lwm2m_engine_set_u8(LIGHT_DIMMER_PATH, light.dimmer);
+
+	ret = lwm2m_engine_register_post_write_callback(LIGHT_ON_OFF_PATH,
 							on_off_cb);
 	if (ret < 0) {
 		goto fail;
 	}
 
+	ret = lwm2m_engine_register_post_write_callback(LIGHT_DIMMER_PATH,
+							dimmer_cb);
+	if (ret < 0) {
+		goto fail;
+	}
+
+	ret = lwm2m_engine_register_read_callback(LIGHT_ON_TIME_PATH,
+						  on_time_read_cb);
+	if (ret < 0) {
+		goto fail;
+	}
+
+	ret = lwm2m_engine_register_post_write_callback(LIGHT_ON_TIME_PATH,
+							on_time_write_cb);
+	if (ret < 0) {
+		goto fail;
+	}
+
 	return 0;
 
 fail:
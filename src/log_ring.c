@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_log_ring
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <init.h>
+#include <string.h>
+#include <misc/byteorder.h>
+#include <logging/log_backend.h>
+#include <logging/log_msg.h>
+#include <logging/log_ctrl.h>
+#include <net/lwm2m.h>
+
+/* LwM2M engine internals, needed to define a custom object */
+#include "lwm2m_object.h"
+#include "lwm2m_engine.h"
+
+#include "log_ring.h"
+
+BUILD_ASSERT_MSG((CONFIG_FOTA_LOG_RING_SIZE &
+		  (CONFIG_FOTA_LOG_RING_SIZE - 1)) == 0,
+		 "CONFIG_FOTA_LOG_RING_SIZE must be a power of two");
+
+/* Written at boot, checked to tell a warm reset from a cold boot */
+#define RING_MAGIC		0x4c4f4731
+
+/*
+ * Record layout, little endian, no padding (scripts/log_ring_decode.py
+ * must be kept in sync):
+ *
+ *   u8  flags      level (bits 0-2), hexdump (bit 3)
+ *   u8  count      number of arguments, or of hexdump bytes
+ *   u16 source     log source ID
+ *   u32 timestamp  log timestamp, in CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC
+ *   u32 fmt        address of the format string
+ *   followed by count u32 arguments, or count hexdump bytes
+ */
+#define REC_HDR_LEN		12
+#define REC_LEVEL_MASK		0x07
+#define REC_HEXDUMP		BIT(3)
+#define REC_HEXDUMP_MAX		16
+
+#define REC_LEN(flags, count) \
+	(REC_HDR_LEN + ((flags) & REC_HEXDUMP ? (count) : (count) * 4))
+
+#define RING_INDEX(pos)		((pos) & (CONFIG_FOTA_LOG_RING_SIZE - 1))
+
+struct log_ring {
+	u32_t magic;
+	/* Stream positions of the next byte and of the oldest record */
+	u32_t head;
+	u32_t tail;
+	u8_t buf[CONFIG_FOTA_LOG_RING_SIZE];
+};
+
+/* Kept across warm resets, to read what led up to them */
+static struct log_ring ring __noinit;
+
+/* Messages per source in the current one second window */
+struct rate_limit {
+	u32_t window;
+	u16_t count;
+};
+
+static struct rate_limit limits[CONFIG_FOTA_LOG_RING_MAX_SOURCES];
+static u32_t dropped;
+
+enum log_ring_res_id {
+	/* Stream positions of the oldest byte and just past the newest */
+	LOG_RING_OLDEST_ID,
+	LOG_RING_NEWEST_ID,
+	/* Stream position the next chunk read starts at */
+	LOG_RING_OFFSET_ID,
+	/* Up to CONFIG_FOTA_LOG_RING_CHUNK bytes of records from OFFSET */
+	LOG_RING_CHUNK_ID,
+	/* Messages rate limited or lost by the logger */
+	LOG_RING_DROPPED_ID,
+	/* Frequency of the record timestamps, in Hz */
+	LOG_RING_TIMESTAMP_FREQ_ID,
+	/* Empty the ring */
+	LOG_RING_CLEAR_ID,
+
+	LOG_RING_MAX_ID
+};
+
+static struct lwm2m_engine_obj log_ring_obj;
+static struct lwm2m_engine_obj_field fields[] = {
+	OBJ_FIELD_DATA(LOG_RING_OLDEST_ID, R, U32),
+	OBJ_FIELD_DATA(LOG_RING_NEWEST_ID, R, U32),
+	OBJ_FIELD_DATA(LOG_RING_OFFSET_ID, RW, U32),
+	OBJ_FIELD_DATA(LOG_RING_CHUNK_ID, R, OPAQUE),
+	OBJ_FIELD_DATA(LOG_RING_DROPPED_ID, R, U32),
+	OBJ_FIELD_DATA(LOG_RING_TIMESTAMP_FREQ_ID, R, U32),
+	OBJ_FIELD_EXECUTE(LOG_RING_CLEAR_ID),
+};
+
+BUILD_ASSERT_MSG(ARRAY_SIZE(fields) == LOG_RING_MAX_ID,
+		 "Log ring object fields out of sync with resource IDs");
+
+/* Every resource but Clear (executable) has a single instance */
+#define LOG_RING_RES_INST_COUNT	(LOG_RING_MAX_ID - 1)
+
+static struct lwm2m_engine_obj_inst inst;
+static struct lwm2m_engine_res res[LOG_RING_MAX_ID];
+static struct lwm2m_engine_res_inst res_inst[LOG_RING_RES_INST_COUNT];
+static u32_t oldest, newest, offset, timestamp_freq;
+static u8_t chunk[CONFIG_FOTA_LOG_RING_CHUNK];
+
+static void ring_reset(void)
+{
+	ring.magic = RING_MAGIC;
+	ring.head = 0;
+	ring.tail = 0;
+}
+
+static bool ring_valid(void)
+{
+	u32_t pos = ring.tail;
+	u8_t flags, count;
+
+	if (ring.magic != RING_MAGIC ||
+	    ring.head - ring.tail > CONFIG_FOTA_LOG_RING_SIZE) {
+		return false;
+	}
+
+	/* The records must chain from tail to head exactly */
+	while (pos != ring.head) {
+		if (ring.head - pos < REC_HDR_LEN) {
+			return false;
+		}
+
+		flags = ring.buf[RING_INDEX(pos)];
+		count = ring.buf[RING_INDEX(pos + 1)];
+		pos += REC_LEN(flags, count);
+		if (pos - ring.tail > ring.head - ring.tail) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void ring_put(const u8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		ring.buf[RING_INDEX(ring.head + i)] = data[i];
+	}
+
+	ring.head += len;
+}
+
+/* Must be called with interrupts locked */
+static void ring_write(const u8_t *hdr, const u8_t *payload, size_t len)
+{
+	u8_t flags, count;
+
+	/* Evict whole records, so the tail always starts one */
+	while (CONFIG_FOTA_LOG_RING_SIZE - (ring.head - ring.tail) <
+	       REC_HDR_LEN + len) {
+		flags = ring.buf[RING_INDEX(ring.tail)];
+		count = ring.buf[RING_INDEX(ring.tail + 1)];
+		ring.tail += REC_LEN(flags, count);
+	}
+
+	ring_put(hdr, REC_HDR_LEN);
+	ring_put(payload, len);
+}
+
+static bool rate_limited(u16_t source)
+{
+	struct rate_limit *limit = &limits[source % ARRAY_SIZE(limits)];
+	u32_t window = k_uptime_get_32() / MSEC_PER_SEC;
+
+	if (limit->window != window) {
+		limit->window = window;
+		limit->count = 0;
+	}
+
+	if (limit->count >= CONFIG_FOTA_LOG_RING_RATE_LIMIT) {
+		return true;
+	}
+
+	limit->count++;
+
+	return false;
+}
+
+static void put(const struct log_backend *const backend, struct log_msg *msg)
+{
+	u8_t hdr[REC_HDR_LEN];
+	u32_t args[LOG_MAX_NARGS];
+	u8_t hexdump[REC_HEXDUMP_MAX];
+	const u8_t *payload;
+	u16_t source = log_msg_source_id_get(msg);
+	u32_t timestamp = log_msg_timestamp_get(msg);
+	u32_t fmt = (u32_t)(uintptr_t)log_msg_str_get(msg);
+	size_t len, count, i;
+	unsigned int key;
+	u8_t flags;
+
+	log_msg_get(msg);
+
+	if (rate_limited(source)) {
+		dropped++;
+		goto out;
+	}
+
+	flags = log_msg_level_get(msg) & REC_LEVEL_MASK;
+
+	if (log_msg_is_std(msg)) {
+		count = log_msg_nargs_get(msg);
+		for (i = 0; i < count; i++) {
+			args[i] = log_msg_arg_get(msg, i);
+		}
+
+		payload = (const u8_t *)args;
+		len = count * sizeof(args[0]);
+	} else {
+		count = sizeof(hexdump);
+		log_msg_hexdump_data_get(msg, hexdump, &count, 0);
+		flags |= REC_HEXDUMP;
+		payload = hexdump;
+		len = count;
+	}
+
+	hdr[0] = flags;
+	hdr[1] = count;
+	sys_put_le16(source, &hdr[2]);
+	sys_put_le32(timestamp, &hdr[4]);
+	sys_put_le32(fmt, &hdr[8]);
+
+	/* Arguments are stored in CPU order: all supported SoCs are LE */
+	key = irq_lock();
+	ring_write(hdr, payload, len);
+	irq_unlock(key);
+
+out:
+	log_msg_put(msg);
+}
+
+static void panic(struct log_backend const *const backend)
+{
+	/* Records are already in RAM: nothing to flush */
+}
+
+static void log_dropped(const struct log_backend *const backend, u32_t cnt)
+{
+	dropped += cnt;
+}
+
+static const struct log_backend_api log_ring_api = {
+	.put = put,
+	.panic = panic,
+	.dropped = log_dropped,
+};
+
+LOG_BACKEND_DEFINE(log_ring_backend, log_ring_api, true);
+
+static void *oldest_read_cb(u16_t obj_inst_id, u16_t res_id,
+			    u16_t res_inst_id, size_t *data_len)
+{
+	oldest = ring.tail;
+	*data_len = sizeof(oldest);
+
+	return &oldest;
+}
+
+static void *newest_read_cb(u16_t obj_inst_id, u16_t res_id,
+			    u16_t res_inst_id, size_t *data_len)
+{
+	newest = ring.head;
+	*data_len = sizeof(newest);
+
+	return &newest;
+}
+
+static void *chunk_read_cb(u16_t obj_inst_id, u16_t res_id,
+			   u16_t res_inst_id, size_t *data_len)
+{
+	unsigned int key;
+	u32_t pos;
+	size_t i, len;
+
+	key = irq_lock();
+
+	/* Readers which fell behind resume at the oldest record */
+	pos = offset;
+	if (pos - ring.tail > ring.head - ring.tail) {
+		pos = ring.tail;
+	}
+
+	len = MIN(ring.head - pos, sizeof(chunk));
+	for (i = 0; i < len; i++) {
+		chunk[i] = ring.buf[RING_INDEX(pos + i)];
+	}
+
+	irq_unlock(key);
+
+	/*
+	 * OFFSET is left alone, so a read lost on the way can simply be
+	 * repeated; readers move on by writing OFFSET themselves.
+	 */
+	*data_len = len;
+
+	return chunk;
+}
+
+static void *dropped_read_cb(u16_t obj_inst_id, u16_t res_id,
+			     u16_t res_inst_id, size_t *data_len)
+{
+	*data_len = sizeof(dropped);
+
+	return &dropped;
+}
+
+static int clear_cb(u16_t obj_inst_id)
+{
+	unsigned int key;
+
+	key = irq_lock();
+	ring.tail = ring.head;
+	irq_unlock(key);
+
+	return 0;
+}
+
+static struct lwm2m_engine_obj_inst *log_ring_create(u16_t obj_inst_id)
+{
+	int i = 0, j = 0;
+
+	if (inst.obj) {
+		LOG_ERR("Can not create instance - already existing: %u",
+			obj_inst_id);
+		return NULL;
+	}
+
+	init_res_instance(res_inst, ARRAY_SIZE(res_inst));
+
+	INIT_OBJ_RES_DATA(LOG_RING_OLDEST_ID, res, i, res_inst, j,
+			  &oldest, sizeof(oldest));
+	INIT_OBJ_RES_DATA(LOG_RING_NEWEST_ID, res, i, res_inst, j,
+			  &newest, sizeof(newest));
+	INIT_OBJ_RES_DATA(LOG_RING_OFFSET_ID, res, i, res_inst, j,
+			  &offset, sizeof(offset));
+	INIT_OBJ_RES_DATA(LOG_RING_CHUNK_ID, res, i, res_inst, j,
+			  chunk, sizeof(chunk));
+	INIT_OBJ_RES_DATA(LOG_RING_DROPPED_ID, res, i, res_inst, j,
+			  &dropped, sizeof(dropped));
+	INIT_OBJ_RES_DATA(LOG_RING_TIMESTAMP_FREQ_ID, res, i, res_inst, j,
+			  &timestamp_freq, sizeof(timestamp_freq));
+	INIT_OBJ_RES_EXECUTE(LOG_RING_CLEAR_ID, res, i, clear_cb);
+
+	inst.resources = res;
+	inst.resource_count = i;
+
+	return &inst;
+}
+
+static int log_ring_check(struct device *dev)
+{
+	/* Keep what the previous boot logged, if it is intact */
+	if (!ring_valid()) {
+		ring_reset();
+	}
+
+	return 0;
+}
+
+/* Before the logger starts processing, so no record hits a stale ring */
+SYS_INIT(log_ring_check, PRE_KERNEL_1, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+
+static int log_ring_obj_init(struct device *dev)
+{
+	log_ring_obj.obj_id = LOG_RING_OBJ_ID;
+	log_ring_obj.fields = fields;
+	log_ring_obj.field_count = ARRAY_SIZE(fields);
+	log_ring_obj.max_instance_count = 1;
+	log_ring_obj.create_cb = log_ring_create;
+	lwm2m_register_obj(&log_ring_obj);
+
+	return 0;
+}
+
+SYS_INIT(log_ring_obj_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+
+int log_ring_init(void)
+{
+	char path[sizeof("65535/65535/65535")];
+	int ret;
+
+	timestamp_freq = sys_clock_hw_cycles_per_sec();
+	offset = ring.tail;
+
+	snprintk(path, sizeof(path), "%u/0", LOG_RING_OBJ_ID);
+	ret = lwm2m_engine_create_obj_inst(path);
+	if (ret < 0) {
+		return ret;
+	}
+
+	snprintk(path, sizeof(path), "%u/0/%u", LOG_RING_OBJ_ID,
+		 LOG_RING_OLDEST_ID);
+	ret = lwm2m_engine_register_read_callback(path, oldest_read_cb);
+	if (ret < 0) {
+		return ret;
+	}
+
+	snprintk(path, sizeof(path), "%u/0/%u", LOG_RING_OBJ_ID,
+		 LOG_RING_NEWEST_ID);
+	ret = lwm2m_engine_register_read_callback(path, newest_read_cb);
+	if (ret < 0) {
+		return ret;
+	}
+
+	snprintk(path, sizeof(path), "%u/0/%u", LOG_RING_OBJ_ID,
+		 LOG_RING_CHUNK_ID);
+	ret = lwm2m_engine_register_read_callback(path, chunk_read_cb);
+	if (ret < 0) {
+		return ret;
+	}
+
+	snprintk(path, sizeof(path), "%u/0/%u", LOG_RING_OBJ_ID,
+		 LOG_RING_DROPPED_ID);
+
+	return lwm2m_engine_register_read_callback(path, dropped_read_cb);
+}
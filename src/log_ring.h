@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_LOG_RING_H__
+#define FOTA_LOG_RING_H__
+
+/**
+ * @file
+ * @brief Binary log ring buffer
+ *
+ * Log backend which stores messages unformatted (source, level,
+ * timestamp, format string address and raw arguments) in a RAM ring
+ * which survives warm resets, and a private LwM2M object through which
+ * the ring can be read back in chunks. scripts/log_ring_decode.py turns
+ * the records back into text using the application's ELF file.
+ */
+
+/* Private LwM2M object giving access to the log ring */
+#define LOG_RING_OBJ_ID	26242
+
+/**
+ * @brief Create the log ring object instance (LOG_RING_OBJ_ID/0).
+ *
+ * Must be called after the LwM2M engine has been initialized, and
+ * before the client registers so the object is announced.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+int log_ring_init(void);
+
+#endif	/* FOTA_LOG_RING_H__ */
@@ -13,14 +13,12 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #include <zephyr.h>
 #include <dfu/mcuboot.h>
-#include <dfu/flash_img.h>
 #include <flash.h>
 #include <logging/log_ctrl.h>
 #include <misc/reboot.h>
 #include <net/net_if.h>
 #include <net/net_mgmt.h>
 #include <net/lwm2m.h>
-#include <ctype.h>
 #include <stdio.h>
 #include <version.h>
 #include <tc_util.h>
@@ -35,6 +33,18 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include "bluetooth.h"
 #endif
 #include "settings.h"
+#include "fw_writer.h"
+#include "lwm2m_servers.h"
+#if defined(CONFIG_FOTA_MCAST_GROUP)
+#include "mcast_group.h"
+#endif
+#if defined(CONFIG_FOTA_DIAG)
+#include "diag.h"
+#include "mem_stats.h"
+#endif
+#if defined(CONFIG_FOTA_LOG_RING)
+#include "log_ring.h"
+#endif
 
 /* Network configuration checks */
 #if defined(CONFIG_NET_IPV6)
@@ -68,14 +78,27 @@ BUILD_ASSERT_MSG(sizeof(CONFIG_LWM2M_FIRMWARE_UPDATE_PULL_COAP_PROXY_ADDR) > 1,
 
 #define NUM_TEST_RESULTS	5
 
+/* Connectivity Monitoring network bearer (4/0/0), LwM2M 1.0 E.4 */
+#if defined(CONFIG_FOTA_NET_MODEM)
+#define NETWORK_BEARER		6	/* LTE-FDD */
+#elif defined(CONFIG_FOTA_NET_BLE6LOWPAN)
+#define NETWORK_BEARER		22	/* Bluetooth */
+#elif defined(CONFIG_FOTA_NET_OPENTHREAD) || defined(CONFIG_FOTA_NET_802154)
+#define NETWORK_BEARER		23	/* IEEE 802.15.4 */
+#elif defined(CONFIG_WIFI)
+#define NETWORK_BEARER		21	/* WLAN */
+#else
+#define NETWORK_BEARER		41	/* Ethernet */
+#endif
+
 #if defined(CONFIG_LWM2M_DTLS_SUPPORT)
 #define TLS_TAG			1
 
-#define DEFAULT_CLIENT_PSK	"000102030405060708090a0b0c0d0e0f"
-
-/* DTLS information read from credential partition */
-static char client_psk[LWM2M_DEVICE_TOKEN_SIZE];
-static u8_t client_psk_bin[LWM2M_DEVICE_TOKEN_HEX_SIZE];
+/* Used when no key is provisioned in the credentials partition */
+static const u8_t default_client_psk[] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
 #endif /* CONFIG_LWM2M_DTLS_SUPPORT */
 
 #define FLASH_BANK0_ID DT_FLASH_AREA_IMAGE_0_ID
@@ -97,21 +120,45 @@ static bool tc_logging;
 static char ep_name[LWM2M_DEVICE_ID_SIZE];
 
 static struct device *flash_dev;
-static struct flash_img_context dfu_ctx;
 static struct lwm2m_ctx client;
 
 /* LwM2M state */
 static int mem_total;
 
-/* storage location for firmware package */
-static u8_t firmware_buf[CONFIG_LWM2M_COAP_BLOCK_SIZE];
 /* storage location for firmware version */
 static char firmware_version[32];
 
 static struct k_delayed_work reboot_work;
 static struct net_mgmt_event_callback cb;
 static struct k_work net_event_work;
+static struct k_work reg_update_work;
 static struct k_work_q *net_event_work_q;
+static bool lwm2m_started;
+
+/* Server failover */
+#define FAILOVER_DELAY		K_SECONDS(5)
+#define DEREGISTER_TIMEOUT	K_SECONDS(10)
+
+/*
+ * Failover runs on app_wq without blocking it: each step is a work
+ * item, moved along by rd client events, timeouts and health checks.
+ */
+enum failover_state {
+	/* Registered, or registering */
+	FAILOVER_IDLE,
+	/* Waiting for a failover to start */
+	FAILOVER_PENDING,
+	/* Waiting for the rd client to deregister */
+	FAILOVER_STOPPING,
+	/* Waiting for the servers' health check */
+	FAILOVER_CHECKING,
+};
+
+static atomic_t failover_state;
+static struct k_delayed_work failover_work;
+static struct k_work register_work;
+static u32_t registration_start;
+static u32_t boot_registered_ms;
 
 static void *firmware_read_cb(u16_t obj_inst_id, u16_t res_id,
 			      u16_t res_inst_id, size_t *data_len)
@@ -124,6 +171,7 @@ static void *firmware_read_cb(u16_t obj_inst_id, u16_t res_id,
 static void reboot(struct k_work *work)
 {
 	LOG_INF("Rebooting device");
+	fota_settings_commit();
 #ifdef CONFIG_NET_L2_BT
 	bt_network_disable();
 #endif
@@ -131,6 +179,20 @@ static void reboot(struct k_work *work)
 	sys_reboot(0);
 }
 
+#if defined(CONFIG_FOTA_DIAG)
+static void *mem_free_read_cb(u16_t obj_inst_id, u16_t res_id,
+			      u16_t res_inst_id, size_t *data_len)
+{
+	static int mem_free;
+
+	/* Free RAM in the application heaps, in KB */
+	mem_free = (int)(mem_stats_heap_free() / 1024);
+	*data_len = sizeof(mem_free);
+
+	return &mem_free;
+}
+#endif
+
 static int device_reboot_cb(u16_t obj_inst_id)
 {
 	LOG_INF("DEVICE: Reboot in progress");
@@ -162,6 +224,13 @@ static int firmware_update_cb(u16_t obj_inst_id)
 		goto cleanup;
 	}
 
+	/* The new counter must be on flash before the upgrade is armed */
+	ret = fota_settings_commit();
+	if (ret) {
+		LOG_ERR("Failed to save the update counter: %d", ret);
+		goto cleanup;
+	}
+
 	boot_request_upgrade(false);
 
 	k_delayed_work_submit(&reboot_work, MSEC_PER_SEC);
@@ -172,11 +241,14 @@ cleanup:
 	return ret;
 }
 
+/*
+ * Have the engine copy each block from the received packet straight
+ * into the image writer's page buffer.
+ */
 static void *firmware_get_buf(u16_t obj_inst_id, u16_t res_id,
 			      u16_t res_inst_id, size_t *data_len)
 {
-	*data_len = sizeof(firmware_buf);
-	return firmware_buf;
+	return fw_writer_get_buf(data_len);
 }
 
 static int firmware_block_received_cb(u16_t obj_inst_id, u16_t res_id,
@@ -186,6 +258,7 @@ static int firmware_block_received_cb(u16_t obj_inst_id, u16_t res_id,
 {
 	static u8_t percent_downloaded;
 	static u32_t bytes_downloaded;
+	struct fw_writer_stats stats;
 	u8_t downloaded;
 	int ret = 0;
 
@@ -199,11 +272,19 @@ static int firmware_block_received_cb(u16_t obj_inst_id, u16_t res_id,
 		return -EINVAL;
 	}
 
-	/* Erase bank 1 before starting the write process */
+	/* Bank 1 is erased progressively, as it is written */
 	if (bytes_downloaded == 0) {
-		flash_img_init(&dfu_ctx);
+		ret = fw_writer_start(flash_dev);
+		if (ret < 0) {
+			LOG_ERR("Failed to start image write: %d", ret);
+			goto cleanup;
+		}
 	}
 
+#ifdef CONFIG_NET_L2_BT
+	bt_network_bulk_transfer(!last_block);
+#endif
+
 	bytes_downloaded += data_len;
 
 	/* display a % downloaded, if it's different */
@@ -219,7 +300,7 @@ static int firmware_block_received_cb(u16_t obj_inst_id, u16_t res_id,
 		LOG_INF("%d%%", percent_downloaded);
 	}
 
-	ret = flash_img_buffered_write(&dfu_ctx, data, data_len, last_block);
+	ret = fw_writer_write(data, data_len, last_block);
 	if (ret < 0) {
 		LOG_ERR("Failed to write flash block");
 		goto cleanup;
@@ -234,9 +315,21 @@ static int firmware_block_received_cb(u16_t obj_inst_id, u16_t res_id,
 		LOG_ERR("Early last block, downloaded %d, expecting %d",
 			bytes_downloaded, total_size);
 		ret = -EIO;
+	} else {
+		fw_writer_stats_get(&stats);
+		LOG_INF("Image written: %u bytes in %u blocks, erase %u us, "
+			"program %u us, slowest block %u us", bytes_downloaded,
+			stats.blocks, stats.erase_us, stats.program_us,
+			stats.block_max_us);
 	}
 
 cleanup:
+	if (ret < 0) {
+		fw_writer_abort();
+	}
+#ifdef CONFIG_NET_L2_BT
+	bt_network_bulk_transfer(false);
+#endif
 	bytes_downloaded = 0;
 	percent_downloaded = 0;
 
@@ -244,59 +337,59 @@ cleanup:
 }
 #endif
 
-#if defined(CONFIG_LWM2M_DTLS_SUPPORT)
-static int generate_hex(char *src, u8_t *dst, size_t dst_len)
+static int set_server_url(const char *host)
 {
-	int src_len, i, j = 0;
-	u8_t c = 0;
-
-	src_len = strlen(src);
-	for (i = 0; i < src_len; i++) {
-		if (isdigit(src[i])) {
-			c += src[i] - '0';
-		} else if (isalpha(src[i])) {
-			c += src[i] - (isupper(src[i]) ? 'A' - 10 : 'a' - 10);
-		} else {
-			return -EINVAL;
-		}
-		if (i % 2) {
-			if (j >= dst_len) {
-				return -E2BIG;
-			}
-			dst[j++] = c;
-			c = 0;
-		} else {
-			c = c << 4;
-		}
-	}
+	char *server_url;
+	u16_t server_url_len;
+	u8_t server_url_flags;
+	int ret;
 
-	if (j != LWM2M_DEVICE_TOKEN_HEX_SIZE) {
-		return -EINVAL;
+	ret = lwm2m_engine_get_res_data("0/0/0",
+					(void **)&server_url, &server_url_len,
+					&server_url_flags);
+	if (ret < 0) {
+		return ret;
 	}
 
+	snprintk(server_url, server_url_len, "coap%s//%s%s%s",
+		 IS_ENABLED(CONFIG_LWM2M_DTLS_SUPPORT) ? "s:" : ":",
+		 strchr(host, ':') ? "[" : "", host,
+		 strchr(host, ':') ? "]" : "");
+
 	return 0;
 }
-#endif /* CONFIG_LWM2M_DTLS_SUPPORT */
 
 static int lwm2m_setup(void)
 {
 	const struct product_id_t *product_id = product_id_get();
 	static char device_serial_no[10];
-	char *server_url;
-	u16_t server_url_len;
-	u8_t server_url_flags;
+	const struct lwm2m_credentials *creds;
+#if defined(CONFIG_LWM2M_DTLS_SUPPORT)
+	const u8_t *psk;
+	size_t psk_len;
+#endif
 	int ret;
 
 	snprintk(device_serial_no, sizeof(device_serial_no), "%08x",
 		 product_id->number);
-	/* Check if there is a valid device id stored in the device */
-	ret = lwm2m_get_device_id(flash_dev, ep_name);
+
+	/* Parse the credentials partition once; later reads hit the cache */
+	ret = lwm2m_credentials_load(flash_dev);
 	if (ret) {
-		LOG_ERR("Fail to read LWM2M Device ID");
+		LOG_ERR("Fail to read LWM2M credentials (%d)", ret);
+	}
+	creds = lwm2m_credentials_get();
+
+	/* Check if there is a valid device id stored in the device */
+	if (creds && creds->device_id[0]) {
+		strncpy(ep_name, creds->device_id, sizeof(ep_name));
+		ret = 0;
+	} else {
+		ret = -ENOENT;
 	}
 #if defined(CONFIG_MODEM_RECEIVER)
 	/* use IMEI */
-	if (ret || ep_name[LWM2M_DEVICE_ID_SIZE - 1] != '\0') {
+	if (ret) {
 		struct mdm_receiver_context *mdm_ctx;
 
 		mdm_ctx = mdm_receiver_context_from_id(0);
@@ -310,7 +403,7 @@ static int lwm2m_setup(void)
 		}
 	}
 #endif /* CONFIG_MODEM_RECEIVER */
-	if (ret || ep_name[LWM2M_DEVICE_ID_SIZE - 1] != '\0') {
+	if (ret) {
 		/* No UUID, use the serial number instead */
 		LOG_WRN("LWM2M Device ID not set, using serial number");
 		snprintk(ep_name, LWM2M_DEVICE_ID_SIZE, "%s:sn:%s",
@@ -320,43 +413,31 @@ static int lwm2m_setup(void)
 
 #if defined(CONFIG_LWM2M_DTLS_SUPPORT)
 	/* Check if there is a valid device token stored in the device */
-	ret = lwm2m_get_device_token(flash_dev, client_psk);
-	if (ret || client_psk[LWM2M_DEVICE_TOKEN_SIZE - 1] != '\0') {
+	if (creds && creds->psk_len) {
+		psk = creds->psk;
+		psk_len = creds->psk_len;
+	} else {
 		LOG_ERR("Fail to read LWM2M Device Token");
 
 		/* No token, use the default key instead */
-		strncpy(client_psk, DEFAULT_CLIENT_PSK,
-			LWM2M_DEVICE_TOKEN_SIZE);
-	}
-
-	ret = generate_hex(client_psk, client_psk_bin,
-			   LWM2M_DEVICE_TOKEN_HEX_SIZE);
-	if (ret) {
-		LOG_ERR("Failed to generate psk hex: %d", ret);
-		return ret;
+		psk = default_client_psk;
+		psk_len = sizeof(default_client_psk);
 	}
 #endif /* CONFIG_LWM2M_DTLS_SUPPORT */
 
-	/* Server URL */
-	ret = lwm2m_engine_get_res_data("0/0/0",
-					(void **)&server_url, &server_url_len,
-					&server_url_flags);
+	/* Server URL, until the best server has been picked */
+	lwm2m_servers_init(SERVER_ADDR, &client);
+	ret = set_server_url(SERVER_ADDR);
 	if (ret < 0) {
 		return ret;
 	}
 
-	snprintk(server_url, server_url_len, "coap%s//%s%s%s",
-		 IS_ENABLED(CONFIG_LWM2M_DTLS_SUPPORT) ? "s:" : ":",
-		 strchr(SERVER_ADDR, ':') ? "[" : "", SERVER_ADDR,
-		 strchr(SERVER_ADDR, ':') ? "]" : "");
-
 	/* Security Mode */
 	lwm2m_engine_set_u8("0/0/2",
 			    IS_ENABLED(CONFIG_LWM2M_DTLS_SUPPORT) ? 0 : 3);
 #if defined(CONFIG_LWM2M_DTLS_SUPPORT)
 	lwm2m_engine_set_string("0/0/3", (char *)ep_name);
-	lwm2m_engine_set_opaque("0/0/5",
-				(void *)client_psk_bin, sizeof(client_psk_bin));
+	lwm2m_engine_set_opaque("0/0/5", (void *)psk, psk_len);
 #endif /* CONFIG_LWM2M_DTLS_SUPPORT */
 
 	/* Device Object values and callbacks */
@@ -382,6 +463,24 @@ static int lwm2m_setup(void)
 				  LWM2M_RES_DATA_FLAG_RO);
 	mem_total = (int)(FLASH_BANK_SIZE / 1024);
 	lwm2m_engine_set_res_data("3/0/21", &mem_total, sizeof(mem_total), 0);
+#if defined(CONFIG_LWM2M_CONN_MON_OBJ_SUPPORT)
+	lwm2m_engine_set_u8("4/0/0", NETWORK_BEARER);
+#endif
+#if defined(CONFIG_FOTA_DIAG)
+	lwm2m_engine_register_read_callback("3/0/10", mem_free_read_cb);
+
+	ret = diag_init();
+	if (ret < 0) {
+		LOG_ERR("Fail to create diagnostics object (%d)", ret);
+	}
+#endif
+
+#if defined(CONFIG_FOTA_LOG_RING)
+	ret = log_ring_init();
+	if (ret < 0) {
+		LOG_ERR("Fail to create log ring object (%d)", ret);
+	}
+#endif
 
 #ifdef CONFIG_LWM2M_FIRMWARE_UPDATE_OBJ_SUPPORT
 	/* Firmware Object callbacks */
@@ -410,6 +509,14 @@ static void handle_test_result(struct update_lwm2m_data *data, u8_t result)
 	}
 }
 
+static void failover_schedule(void)
+{
+	/* A failover already under way will pick the best server anyway */
+	if (atomic_cas(&failover_state, FAILOVER_IDLE, FAILOVER_PENDING)) {
+		app_wq_submit_delayed(&failover_work, FAILOVER_DELAY);
+	}
+}
+
 static void rd_client_event(struct lwm2m_ctx *client,
 			    enum lwm2m_rd_client_event client_event)
 {
@@ -441,20 +548,40 @@ static void rd_client_event(struct lwm2m_ctx *client,
 			TC_END_REPORT(TC_FAIL);
 			tc_logging = false;
 		}
+		/*
+		 * The client gives up after a failed registration: retry,
+		 * with another server if this one keeps failing.
+		 */
+		lwm2m_servers_report(false);
+		failover_schedule();
 		break;
 
 	case LWM2M_RD_CLIENT_EVENT_REGISTRATION_COMPLETE:
 		if (tc_logging) {
 			Z_TC_END_RESULT(TC_PASS, "lwm2m_registration");
 		}
+		LOG_INF("Registered with %s in %u ms",
+			lwm2m_servers_host(lwm2m_servers_current()),
+			k_uptime_get_32() - registration_start);
+		if (!boot_registered_ms) {
+			boot_registered_ms = k_uptime_get_32();
+			LOG_INF("First registration %u ms after boot",
+				boot_registered_ms);
+		}
+		lwm2m_servers_report(true);
 		break;
 
 	case LWM2M_RD_CLIENT_EVENT_REG_UPDATE_FAILURE:
 		handle_test_result(&update_data, TC_FAIL);
+		/* The client falls back to a full registration by itself */
+		if (lwm2m_servers_report(false)) {
+			failover_schedule();
+		}
 		break;
 
 	case LWM2M_RD_CLIENT_EVENT_REG_UPDATE_COMPLETE:
 		handle_test_result(&update_data, TC_PASS);
+		lwm2m_servers_report(true);
 		break;
 
 	case LWM2M_RD_CLIENT_EVENT_DEREGISTER_FAILURE:
@@ -464,7 +591,10 @@ static void rd_client_event(struct lwm2m_ctx *client,
 
 	case LWM2M_RD_CLIENT_EVENT_DISCONNECT:
 		LOG_DBG("Disconnected");
-		/* TODO: handle disconnect? */
+		/* Deregistered: go on with the failover without waiting */
+		if (atomic_get(&failover_state) == FAILOVER_STOPPING) {
+			app_wq_submit_delayed(&failover_work, K_NO_WAIT);
+		}
 		break;
 
 	}
@@ -532,6 +662,13 @@ static int lwm2m_image_init(void)
 		if (counter.update != -1) {
 			ret = fota_update_counter_update(COUNTER_CURRENT,
 						counter.update);
+			if (!ret) {
+				/*
+				 * The image is already confirmed: losing this
+				 * update would report the upgrade as failed.
+				 */
+				ret = fota_settings_commit();
+			}
 			if (ret) {
 				LOG_ERR("Failed to update the update "
 					"counter: %d", ret);
@@ -601,6 +738,8 @@ static void lwm2m_start(struct k_work *work)
 {
 	int ret;
 
+	lwm2m_started = true;
+
 	TC_START("LwM2M tests");
 
 	TC_PRINT("Initializing LWM2M Image\n");
@@ -637,17 +776,88 @@ static void lwm2m_start(struct k_work *work)
 
 	/* small delay to finalize networking */
 	k_sleep(K_SECONDS(2));
+
+#if defined(CONFIG_FOTA_MCAST_GROUP)
+	ret = mcast_group_start(net_if_get_default());
+	if (ret < 0) {
+		/* Unicast control through the LwM2M server still works */
+		LOG_ERR("Cannot start multicast group control (%d)", ret);
+	}
+#endif
 	TC_PRINT("LwM2M registration\n");
 
+	/*
+	 * Ping the servers now that networking is up; registration starts
+	 * with the best one once they have answered.
+	 */
+	atomic_set(&failover_state, FAILOVER_CHECKING);
+	lwm2m_servers_check(&register_work);
+	LOG_INF("setup complete.");
+}
+
+/* Register with the best server, as of the last health check */
+static void lwm2m_register(struct k_work *work)
+{
+	set_server_url(lwm2m_servers_host(lwm2m_servers_select()));
+	LOG_INF("Registering with %s",
+		lwm2m_servers_host(lwm2m_servers_current()));
+
+	atomic_set(&failover_state, FAILOVER_IDLE);
+	registration_start = k_uptime_get_32();
 	/* client.sec_obj_inst is 0 as a starting point */
 	lwm2m_rd_client_start(&client, ep_name, rd_client_event);
-	LOG_INF("setup complete.");
+}
+
+/*
+ * Restart registration with the best server, which is another one if
+ * the current server has failed too often: stop the rd client, give it
+ * DEREGISTER_TIMEOUT to deregister if the old server still answers,
+ * then health check the servers and register again.
+ */
+static void lwm2m_failover(struct k_work *work)
+{
+	switch (atomic_get(&failover_state)) {
+	case FAILOVER_PENDING:
+		atomic_set(&failover_state, FAILOVER_STOPPING);
+		app_wq_submit_delayed(&failover_work, DEREGISTER_TIMEOUT);
+		lwm2m_rd_client_stop(&client, rd_client_event);
+		break;
+
+	case FAILOVER_STOPPING:
+		/* Deregistered, or timed out */
+		atomic_set(&failover_state, FAILOVER_CHECKING);
+		lwm2m_servers_check(&register_work);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void lwm2m_reg_update(struct k_work *work)
+{
+	/* A failover in progress registers again anyway */
+	if (atomic_get(&failover_state) != FAILOVER_IDLE) {
+		return;
+	}
+
+	LOG_INF("Network is back, updating LwM2M registration");
+	lwm2m_rd_client_update();
 }
 
 static void event_iface_up(struct net_mgmt_event_callback *cb,
 		u32_t mgmt_event, struct net_if *iface)
 {
-	k_work_submit_to_queue(net_event_work_q, &net_event_work);
+	/*
+	 * The first time the interface comes up, LwM2M is started. If it
+	 * comes back after a link loss (e.g. a BLE reconnect), the session
+	 * is still there and only needs a Registration Update.
+	 */
+	if (!lwm2m_started) {
+		k_work_submit_to_queue(net_event_work_q, &net_event_work);
+	} else {
+		k_work_submit_to_queue(net_event_work_q, &reg_update_work);
+	}
 }
 
 int lwm2m_init(struct k_work_q *work_q)
@@ -655,6 +865,9 @@ int lwm2m_init(struct k_work_q *work_q)
 	struct net_if *iface;
 
 	k_work_init(&net_event_work, lwm2m_start);
+	k_work_init(&reg_update_work, lwm2m_reg_update);
+	k_delayed_work_init(&failover_work, lwm2m_failover);
+	k_work_init(&register_work, lwm2m_register);
 	net_event_work_q = work_q;
 
 	iface = net_if_get_default();
@@ -665,14 +878,20 @@ int lwm2m_init(struct k_work_q *work_q)
 		return -ENETDOWN;
 	}
 
-	/* Subscribe to NET_EVENT_IF_UP if interface is not ready */
-	if (!net_if_is_up(iface)) {
-		net_mgmt_init_event_callback(&cb, event_iface_up,
-				NET_EVENT_IF_UP);
-		net_mgmt_add_event_callback(&cb);
-	} else {
+	/*
+	 * Subscribe to NET_EVENT_IF_UP even if the interface is ready, to
+	 * learn about the link coming back later on.
+	 */
+	net_mgmt_init_event_callback(&cb, event_iface_up, NET_EVENT_IF_UP);
+	net_mgmt_add_event_callback(&cb);
+	if (net_if_is_up(iface)) {
 		event_iface_up(NULL, NET_EVENT_IF_UP, iface);
 	}
 
 	return 0;
 }
+
+u32_t lwm2m_boot_registered_ms(void)
+{
+	return boot_registered_ms;
+}
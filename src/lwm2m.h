@@ -7,6 +7,16 @@
 #ifndef FOTA_LWM2M_H__
 #define FOTA_LWM2M_H__
 
+#include <zephyr/types.h>
+
 int lwm2m_init(struct k_work_q *work_q);
 
+/**
+ * @brief Get the time from boot to the first registration.
+ *
+ * @return Uptime in milliseconds when the first registration since boot
+ *         completed, or 0 if there was none yet.
+ */
+u32_t lwm2m_boot_registered_ms(void);
+
 #endif	/* FOTA_LWM2M_H__ */
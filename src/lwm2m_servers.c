@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_servers
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <string.h>
+#include <net/socket.h>
+#include <net/net_ip.h>
+#include <net/coap.h>
+#include <net/lwm2m.h>
+#include <random/rand32.h>
+
+#include "lwm2m_servers.h"
+#include "coap_rto.h"
+#include "app_work_queue.h"
+
+#define HOST_LEN		64
+#define SERVER_LIST_LEN		sizeof(CONFIG_FOTA_LWM2M_ALT_SERVERS)
+
+/* CoAP empty Confirmable message ("ping"), answered with a Reset */
+#define COAP_PING_LEN		4
+#define COAP_VER_CON_TKL0	0x40
+#define COAP_TYPE(b)		(((b) >> 4) & 0x3)
+#define COAP_TYPE_RST		3
+/* Same limit as the stack's own Confirmable retransmissions */
+#define COAP_MAX_TRANSMISSIONS	4
+
+/* Confirmable requests of the client and firmware pull contexts */
+#define MAX_EXCHANGES		(2 * CONFIG_LWM2M_ENGINE_MAX_PENDING)
+
+/* Pings can take CONFIG_FOTA_LWM2M_PING_TIMEOUT_MS: keep them off app_wq */
+#define HEALTH_STACK_SIZE	1536
+#define HEALTH_PRIORITY		K_PRIO_PREEMPT(8)
+
+struct lwm2m_server {
+	char host[HOST_LEN];
+	/*
+	 * Retransmission timeout and smoothed RTT, from the engine's
+	 * exchanges with the server and from CoAP pings
+	 */
+	struct coap_rto rto;
+	/* Whether the last health check was answered */
+	bool reachable;
+	/* Consecutive failed registrations or updates */
+	u8_t failures;
+};
+
+/* A Confirmable request of the LwM2M engine to the current server */
+struct exchange {
+	const struct coap_pending *pending;
+	struct lwm2m_server *server;
+	/* Uptime of the first transmission, in milliseconds */
+	u32_t start;
+	int transmissions;
+};
+
+static struct lwm2m_server servers[CONFIG_FOTA_LWM2M_MAX_SERVERS];
+static int server_count;
+static int current;
+static u16_t ping_mid;
+static const struct lwm2m_ctx *engine_ctx;
+static struct exchange exchanges[MAX_EXCHANGES];
+/* Protects the RTO estimates, health check results and current */
+static K_MUTEX_DEFINE(servers_lock);
+
+static K_THREAD_STACK_DEFINE(health_stack, HEALTH_STACK_SIZE);
+static struct k_thread health_thread;
+static K_SEM_DEFINE(check_sem, 0, 1);
+/* Submitted to app_wq when the requested health check is done */
+static struct k_work *check_done;
+
+static int resolve(const char *host, struct sockaddr *addr,
+		   socklen_t *addrlen)
+{
+	static struct zsock_addrinfo hints = {
+		.ai_socktype = SOCK_DGRAM,
+	};
+	struct zsock_addrinfo *res;
+	char port[sizeof("65535")];
+	int ret;
+
+	/* Literal addresses don't need the resolver */
+	if (net_ipaddr_parse(host, strlen(host), addr)) {
+		if (addr->sa_family == AF_INET6) {
+			net_sin6(addr)->sin6_port =
+				htons(CONFIG_FOTA_LWM2M_PING_PORT);
+			*addrlen = sizeof(struct sockaddr_in6);
+		} else {
+			net_sin(addr)->sin_port =
+				htons(CONFIG_FOTA_LWM2M_PING_PORT);
+			*addrlen = sizeof(struct sockaddr_in);
+		}
+
+		return 0;
+	}
+
+	snprintk(port, sizeof(port), "%u", CONFIG_FOTA_LWM2M_PING_PORT);
+	ret = zsock_getaddrinfo(host, port, &hints, &res);
+	if (ret) {
+		return -EHOSTUNREACH;
+	}
+
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*addrlen = res->ai_addrlen;
+	zsock_freeaddrinfo(res);
+
+	return 0;
+}
+
+static int coap_ping(struct lwm2m_server *server)
+{
+	struct zsock_pollfd fds;
+	struct sockaddr addr;
+	socklen_t addrlen;
+	u8_t msg[COAP_PING_LEN];
+	u32_t start, elapsed, rtt, timeout, deadline;
+	int transmissions = 0;
+	u16_t mid;
+	int sock, ret;
+
+	ret = resolve(server->host, &addr, &addrlen);
+	if (ret) {
+		return ret;
+	}
+
+	sock = zsock_socket(addr.sa_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		return -errno;
+	}
+
+	fds.fd = sock;
+	fds.events = ZSOCK_POLLIN;
+
+	mid = ping_mid++;
+	start = k_uptime_get_32();
+	k_mutex_lock(&servers_lock, K_FOREVER);
+	timeout = coap_rto_get(&server->rto);
+	k_mutex_unlock(&servers_lock);
+	deadline = 0;
+
+	/* Retransmit like any other Confirmable message, until the cap */
+	while (true) {
+		elapsed = k_uptime_get_32() - start;
+		if (elapsed >= deadline) {
+			if (transmissions == COAP_MAX_TRANSMISSIONS ||
+			    elapsed >= CONFIG_FOTA_LWM2M_PING_TIMEOUT_MS) {
+				ret = -ETIMEDOUT;
+				goto out;
+			}
+
+			msg[0] = COAP_VER_CON_TKL0;
+			msg[1] = 0;
+			msg[2] = mid >> 8;
+			msg[3] = mid & 0xff;
+
+			ret = zsock_sendto(sock, msg, sizeof(msg), 0, &addr,
+					   addrlen);
+			if (ret < 0) {
+				ret = -errno;
+				goto out;
+			}
+
+			if (transmissions++) {
+				timeout = coap_rto_backoff(timeout);
+			}
+
+			deadline = MIN(elapsed + timeout,
+				       CONFIG_FOTA_LWM2M_PING_TIMEOUT_MS);
+		}
+
+		ret = zsock_poll(&fds, 1, deadline - elapsed);
+		if (ret < 0) {
+			ret = -errno;
+			goto out;
+		}
+
+		if (!ret) {
+			continue;
+		}
+
+		/* Wait for the Reset with the same message ID */
+		ret = zsock_recv(sock, msg, sizeof(msg), 0);
+		if (ret >= COAP_PING_LEN && COAP_TYPE(msg[0]) == COAP_TYPE_RST &&
+		    ((msg[2] << 8) | msg[3]) == mid) {
+			break;
+		}
+	}
+
+	/* Measured from the first transmission, as CoCoA does */
+	rtt = k_uptime_get_32() - start;
+	k_mutex_lock(&servers_lock, K_FOREVER);
+	coap_rto_sample(&server->rto, rtt, transmissions);
+	k_mutex_unlock(&servers_lock);
+	LOG_DBG("Server %s RTT %u ms (%d transmissions), smoothed %u ms, "
+		"RTO %u ms", server->host, rtt, transmissions,
+		coap_rto_srtt(&server->rto), server->rto.rto);
+	ret = 0;
+
+out:
+	zsock_close(sock);
+
+	return ret;
+}
+
+static void health_check(struct lwm2m_server *server)
+{
+	int ret;
+
+	ret = coap_ping(server);
+	k_mutex_lock(&servers_lock, K_FOREVER);
+	server->reachable = !ret;
+	k_mutex_unlock(&servers_lock);
+	if (ret) {
+		LOG_WRN("Server %s did not answer ping (%d)", server->host,
+			ret);
+	}
+}
+
+/*
+ * Keep the RTT of every server fresh, so failover picks well. Checks
+ * run every
+ * CONFIG_FOTA_LWM2M_HEALTH_CHECK_INTERVAL seconds, and whenever
+ * lwm2m_servers_check() asks for one.
+ */
+static void health_check_loop(void *p1, void *p2, void *p3)
+{
+	s32_t interval = CONFIG_FOTA_LWM2M_HEALTH_CHECK_INTERVAL > 0 ?
+		K_SECONDS(CONFIG_FOTA_LWM2M_HEALTH_CHECK_INTERVAL) : K_FOREVER;
+	struct k_work *done;
+	int i;
+
+	while (true) {
+		k_sem_take(&check_sem, interval);
+
+		/* Requests made from now on get a check of their own */
+		k_mutex_lock(&servers_lock, K_FOREVER);
+		done = check_done;
+		check_done = NULL;
+		k_mutex_unlock(&servers_lock);
+
+		for (i = 0; i < server_count; i++) {
+			health_check(&servers[i]);
+		}
+
+		if (done) {
+			app_wq_submit(done);
+		}
+	}
+}
+
+static void add_server(const char *host)
+{
+	struct lwm2m_server *server;
+
+	if (server_count >= ARRAY_SIZE(servers)) {
+		LOG_WRN("Too many LwM2M servers, ignoring %s", host);
+		return;
+	}
+
+	if (strlen(host) >= HOST_LEN) {
+		LOG_ERR("LwM2M server name too long: %s", host);
+		return;
+	}
+
+	server = &servers[server_count++];
+	strcpy(server->host, host);
+	coap_rto_init(&server->rto, CONFIG_COAP_INIT_ACK_TIMEOUT_MS);
+	server->reachable = true;
+	server->failures = 0;
+}
+
+int lwm2m_servers_init(const char *primary, const struct lwm2m_ctx *ctx)
+{
+	char list[SERVER_LIST_LEN];
+	char *host, *saveptr;
+
+	server_count = 0;
+	current = 0;
+	engine_ctx = ctx;
+	add_server(primary);
+
+	strncpy(list, CONFIG_FOTA_LWM2M_ALT_SERVERS, sizeof(list));
+	for (host = strtok_r(list, " ,", &saveptr); host;
+	     host = strtok_r(NULL, " ,", &saveptr)) {
+		add_server(host);
+	}
+
+	ping_mid = sys_rand32_get();
+
+	/* With a single server there is nothing to choose between */
+	if (server_count <= 1) {
+		return server_count;
+	}
+
+	k_thread_create(&health_thread, health_stack,
+			K_THREAD_STACK_SIZEOF(health_stack),
+			health_check_loop, NULL, NULL, NULL,
+			HEALTH_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&health_thread, "lwm2m_health");
+
+	return server_count;
+}
+
+static bool better(const struct lwm2m_server *a,
+		   const struct lwm2m_server *b)
+{
+	/* Reachable first, then fewer failures, then lower RTT */
+	if (a->reachable != b->reachable) {
+		return a->reachable;
+	}
+
+	if (a->failures != b->failures) {
+		return a->failures < b->failures;
+	}
+
+	return coap_rto_srtt(&a->rto) < coap_rto_srtt(&b->rto);
+}
+
+void lwm2m_servers_check(struct k_work *done)
+{
+	/* With a single server there is no choice to make */
+	if (server_count <= 1) {
+		app_wq_submit(done);
+		return;
+	}
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+	check_done = done;
+	k_mutex_unlock(&servers_lock);
+
+	k_sem_give(&check_sem);
+}
+
+int lwm2m_servers_select(void)
+{
+	int i, best;
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+
+	best = current;
+	for (i = 0; i < server_count; i++) {
+		if (better(&servers[i], &servers[best])) {
+			best = i;
+		}
+	}
+
+	if (best != current) {
+		LOG_INF("Switching LwM2M server from %s to %s",
+			servers[current].host, servers[best].host);
+		current = best;
+	}
+
+	k_mutex_unlock(&servers_lock);
+
+	return best;
+}
+
+const char *lwm2m_servers_host(int index)
+{
+	if (index < 0 || index >= server_count) {
+		return NULL;
+	}
+
+	return servers[index].host;
+}
+
+u32_t lwm2m_servers_rtt(int index)
+{
+	u32_t rtt;
+
+	if (index < 0 || index >= server_count) {
+		return LWM2M_SERVER_RTT_UNKNOWN;
+	}
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+	rtt = coap_rto_srtt(&servers[index].rto);
+	k_mutex_unlock(&servers_lock);
+
+	return rtt;
+}
+
+u32_t lwm2m_servers_rto(int index)
+{
+	u32_t rto;
+
+	if (index < 0 || index >= server_count) {
+		return CONFIG_COAP_INIT_ACK_TIMEOUT_MS;
+	}
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+	rto = coap_rto_get(&servers[index].rto);
+	k_mutex_unlock(&servers_lock);
+
+	return rto;
+}
+
+int lwm2m_servers_current(void)
+{
+	return current;
+}
+
+int lwm2m_servers_count(void)
+{
+	return server_count;
+}
+
+bool lwm2m_servers_report(bool success)
+{
+	struct lwm2m_server *server;
+	bool failover;
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+
+	server = &servers[current];
+	if (success) {
+		server->failures = 0;
+	} else if (server->failures < UINT8_MAX) {
+		server->failures++;
+	}
+	failover = server->failures >= CONFIG_FOTA_LWM2M_FAILOVER_THRESHOLD;
+
+	k_mutex_unlock(&servers_lock);
+
+	if (!success) {
+		LOG_WRN("LwM2M server %s failed (%u in a row)", server->host,
+			server->failures);
+	}
+
+	return failover;
+}
+
+/*
+ * The LwM2M engine's Confirmable requests go through the CoAP library's
+ * pending API, wrapped at link time (see app.cmake). Requests to the
+ * address the client context is connected to are paced with the
+ * current server's RTO estimate instead of the static
+ * CONFIG_COAP_INIT_ACK_TIMEOUT_MS, and their round trip times feed it.
+ * Anything else, like a firmware download from another host, keeps the
+ * CoAP library's own timeouts. These run on the engine's thread.
+ */
+int __real_coap_pending_init(struct coap_pending *pending,
+			     const struct coap_packet *request,
+			     const struct sockaddr *addr);
+bool __real_coap_pending_cycle(struct coap_pending *pending);
+struct coap_pending *__real_coap_pending_received(
+	const struct coap_packet *response,
+	struct coap_pending *pendings, size_t len);
+
+static bool same_peer(const struct sockaddr *a, const struct sockaddr *b)
+{
+	if (a->sa_family != b->sa_family) {
+		return false;
+	}
+
+	if (a->sa_family == AF_INET6) {
+		return net_sin6(a)->sin6_port == net_sin6(b)->sin6_port &&
+		       net_ipv6_addr_cmp(&net_sin6(a)->sin6_addr,
+					 &net_sin6(b)->sin6_addr);
+	}
+
+	return net_sin(a)->sin_port == net_sin(b)->sin_port &&
+	       net_ipv4_addr_cmp(&net_sin(a)->sin_addr, &net_sin(b)->sin_addr);
+}
+
+/* Call with servers_lock held */
+static struct exchange *exchange_find(const struct coap_pending *pending)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(exchanges); i++) {
+		if (exchanges[i].pending == pending) {
+			return &exchanges[i];
+		}
+	}
+
+	return NULL;
+}
+
+int __wrap_coap_pending_init(struct coap_pending *pending,
+			     const struct coap_packet *request,
+			     const struct sockaddr *addr)
+{
+	struct exchange *ex;
+	int ret;
+
+	ret = __real_coap_pending_init(pending, request, addr);
+	if (ret) {
+		return ret;
+	}
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+
+	/* The engine reuses its pending entries */
+	ex = exchange_find(pending);
+	if (ex) {
+		ex->pending = NULL;
+	}
+
+	if (engine_ctx && server_count &&
+	    same_peer(addr, &engine_ctx->remote_addr)) {
+		ex = ex ? ex : exchange_find(NULL);
+		if (ex) {
+			ex->pending = pending;
+			ex->server = &servers[current];
+			ex->transmissions = 0;
+		}
+	}
+
+	k_mutex_unlock(&servers_lock);
+
+	return 0;
+}
+
+bool __wrap_coap_pending_cycle(struct coap_pending *pending)
+{
+	struct exchange *ex;
+	bool more = true;
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+
+	ex = exchange_find(pending);
+	if (!ex) {
+		k_mutex_unlock(&servers_lock);
+		return __real_coap_pending_cycle(pending);
+	}
+
+	if (!ex->transmissions) {
+		ex->start = k_uptime_get_32();
+		pending->timeout = coap_rto_get(&ex->server->rto);
+	} else if (ex->transmissions < COAP_MAX_TRANSMISSIONS) {
+		pending->timeout = coap_rto_backoff(pending->timeout);
+	} else {
+		/* Given up: the engine times the request out */
+		ex->pending = NULL;
+		more = false;
+	}
+
+	if (more) {
+		ex->transmissions++;
+	}
+
+	k_mutex_unlock(&servers_lock);
+
+	return more;
+}
+
+struct coap_pending *__wrap_coap_pending_received(
+	const struct coap_packet *response,
+	struct coap_pending *pendings, size_t len)
+{
+	struct coap_pending *pending;
+	struct exchange *ex;
+	u32_t rtt;
+
+	pending = __real_coap_pending_received(response, pendings, len);
+	if (!pending) {
+		return NULL;
+	}
+
+	k_mutex_lock(&servers_lock, K_FOREVER);
+
+	ex = exchange_find(pending);
+	if (ex && ex->transmissions) {
+		/* Measured from the first transmission, as CoCoA does */
+		rtt = k_uptime_get_32() - ex->start;
+		coap_rto_sample(&ex->server->rto, rtt, ex->transmissions);
+		LOG_DBG("Server %s RTT %u ms (%d transmissions), RTO %u ms",
+			ex->server->host, rtt, ex->transmissions,
+			ex->server->rto.rto);
+	}
+
+	if (ex) {
+		ex->pending = NULL;
+	}
+
+	k_mutex_unlock(&servers_lock);
+
+	return pending;
+}
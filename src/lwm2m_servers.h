@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_LWM2M_SERVERS_H__
+#define FOTA_LWM2M_SERVERS_H__
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+#include "coap_rto.h"
+
+struct lwm2m_ctx;
+
+/**
+ * @file
+ * @brief LwM2M server selection and failover
+ *
+ * Keeps a list of LwM2M servers (the configured peer, then
+ * CONFIG_FOTA_LWM2M_ALT_SERVERS), estimates the round trip time and
+ * retransmission timeout of each and picks the one to register with.
+ * Servers which fail to register or update are demoted until they next
+ * register or update successfully.
+ *
+ * The LwM2M engine's Confirmable requests to the current server are
+ * timed to feed its estimate, and retransmitted on its RTO rather than
+ * the static CONFIG_COAP_INIT_ACK_TIMEOUT_MS. With more than one server
+ * configured, the others are estimated from CoAP pings, sent from a
+ * thread of their own, never from the caller's.
+ */
+
+/** Smoothed RTT reported for servers which have never answered */
+#define LWM2M_SERVER_RTT_UNKNOWN	COAP_RTO_SRTT_UNKNOWN
+
+/**
+ * @brief Set up the server list.
+ *
+ * @param primary Host name or address of the preferred server.
+ * @param ctx Client context whose requests to the current server are
+ *        timed and paced.
+ * @return Number of servers in the list.
+ */
+int lwm2m_servers_init(const char *primary, const struct lwm2m_ctx *ctx);
+
+/**
+ * @brief Health check every server in the background.
+ *
+ * Returns at once; @a done is submitted to the application work queue
+ * once every server has been pinged, which can take up to
+ * CONFIG_FOTA_LWM2M_PING_TIMEOUT_MS per server. With a single server,
+ * there is nothing to choose from and @a done is submitted right away.
+ *
+ * @param done Work to submit when the check is complete.
+ */
+void lwm2m_servers_check(struct k_work *done);
+
+/**
+ * @brief Choose the server to register with.
+ *
+ * Picks the healthy server with the fewest failures and the lowest
+ * smoothed RTT, as of the last health check, preferring the current
+ * one on ties. Does not block.
+ *
+ * @return Index of the chosen server.
+ */
+int lwm2m_servers_select(void);
+
+/**
+ * @brief Get the host name or address of a server.
+ */
+const char *lwm2m_servers_host(int index);
+
+/**
+ * @brief Get the smoothed CoAP RTT of a server, in milliseconds.
+ *
+ * @return RTT, or LWM2M_SERVER_RTT_UNKNOWN.
+ */
+u32_t lwm2m_servers_rtt(int index);
+
+/**
+ * @brief Get the estimated CoAP retransmission timeout of a server.
+ *
+ * @return RTO in milliseconds; CONFIG_COAP_INIT_ACK_TIMEOUT_MS until
+ *         the server has answered.
+ */
+u32_t lwm2m_servers_rto(int index);
+
+/**
+ * @brief Get the index of the server currently in use.
+ */
+int lwm2m_servers_current(void);
+
+/**
+ * @brief Get the number of configured servers.
+ */
+int lwm2m_servers_count(void);
+
+/**
+ * @brief Record the outcome of a registration or update.
+ *
+ * @param success True if the current server answered.
+ * @return True if the current server has now failed
+ *         CONFIG_FOTA_LWM2M_FAILOVER_THRESHOLD times in a row and
+ *         another one should be selected.
+ */
+bool lwm2m_servers_report(bool success);
+
+#endif	/* FOTA_LWM2M_SERVERS_H__ */
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_mcast
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/net_if.h>
+#include <net/net_ip.h>
+#if defined(CONFIG_NET_IPV6_MLD)
+#include <net/mld.h>
+#endif
+#include <net/socket.h>
+#include <net/coap.h>
+#include <net/lwm2m.h>
+
+#include "app_work_queue.h"
+#include "mcast_group.h"
+
+#define MCAST_STACK_SIZE	1536
+#define MCAST_PRIORITY		K_PRIO_PREEMPT(8)
+#define MCAST_MAX_MSG_SIZE	128
+#define MCAST_MAX_OPTIONS	8
+#define MCAST_ADDR_STR_LEN	sizeof(CONFIG_FOTA_MCAST_GROUP_ADDRS)
+#define MCAST_WRITE_QUEUE_LEN	4
+
+#define LIGHT_OBJ_ID		3311
+#define LIGHT_ON_OFF_RES_ID	5850
+#define LIGHT_DIMMER_RES_ID	5851
+
+/* RFC 7967 No-Response option and its "not interested in 2.xx" bit */
+#define COAP_OPTION_NO_RESPONSE	258
+#define NO_RESPONSE_2XX		BIT(1)
+
+/* CoAP content formats accepted for group writes */
+#define COAP_FORMAT_TEXT_PLAIN		0
+#define COAP_FORMAT_OMA_PLAIN_TEXT	1541
+
+static K_THREAD_STACK_DEFINE(mcast_stack, MCAST_STACK_SIZE);
+static struct k_thread mcast_thread;
+static int mcast_sock = -1;
+
+static u8_t mcast_buf[MCAST_MAX_MSG_SIZE];
+
+/* Group writes, applied on the application work queue */
+struct group_write {
+	u16_t inst;
+	u16_t res;
+	u8_t value;
+};
+
+K_MSGQ_DEFINE(write_msgq, sizeof(struct group_write),
+	      MCAST_WRITE_QUEUE_LEN, 4);
+static struct k_work write_work;
+
+static int join_group(struct net_if *iface, const char *group)
+{
+	struct in6_addr addr;
+	int ret;
+
+	ret = net_addr_pton(AF_INET6, group, &addr);
+	if (ret < 0 || !net_ipv6_is_addr_mcast(&addr)) {
+		LOG_ERR("Invalid multicast group %s", group);
+		return -EINVAL;
+	}
+
+#if defined(CONFIG_NET_IPV6_MLD)
+	ret = net_ipv6_mld_join(iface, &addr);
+	if (ret < 0 && ret != -EALREADY) {
+		LOG_ERR("Cannot join group %s (%d)", group, ret);
+		return ret;
+	}
+#else
+	struct net_if_mcast_addr *maddr;
+
+	maddr = net_if_ipv6_maddr_lookup(&addr, &iface);
+	if (!maddr) {
+		maddr = net_if_ipv6_maddr_add(iface, &addr);
+	}
+
+	if (!maddr) {
+		LOG_ERR("Cannot add group %s", group);
+		return -ENOMEM;
+	}
+
+	net_if_ipv6_maddr_join(maddr);
+#endif
+
+	LOG_INF("Joined multicast group %s", group);
+
+	return 0;
+}
+
+static int join_groups(struct net_if *iface)
+{
+	char groups[MCAST_ADDR_STR_LEN];
+	char *group, *saveptr;
+	int count = 0;
+
+	strncpy(groups, CONFIG_FOTA_MCAST_GROUP_ADDRS, sizeof(groups));
+
+	for (group = strtok_r(groups, " ,", &saveptr); group;
+	     group = strtok_r(NULL, " ,", &saveptr)) {
+		if (!join_group(iface, group)) {
+			count++;
+		}
+	}
+
+	return count ? 0 : -ENOENT;
+}
+
+static int parse_path(struct coap_packet *cpkt, u16_t path[3])
+{
+	/* One spare slot to reject paths longer than obj/inst/res */
+	struct coap_option options[4];
+	char segment[6];
+	unsigned long val;
+	int count, i;
+	char *end;
+
+	count = coap_find_options(cpkt, COAP_OPTION_URI_PATH,
+				  options, ARRAY_SIZE(options));
+	if (count != 3) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (options[i].len == 0 ||
+		    options[i].len >= sizeof(segment)) {
+			return -EINVAL;
+		}
+
+		memcpy(segment, options[i].value, options[i].len);
+		segment[options[i].len] = '\0';
+
+		/* strtoul() would take a sign or leading spaces too */
+		if (segment[0] < '0' || segment[0] > '9') {
+			return -EINVAL;
+		}
+
+		val = strtoul(segment, &end, 10);
+		if (*end != '\0' || val > UINT16_MAX) {
+			return -EINVAL;
+		}
+
+		path[i] = val;
+	}
+
+	return 0;
+}
+
+static void apply_writes(struct k_work *work)
+{
+	char path_str[sizeof("65535/65535/65535")];
+	struct group_write write;
+	int ret;
+
+	while (!k_msgq_get(&write_msgq, &write, K_NO_WAIT)) {
+		snprintk(path_str, sizeof(path_str), "%u/%u/%u",
+			 LIGHT_OBJ_ID, write.inst, write.res);
+
+		if (write.res == LIGHT_ON_OFF_RES_ID) {
+			ret = lwm2m_engine_set_bool(path_str, write.value);
+		} else {
+			ret = lwm2m_engine_set_u8(path_str, write.value);
+		}
+
+		if (ret < 0) {
+			LOG_DBG("Group write to %s failed: %d", path_str, ret);
+		} else {
+			LOG_DBG("Group write %s = %u", path_str, write.value);
+		}
+	}
+}
+
+static u8_t handle_write(struct coap_packet *cpkt)
+{
+	struct coap_option option;
+	struct group_write write;
+	const u8_t *payload;
+	char value[8];
+	u16_t payload_len;
+	u16_t path[3];
+	long val;
+	char *end;
+	int ret;
+
+	if (parse_path(cpkt, path) < 0 || path[0] != LIGHT_OBJ_ID) {
+		return COAP_RESPONSE_CODE_NOT_FOUND;
+	}
+
+	if (path[2] != LIGHT_ON_OFF_RES_ID && path[2] != LIGHT_DIMMER_RES_ID) {
+		return COAP_RESPONSE_CODE_NOT_ALLOWED;
+	}
+
+	if (coap_find_options(cpkt, COAP_OPTION_CONTENT_FORMAT,
+			      &option, 1) == 1) {
+		ret = coap_option_value_to_int(&option);
+		if (ret != COAP_FORMAT_TEXT_PLAIN &&
+		    ret != COAP_FORMAT_OMA_PLAIN_TEXT) {
+			return COAP_RESPONSE_CODE_UNSUPPORTED_CONTENT_FORMAT;
+		}
+	}
+
+	payload = coap_packet_get_payload(cpkt, &payload_len);
+	if (!payload || payload_len == 0 || payload_len >= sizeof(value)) {
+		return COAP_RESPONSE_CODE_BAD_REQUEST;
+	}
+
+	memcpy(value, payload, payload_len);
+	value[payload_len] = '\0';
+
+	if (path[2] == LIGHT_ON_OFF_RES_ID) {
+		if (!strcmp(value, "true")) {
+			val = 1;
+		} else if (!strcmp(value, "false")) {
+			val = 0;
+		} else {
+			val = strtol(value, &end, 10);
+			if (*end != '\0' || (val != 0 && val != 1)) {
+				return COAP_RESPONSE_CODE_BAD_REQUEST;
+			}
+		}
+	} else {
+		val = strtol(value, &end, 10);
+		if (*end != '\0' || val < 0 || val > 100) {
+			return COAP_RESPONSE_CODE_BAD_REQUEST;
+		}
+	}
+
+	/*
+	 * The engine is not called from this thread: writes are applied
+	 * on the application work queue, like every other LwM2M write
+	 * the application makes. A write to a missing instance is only
+	 * logged there.
+	 */
+	write.inst = path[1];
+	write.res = path[2];
+	write.value = val;
+	if (k_msgq_put(&write_msgq, &write, K_NO_WAIT)) {
+		return COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE;
+	}
+
+	app_wq_submit(&write_work);
+
+	return COAP_RESPONSE_CODE_CHANGED;
+}
+
+static bool response_wanted(struct coap_packet *cpkt, u8_t code)
+{
+	struct coap_option option;
+
+	/*
+	 * Group requests are sent as NON and are never answered, so a
+	 * single packet can drive a whole room without an ACK storm.
+	 * State changes are reported back through the usual LwM2M
+	 * observations instead. A CON request sent to this port directly
+	 * is acknowledged, unless the sender asked for no 2.xx response.
+	 */
+	if (coap_header_get_type(cpkt) != COAP_TYPE_CON) {
+		return false;
+	}
+
+	if (coap_find_options(cpkt, COAP_OPTION_NO_RESPONSE,
+			      &option, 1) == 1 &&
+	    code == COAP_RESPONSE_CODE_CHANGED &&
+	    (coap_option_value_to_int(&option) & NO_RESPONSE_2XX)) {
+		return false;
+	}
+
+	return true;
+}
+
+static void send_response(struct coap_packet *request, u8_t code,
+			  struct sockaddr *from, socklen_t from_len)
+{
+	struct coap_packet response;
+	/* Header and token only: group write responses have no payload */
+	u8_t buf[4 + 8];
+	u8_t token[8];
+	u8_t tkl;
+	int ret;
+
+	tkl = coap_header_get_token(request, token);
+
+	ret = coap_packet_init(&response, buf, sizeof(buf), 1,
+			       COAP_TYPE_ACK, tkl, token, code,
+			       coap_header_get_id(request));
+	if (ret < 0) {
+		LOG_ERR("Cannot build response: %d", ret);
+		return;
+	}
+
+	ret = zsock_sendto(mcast_sock, response.data, response.offset, 0,
+			   from, from_len);
+	if (ret < 0) {
+		LOG_ERR("Cannot send response: %d", errno);
+	}
+}
+
+static void handle_packet(int len, struct sockaddr *from, socklen_t from_len)
+{
+	struct coap_option options[MCAST_MAX_OPTIONS];
+	struct coap_packet cpkt;
+	u8_t method, code;
+	int ret;
+
+	ret = coap_packet_parse(&cpkt, mcast_buf, len, options,
+				ARRAY_SIZE(options));
+	if (ret < 0) {
+		LOG_DBG("Invalid CoAP packet: %d", ret);
+		return;
+	}
+
+	method = coap_header_get_code(&cpkt);
+	if (method == COAP_METHOD_PUT || method == COAP_METHOD_POST) {
+		code = handle_write(&cpkt);
+	} else {
+		code = COAP_RESPONSE_CODE_NOT_ALLOWED;
+	}
+
+	if (response_wanted(&cpkt, code)) {
+		send_response(&cpkt, code, from, from_len);
+	}
+}
+
+static void mcast_group_loop(void *p1, void *p2, void *p3)
+{
+	struct sockaddr_in6 from;
+	socklen_t from_len;
+	int len;
+
+	while (true) {
+		from_len = sizeof(from);
+		len = zsock_recvfrom(mcast_sock, mcast_buf, sizeof(mcast_buf),
+				     0, (struct sockaddr *)&from, &from_len);
+		if (len < 0) {
+			LOG_ERR("recvfrom failed: %d", errno);
+			k_sleep(K_SECONDS(1));
+			continue;
+		}
+
+		handle_packet(len, (struct sockaddr *)&from, from_len);
+	}
+}
+
+int mcast_group_start(struct net_if *iface)
+{
+	struct sockaddr_in6 addr;
+	int ret;
+
+	if (mcast_sock >= 0) {
+		/* Already running; group membership lives on the iface */
+		return 0;
+	}
+
+	ret = join_groups(iface);
+	if (ret < 0) {
+		LOG_ERR("No multicast group joined");
+		return ret;
+	}
+
+	mcast_sock = zsock_socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (mcast_sock < 0) {
+		LOG_ERR("Cannot create socket: %d", errno);
+		return -errno;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(CONFIG_FOTA_MCAST_GROUP_PORT);
+
+	ret = zsock_bind(mcast_sock, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret < 0) {
+		LOG_ERR("Cannot bind to port %d: %d",
+			CONFIG_FOTA_MCAST_GROUP_PORT, errno);
+		zsock_close(mcast_sock);
+		mcast_sock = -1;
+		return -errno;
+	}
+
+	k_work_init(&write_work, apply_writes);
+
+	k_thread_create(&mcast_thread, mcast_stack,
+			K_THREAD_STACK_SIZEOF(mcast_stack),
+			mcast_group_loop, NULL, NULL, NULL,
+			MCAST_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&mcast_thread, "mcast_group");
+
+	return 0;
+}
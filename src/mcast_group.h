@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_MCAST_GROUP_H__
+#define FOTA_MCAST_GROUP_H__
+
+#include <net/net_if.h>
+
+/**
+ * @brief Join the configured CoAP groups and serve group writes.
+ *
+ * Joins every group in CONFIG_FOTA_MCAST_GROUP_ADDRS on @a iface and
+ * starts a thread which receives CoAP PUT/POST requests for the Light
+ * Control on/off and dimmer resources on CONFIG_FOTA_MCAST_GROUP_PORT.
+ * The writes themselves are applied on the application work queue,
+ * so this must be called from it. Calling it again is harmless.
+ *
+ * @param iface Network interface to join the groups on.
+ * @return 0 on success, negative errno otherwise.
+ */
+int mcast_group_start(struct net_if *iface);
+
+#endif	/* FOTA_MCAST_GROUP_H__ */
@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_mem_stats
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <string.h>
+#include <limits.h>
+#if defined(CONFIG_FOTA_DIAG_STACKS)
+#include <debug/stack.h>
+#endif
+#if defined(CONFIG_NETWORKING)
+#include <net/net_pkt.h>
+#endif
+#if defined(CONFIG_NET_STATISTICS_USER_API)
+#include <net/net_mgmt.h>
+#include <net/net_stats.h>
+#endif
+#if defined(CONFIG_MINIMAL_LIBC_MALLOC)
+#include <misc/mempool.h>
+#endif
+#if defined(CONFIG_MBEDTLS_ENABLE_HEAP)
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+#include <mbedtls/memory_buffer_alloc.h>
+#endif
+
+#include "mem_stats.h"
+
+#define SAMPLE_PERIOD	K_MSEC(CONFIG_FOTA_MEM_STATS_SAMPLE_MS)
+
+/*
+ * Pool minima and exhaustion counts are only as good as the sampling
+ * period: a pool which runs dry for less than a period may be missed.
+ * Every query samples too, so reading the counters never returns stale
+ * values.
+ */
+static struct k_delayed_work sample_work;
+
+#if defined(CONFIG_MINIMAL_LIBC_MALLOC)
+/* Defined by the minimal libc malloc() implementation */
+extern struct sys_mem_pool z_malloc_mem_pool;
+
+static u32_t libc_min_free = UINT32_MAX;
+
+static u32_t libc_heap_size(void)
+{
+	return z_malloc_mem_pool.base.n_max * z_malloc_mem_pool.base.max_sz;
+}
+
+static u32_t libc_heap_free(void)
+{
+	struct sys_mem_pool_base *p = &z_malloc_mem_pool.base;
+	size_t block_sz = p->max_sz;
+	sys_dnode_t *node;
+	u32_t free = 0;
+	int i;
+
+	/* Free blocks of each level are kept on that level's free list */
+	sys_mutex_lock(&z_malloc_mem_pool.mutex, K_FOREVER);
+	for (i = 0; i < p->n_levels; i++) {
+		SYS_DLIST_FOR_EACH_NODE(&p->levels[i].free_list, node) {
+			free += block_sz;
+		}
+		block_sz = WB_DN(block_sz / 4);
+	}
+	sys_mutex_unlock(&z_malloc_mem_pool.mutex);
+
+	libc_min_free = MIN(libc_min_free, free);
+
+	return free;
+}
+#endif /* CONFIG_MINIMAL_LIBC_MALLOC */
+
+int mem_stats_libc_heap(struct mem_heap_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+#if defined(CONFIG_MINIMAL_LIBC_MALLOC)
+	stats->size = libc_heap_size();
+	stats->used = stats->size - libc_heap_free();
+	stats->peak = stats->size - libc_min_free;
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+int mem_stats_mbedtls_heap(struct mem_heap_stats *stats)
+{
+#if defined(CONFIG_MBEDTLS_ENABLE_HEAP) && defined(MBEDTLS_MEMORY_DEBUG)
+	size_t bytes, blocks;
+#endif
+
+	memset(stats, 0, sizeof(*stats));
+
+#if defined(CONFIG_MBEDTLS_ENABLE_HEAP)
+	stats->size = CONFIG_MBEDTLS_HEAP_SIZE;
+#if defined(MBEDTLS_MEMORY_DEBUG)
+	mbedtls_memory_buffer_alloc_cur_get(&bytes, &blocks);
+	stats->used = bytes;
+	mbedtls_memory_buffer_alloc_max_get(&bytes, &blocks);
+	stats->peak = bytes;
+
+	return 0;
+#endif
+#endif
+
+	return -ENOTSUP;
+}
+
+#if defined(CONFIG_NETWORKING)
+static struct mem_pool_stats net_pools[MEM_NET_POOL_COUNT];
+static atomic_t net_alloc_failures[MEM_NET_POOL_COUNT];
+
+/*
+ * The linker redirects the network stack's calls to these allocators
+ * to the __wrap_ functions below (-Wl,--wrap in CMakeLists.txt), so
+ * that failures are counted where they happen rather than inferred
+ * from sampled free counts.
+ */
+int __real_k_mem_slab_alloc(struct k_mem_slab *slab, void **mem,
+			    s32_t timeout);
+#if !defined(CONFIG_NET_BUF_LOG)
+struct net_buf *__real_net_buf_alloc_fixed(struct net_buf_pool *pool,
+					   s32_t timeout);
+struct net_buf *__real_net_buf_alloc_len(struct net_buf_pool *pool,
+					 size_t size, s32_t timeout);
+#endif
+
+int __wrap_k_mem_slab_alloc(struct k_mem_slab *slab, void **mem,
+			    s32_t timeout)
+{
+	struct k_mem_slab *rx, *tx;
+	struct net_buf_pool *rx_data, *tx_data;
+	int ret;
+
+	ret = __real_k_mem_slab_alloc(slab, mem, timeout);
+	if (ret) {
+		net_pkt_get_info(&rx, &tx, &rx_data, &tx_data);
+		if (slab == rx) {
+			atomic_inc(&net_alloc_failures[MEM_NET_PKT_RX]);
+		} else if (slab == tx) {
+			atomic_inc(&net_alloc_failures[MEM_NET_PKT_TX]);
+		}
+	}
+
+	return ret;
+}
+
+#if !defined(CONFIG_NET_BUF_LOG)
+static void buf_alloc_failed(struct net_buf_pool *pool)
+{
+	struct k_mem_slab *rx, *tx;
+	struct net_buf_pool *rx_data, *tx_data;
+
+	net_pkt_get_info(&rx, &tx, &rx_data, &tx_data);
+	if (pool == rx_data) {
+		atomic_inc(&net_alloc_failures[MEM_NET_BUF_RX]);
+	} else if (pool == tx_data) {
+		atomic_inc(&net_alloc_failures[MEM_NET_BUF_TX]);
+	}
+}
+
+struct net_buf *__wrap_net_buf_alloc_fixed(struct net_buf_pool *pool,
+					   s32_t timeout)
+{
+	struct net_buf *buf;
+
+	buf = __real_net_buf_alloc_fixed(pool, timeout);
+	if (!buf) {
+		buf_alloc_failed(pool);
+	}
+
+	return buf;
+}
+
+struct net_buf *__wrap_net_buf_alloc_len(struct net_buf_pool *pool,
+					 size_t size, s32_t timeout)
+{
+	struct net_buf *buf;
+
+	buf = __real_net_buf_alloc_len(pool, size, timeout);
+	if (!buf) {
+		buf_alloc_failed(pool);
+	}
+
+	return buf;
+}
+#endif /* !CONFIG_NET_BUF_LOG */
+
+static void pool_update(struct mem_pool_stats *stats, u16_t count,
+			u16_t free)
+{
+	stats->count = count;
+	stats->free = free;
+	stats->min_free = MIN(stats->min_free, free);
+}
+
+static void slab_sample(struct mem_pool_stats *stats, struct k_mem_slab *slab)
+{
+	pool_update(stats, slab->num_blocks, k_mem_slab_num_free_get(slab));
+}
+
+static void buf_pool_sample(struct mem_pool_stats *stats,
+			    struct net_buf_pool *pool)
+{
+	pool_update(stats, pool->buf_count, pool->avail_count);
+}
+
+static void net_pools_sample(void)
+{
+	struct k_mem_slab *rx, *tx;
+	struct net_buf_pool *rx_data, *tx_data;
+	unsigned int key;
+
+	net_pkt_get_info(&rx, &tx, &rx_data, &tx_data);
+
+	key = irq_lock();
+	slab_sample(&net_pools[MEM_NET_PKT_RX], rx);
+	slab_sample(&net_pools[MEM_NET_PKT_TX], tx);
+	buf_pool_sample(&net_pools[MEM_NET_BUF_RX], rx_data);
+	buf_pool_sample(&net_pools[MEM_NET_BUF_TX], tx_data);
+	irq_unlock(key);
+}
+#endif /* CONFIG_NETWORKING */
+
+int mem_stats_net_pool(enum mem_net_pool pool, struct mem_pool_stats *stats)
+{
+#if defined(CONFIG_NETWORKING)
+	unsigned int key;
+
+	if (pool >= MEM_NET_POOL_COUNT) {
+		return -EINVAL;
+	}
+
+	net_pools_sample();
+
+	key = irq_lock();
+	*stats = net_pools[pool];
+	irq_unlock(key);
+	stats->alloc_failures = atomic_get(&net_alloc_failures[pool]);
+
+	return 0;
+#else
+	memset(stats, 0, sizeof(*stats));
+
+	return -ENOTSUP;
+#endif
+}
+
+int mem_stats_net_drops(u32_t *drops)
+{
+#if defined(CONFIG_NET_STATISTICS_USER_API)
+	struct net_stats stats;
+	int ret;
+
+	ret = net_mgmt(NET_REQUEST_STATS_GET_ALL, NULL, &stats, sizeof(stats));
+	if (ret < 0) {
+		return ret;
+	}
+
+	*drops = stats.processing_error;
+#if defined(CONFIG_NET_STATISTICS_IPV6)
+	*drops += stats.ipv6.drop;
+#endif
+#if defined(CONFIG_NET_STATISTICS_IPV4)
+	*drops += stats.ipv4.drop;
+#endif
+#if defined(CONFIG_NET_STATISTICS_UDP)
+	*drops += stats.udp.drop;
+#endif
+#if defined(CONFIG_NET_STATISTICS_ICMP)
+	*drops += stats.icmp.drop;
+#endif
+
+	return 0;
+#else
+	*drops = 0;
+
+	return -ENOTSUP;
+#endif
+}
+
+#if defined(CONFIG_FOTA_DIAG_STACKS)
+struct thread_stack {
+	const char *name;
+	const char *start;
+	size_t size;
+};
+
+static struct thread_stack stacks[CONFIG_FOTA_MEM_STATS_MAX_THREADS];
+static size_t stack_count;
+static K_MUTEX_DEFINE(stacks_lock);
+
+static void stack_collect(const struct k_thread *thread, void *user_data)
+{
+	struct thread_stack *stack;
+
+	/* Runs with the thread list locked: only record, don't scan */
+	if (stack_count >= ARRAY_SIZE(stacks)) {
+		return;
+	}
+
+	stack = &stacks[stack_count++];
+	stack->start = (const char *)thread->stack_info.start;
+	stack->size = thread->stack_info.size;
+#if defined(CONFIG_THREAD_NAME)
+	stack->name = k_thread_name_get((k_tid_t)thread);
+#else
+	stack->name = NULL;
+#endif
+}
+
+int mem_stats_stacks(mem_stats_stack_cb_t cb, void *user_data)
+{
+	size_t unused, min_unused = INT_MAX;
+	size_t i;
+
+	k_mutex_lock(&stacks_lock, K_FOREVER);
+
+	stack_count = 0;
+	k_thread_foreach(stack_collect, NULL);
+
+	/* Application threads are never destroyed, so this is safe */
+	for (i = 0; i < stack_count; i++) {
+		unused = stack_unused_space_get(stacks[i].start,
+						stacks[i].size);
+		min_unused = MIN(min_unused, unused);
+		if (cb) {
+			cb(stacks[i].name, stacks[i].size, unused, user_data);
+		}
+	}
+
+	k_mutex_unlock(&stacks_lock);
+
+	return min_unused;
+}
+#else
+int mem_stats_stacks(mem_stats_stack_cb_t cb, void *user_data)
+{
+	return -ENOTSUP;
+}
+#endif /* CONFIG_FOTA_DIAG_STACKS */
+
+u32_t mem_stats_heap_free(void)
+{
+	struct mem_heap_stats stats;
+	u32_t free = 0;
+
+	if (!mem_stats_libc_heap(&stats)) {
+		free += stats.size - stats.used;
+	}
+
+	if (!mem_stats_mbedtls_heap(&stats)) {
+		free += stats.size - stats.used;
+	}
+
+	return free;
+}
+
+static void sample(struct k_work *work)
+{
+#if defined(CONFIG_MINIMAL_LIBC_MALLOC)
+	libc_heap_free();
+#endif
+#if defined(CONFIG_NETWORKING)
+	net_pools_sample();
+#endif
+
+	k_delayed_work_submit(&sample_work, SAMPLE_PERIOD);
+}
+
+void mem_stats_init(void)
+{
+#if defined(CONFIG_NETWORKING)
+	int i;
+
+	for (i = 0; i < MEM_NET_POOL_COUNT; i++) {
+		net_pools[i].min_free = UINT16_MAX;
+	}
+#endif
+
+	k_delayed_work_init(&sample_work, sample);
+	k_delayed_work_submit(&sample_work, K_NO_WAIT);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_MEM_STATS_H__
+#define FOTA_MEM_STATS_H__
+
+#include <zephyr/types.h>
+#include <stddef.h>
+
+/**
+ * @file
+ * @brief RAM usage accounting
+ *
+ * Reports how much of each statically sized memory region the
+ * application actually uses, so that builds can be right-sized per
+ * board. Values which cannot be measured in the current configuration
+ * are reported as -ENOTSUP.
+ */
+
+/**
+ * @brief Usage of a heap.
+ */
+struct mem_heap_stats {
+	/** Size of the heap, in bytes */
+	u32_t size;
+	/** Bytes currently allocated */
+	u32_t used;
+	/** Most bytes allocated at once since boot */
+	u32_t peak;
+};
+
+/**
+ * @brief Usage of a fixed size block pool.
+ */
+struct mem_pool_stats {
+	/** Number of blocks in the pool */
+	u16_t count;
+	/** Blocks currently free */
+	u16_t free;
+	/** Fewest blocks seen free since boot */
+	u16_t min_free;
+	/** Number of allocations from the pool which failed */
+	u32_t alloc_failures;
+};
+
+enum mem_net_pool {
+	MEM_NET_PKT_RX,
+	MEM_NET_PKT_TX,
+	MEM_NET_BUF_RX,
+	MEM_NET_BUF_TX,
+
+	MEM_NET_POOL_COUNT,
+};
+
+/**
+ * @brief Called by mem_stats_stacks() for each thread.
+ *
+ * @param name Thread name, or NULL if thread names are not enabled.
+ * @param size Stack size, in bytes.
+ * @param unused Bytes of stack which have never been used.
+ * @param user_data Pointer passed to mem_stats_stacks().
+ */
+typedef void (*mem_stats_stack_cb_t)(const char *name, size_t size,
+				     size_t unused, void *user_data);
+
+/**
+ * @brief Get the minimal libc malloc() arena usage.
+ *
+ * @return 0 on success, -ENOTSUP if the arena is not in use.
+ */
+int mem_stats_libc_heap(struct mem_heap_stats *stats);
+
+/**
+ * @brief Get the mbedTLS heap usage.
+ *
+ * Current and peak usage need MBEDTLS_MEMORY_DEBUG in the mbedTLS
+ * configuration; without it, only the size is filled in and
+ * -ENOTSUP is returned.
+ *
+ * @return 0 on success, -ENOTSUP if usage is not available.
+ */
+int mem_stats_mbedtls_heap(struct mem_heap_stats *stats);
+
+/**
+ * @brief Get the usage of one of the network packet or buffer pools.
+ *
+ * Free counts are sampled, so short dips below the reported minimum
+ * can be missed. Allocation failures are counted as they happen, by
+ * wrapping the allocators the network stack calls (see app.cmake);
+ * the debug allocators of CONFIG_NET_BUF_LOG are not counted.
+ *
+ * @return 0 on success, -ENOTSUP without networking.
+ */
+int mem_stats_net_pool(enum mem_net_pool pool, struct mem_pool_stats *stats);
+
+/**
+ * @brief Get the number of packets dropped by the network stack.
+ *
+ * Sums the IP, UDP and ICMP drop counters and processing errors.
+ *
+ * @return 0 on success, -ENOTSUP without CONFIG_NET_STATISTICS_USER_API.
+ */
+int mem_stats_net_drops(u32_t *drops);
+
+/**
+ * @brief Report the stack high-water mark of every thread.
+ *
+ * Scanning stacks is slow; call this from a low priority context.
+ *
+ * @return Smallest amount of unused stack, in bytes, across all threads,
+ *         or -ENOTSUP without CONFIG_FOTA_DIAG_STACKS.
+ */
+int mem_stats_stacks(mem_stats_stack_cb_t cb, void *user_data);
+
+/**
+ * @brief Get the number of free bytes across the application heaps.
+ */
+u32_t mem_stats_heap_free(void);
+
+/**
+ * @brief Start sampling the minimum free counts of the network pools.
+ */
+void mem_stats_init(void);
+
+#endif	/* FOTA_MEM_STATS_H__ */
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_obs_sched
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <stdlib.h>
+#include <misc/slist.h>
+#include <net/lwm2m.h>
+
+#include "obs_sched.h"
+#include "app_work_queue.h"
+
+/* Default minimum and maximum periods of the LwM2M server, in seconds */
+#define SERVER_PMIN_PATH	"1/0/2"
+#define SERVER_PMAX_PATH	"1/0/3"
+
+static sys_slist_t sources = SYS_SLIST_STATIC_INIT(&sources);
+static struct k_delayed_work tick_work;
+static atomic_t tick_armed;
+static bool started;
+
+static u32_t server_period(char *path)
+{
+	u32_t period = 0;
+
+	lwm2m_engine_get_u32(path, &period);
+
+	return period;
+}
+
+static bool changed(struct obs_source *src, s32_t value)
+{
+	if (!src->step) {
+		return value != src->last_value;
+	}
+
+	return abs(value - src->last_value) >= src->step;
+}
+
+static void tick(struct k_work *work)
+{
+	s64_t period = K_SECONDS(CONFIG_FOTA_OBS_PERIOD);
+	s64_t pmin = K_SECONDS(server_period(SERVER_PMIN_PATH));
+	s64_t pmax = K_SECONDS(server_period(SERVER_PMAX_PATH));
+	struct obs_source *src;
+	s64_t now = k_uptime_get();
+	int notified = 0;
+	bool observed = false;
+	s32_t value;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&sources, src, node) {
+		if (!src->observed) {
+			continue;
+		}
+
+		if (!src->sample || src->sample(src, &value)) {
+			/* Event driven, or no sample this time */
+		} else if (!src->sampled) {
+			/* The Observe response carried the current value */
+			src->sampled = true;
+			src->last_value = value;
+		} else if (changed(src, value)) {
+			src->last_value = value;
+			src->pending = true;
+		}
+
+		/*
+		 * A change waits for pmin to pass since the last
+		 * notification. Raise pmax notifications on the last tick
+		 * before they expire, so the engine never sends one on its
+		 * own schedule.
+		 */
+		if (!(src->pending && now - src->last_notify >= pmin) &&
+		    !(pmax && now + period - src->last_notify >= pmax)) {
+			observed = true;
+			continue;
+		}
+
+		src->pending = false;
+		src->last_notify = now;
+		if (lwm2m_notify_observer(src->obj_id, src->obj_inst_id,
+					  src->res_id) > 0) {
+			observed = true;
+			notified++;
+		} else {
+			/* Cancelled: the next read may start it again */
+			src->observed = false;
+		}
+	}
+
+	if (notified) {
+		LOG_DBG("%d notification(s) raised", notified);
+	}
+
+	/* Idle until an observation starts with a read of a source */
+	if (!observed) {
+		atomic_clear(&tick_armed);
+		LOG_DBG("Nothing observed, tick stopped");
+		return;
+	}
+
+	app_wq_submit_delayed(&tick_work, period);
+}
+
+static void tick_arm(void)
+{
+	if (started && atomic_cas(&tick_armed, 0, 1)) {
+		app_wq_submit_delayed(&tick_work,
+				      K_SECONDS(CONFIG_FOTA_OBS_PERIOD));
+	}
+}
+
+void obs_sched_add(struct obs_source *src)
+{
+	unsigned int key;
+
+	src->observed = false;
+	src->sampled = false;
+	src->pending = false;
+	src->last_notify = k_uptime_get();
+
+	key = irq_lock();
+	sys_slist_append(&sources, &src->node);
+	irq_unlock(key);
+}
+
+void obs_sched_notify(struct obs_source *src)
+{
+	src->pending = true;
+	tick_arm();
+}
+
+void obs_sched_read(struct obs_source *src)
+{
+	/* Possibly an Observe: its response counts as a notification */
+	src->sampled = false;
+	src->last_notify = k_uptime_get();
+	src->observed = true;
+	tick_arm();
+}
+
+void obs_sched_start(void)
+{
+	k_delayed_work_init(&tick_work, tick);
+	started = true;
+}
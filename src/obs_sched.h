@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_OBS_SCHED_H__
+#define FOTA_OBS_SCHED_H__
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+
+/**
+ * @file
+ * @brief Observation scheduler
+ *
+ * Samples observable resources and raises their LwM2M notifications on
+ * a single shared tick of CONFIG_FOTA_OBS_PERIOD seconds, instead of
+ * each resource notifying on its own schedule. Each source is notified
+ * on the first tick at least the server's default minimum period (pmin,
+ * 1/0/2) after its last notification once it has changed by its step,
+ * and on the last tick before the default maximum period (pmax, 1/0/3)
+ * expires, so the engine does not wake up for pmax by itself.
+ *
+ * The engine's observers are not shared with the application, so
+ * pmin, pmax and st Write-Attributes of single resources are not
+ * seen here: the engine still applies them, off the shared tick.
+ *
+ * The tick only runs while something is observed. An Observe starts
+ * with a read of the resource, so sources report reads with
+ * obs_sched_read(); a source stops being served once a notification
+ * finds no observer.
+ */
+
+struct obs_source {
+	/** Resource notified when the source changes */
+	u16_t obj_id;
+	u16_t obj_inst_id;
+	u16_t res_id;
+
+	/**
+	 * Sample the source into @a value, in units of the source's
+	 * choosing. NULL for sources which call obs_sched_notify().
+	 */
+	int (*sample)(struct obs_source *src, s32_t *value);
+	/** Smallest change which is notified, 0 for any change */
+	s32_t step;
+
+	/* Private, owned by the scheduler */
+	sys_snode_t node;
+	s32_t last_value;
+	s64_t last_notify;
+	bool observed;
+	bool sampled;
+	bool pending;
+};
+
+/**
+ * @brief Add a source to the scheduler.
+ */
+void obs_sched_add(struct obs_source *src);
+
+/**
+ * @brief Report a change of an event driven source.
+ *
+ * The notification is raised on the next tick, together with the
+ * others due then.
+ */
+void obs_sched_notify(struct obs_source *src);
+
+/**
+ * @brief Report a read of a source's resource.
+ *
+ * Call this from the resource's read callback: it starts the tick if
+ * it was idle, in case the read begins an observation.
+ */
+void obs_sched_read(struct obs_source *src);
+
+/**
+ * @brief Set up the scheduler tick on the application work queue.
+ */
+void obs_sched_start(void);
+
+#endif	/* FOTA_OBS_SCHED_H__ */
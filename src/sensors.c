@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME fota_sensors
+#define LOG_LEVEL CONFIG_FOTA_LOG_LEVEL
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <string.h>
+#include <sensor.h>
+#include <net/lwm2m.h>
+
+#include "obs_sched.h"
+#include "sensors.h"
+
+/* Resources common to the IPSO sensor objects */
+#define SENSOR_VALUE_ID		5700
+#define SENSOR_UNITS_ID		5701
+
+struct sensor_dev {
+	const char *name;
+	struct device *dev;
+	s64_t fetched;
+	int err;
+	bool sampled;
+};
+
+struct ipso_sensor {
+	const char *dev_name;
+	enum sensor_channel chan;
+	u16_t obj_id;
+	u16_t obj_inst_id;
+	const char *units;
+	lwm2m_engine_get_data_cb_t read_cb;
+
+	struct sensor_dev *dev;
+	struct float32_value value;
+	struct obs_source obs;
+};
+
+static void *sensor_read(u16_t obj_id, u16_t obj_inst_id, size_t *data_len);
+static int sensor_sample(struct obs_source *src, s32_t *value);
+
+/* Read callbacks are not told the object ID: one per object */
+#define SENSOR_READ_CB(_obj_id)						\
+	static void *read_cb_##_obj_id(u16_t obj_inst_id, u16_t res_id,	\
+				       u16_t res_inst_id,		\
+				       size_t *data_len)		\
+	{								\
+		return sensor_read(_obj_id, obj_inst_id, data_len);	\
+	}
+
+/*
+ * The sensor table. Each entry is
+ *
+ *   SENSOR(device name, channel, IPSO object ID, instance, units,
+ *          observation step)
+ *
+ * with the step in thousandths of the channel's unit. Entries naming
+ * the same device share its samples. A NULL device is simulated.
+ */
+#if defined(CONFIG_FOTA_TEMP_VIRTUAL)
+#define TEMP_DEV		NULL
+#else
+#define TEMP_DEV		CONFIG_FOTA_SENSOR_TEMP_DEV
+#endif
+
+#if defined(CONFIG_FOTA_SENSOR_TEMP_AMBIENT)
+#define TEMP_CHAN		SENSOR_CHAN_AMBIENT_TEMP
+#else
+#define TEMP_CHAN		SENSOR_CHAN_DIE_TEMP
+#endif
+
+SENSOR_READ_CB(3303)
+#define SENSOR_TEMP							\
+	SENSOR(TEMP_DEV, TEMP_CHAN, 3303, 0, "Cel",			\
+	       CONFIG_FOTA_OBS_TEMP_STEP)
+
+#if defined(CONFIG_FOTA_SENSOR_HUMIDITY)
+SENSOR_READ_CB(3304)
+#define SENSOR_HUMIDITY							\
+	SENSOR(CONFIG_FOTA_SENSOR_HUMIDITY_DEV, SENSOR_CHAN_HUMIDITY,	\
+	       3304, 0, "%RH", CONFIG_FOTA_OBS_HUMIDITY_STEP)
+#else
+#define SENSOR_HUMIDITY
+#endif
+
+#if defined(CONFIG_FOTA_SENSOR_PRESSURE)
+SENSOR_READ_CB(3323)
+#define SENSOR_PRESSURE							\
+	SENSOR(CONFIG_FOTA_SENSOR_PRESSURE_DEV, SENSOR_CHAN_PRESS,	\
+	       3323, 0, "kPa", CONFIG_FOTA_OBS_PRESSURE_STEP)
+#else
+#define SENSOR_PRESSURE
+#endif
+
+#define SENSOR_TABLE	\
+	SENSOR_TEMP	\
+	SENSOR_HUMIDITY	\
+	SENSOR_PRESSURE
+
+#define SENSOR(_dev, _chan, _obj_id, _obj_inst_id, _units, _step)	\
+	{								\
+		.dev_name = _dev,					\
+		.chan = _chan,						\
+		.obj_id = _obj_id,					\
+		.obj_inst_id = _obj_inst_id,				\
+		.units = _units,					\
+		.read_cb = read_cb_##_obj_id,				\
+		.obs = {						\
+			.obj_id = _obj_id,				\
+			.obj_inst_id = _obj_inst_id,			\
+			.res_id = SENSOR_VALUE_ID,			\
+			.sample = sensor_sample,			\
+			.step = _step,					\
+		},							\
+	},
+
+static struct ipso_sensor sensors[] = {
+	SENSOR_TABLE
+};
+
+#undef SENSOR
+
+static struct sensor_dev devs[ARRAY_SIZE(sensors)];
+static int dev_count;
+
+/* Read callbacks run on the engine's thread, samples on the work queue */
+static K_MUTEX_DEFINE(sensors_lock);
+
+/*
+ * One fetch serves every channel of the device read within
+ * CONFIG_FOTA_SENSOR_MAX_AGE_MS of it, e.g. all those sampled on an
+ * observation tick.
+ */
+static int dev_fetch(struct sensor_dev *sd)
+{
+	s64_t now = k_uptime_get();
+
+	if (sd->sampled && now - sd->fetched < CONFIG_FOTA_SENSOR_MAX_AGE_MS) {
+		return sd->err;
+	}
+
+	sd->sampled = true;
+	sd->fetched = now;
+	sd->err = sd->dev ? sensor_sample_fetch(sd->dev) : 0;
+	if (sd->err) {
+		LOG_ERR("%s: I/O error: %d", sd->name, sd->err);
+	}
+
+	return sd->err;
+}
+
+static int channel_get(struct ipso_sensor *s, struct sensor_value *val)
+{
+#if defined(CONFIG_FOTA_TEMP_VIRTUAL)
+	if (!s->dev->dev) {
+		/* One tenth of a degree per minute, 20.0 to 20.9, again */
+		u32_t minutes = k_uptime_get_32() / MSEC_PER_SEC / 60;
+
+		val->val1 = 20;
+		val->val2 = (minutes % 10) * 100000;
+		return 0;
+	}
+#endif
+
+	return sensor_channel_get(s->dev->dev, s->chan, val);
+}
+
+/* Call with sensors_lock held */
+static int sensor_update(struct ipso_sensor *s)
+{
+	struct sensor_value val;
+	int ret;
+
+	ret = dev_fetch(s->dev);
+	if (ret) {
+		return ret;
+	}
+
+	ret = channel_get(s, &val);
+	if (ret) {
+		LOG_ERR("%u/%u: can't get data: %d", s->obj_id,
+			s->obj_inst_id, ret);
+		return ret;
+	}
+
+	LOG_DBG("%u/%u: read %d.%06d %s", s->obj_id, s->obj_inst_id,
+		val.val1, val.val2, s->units);
+	s->value.val1 = val.val1;
+	s->value.val2 = val.val2;
+
+	return 0;
+}
+
+static struct ipso_sensor *sensor_find(u16_t obj_id, u16_t obj_inst_id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sensors); i++) {
+		if (sensors[i].obj_id == obj_id &&
+		    sensors[i].obj_inst_id == obj_inst_id) {
+			return &sensors[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void *sensor_read(u16_t obj_id, u16_t obj_inst_id, size_t *data_len)
+{
+	struct ipso_sensor *s = sensor_find(obj_id, obj_inst_id);
+
+	if (!s) {
+		*data_len = 0;
+		return NULL;
+	}
+
+	/*
+	 * On failure, report the previous value: there is currently no
+	 * way to report read_cb failures to the LWM2M engine.
+	 */
+	k_mutex_lock(&sensors_lock, K_FOREVER);
+	sensor_update(s);
+	k_mutex_unlock(&sensors_lock);
+
+	obs_sched_read(&s->obs);
+
+	*data_len = sizeof(s->value);
+
+	return &s->value;
+}
+
+/* Sampled on the observation tick, in thousandths of the unit */
+static int sensor_sample(struct obs_source *src, s32_t *value)
+{
+	struct ipso_sensor *s = CONTAINER_OF(src, struct ipso_sensor, obs);
+	int ret;
+
+	k_mutex_lock(&sensors_lock, K_FOREVER);
+	ret = sensor_update(s);
+	if (!ret) {
+		*value = s->value.val1 * 1000 + s->value.val2 / 1000;
+	}
+	k_mutex_unlock(&sensors_lock);
+
+	return ret;
+}
+
+static struct sensor_dev *dev_get(const char *name)
+{
+	struct device *dev = NULL;
+	int i;
+
+	for (i = 0; i < dev_count; i++) {
+		if (devs[i].name == name ||
+		    (name && devs[i].name && !strcmp(devs[i].name, name))) {
+			return &devs[i];
+		}
+	}
+
+	if (name) {
+		dev = device_get_binding(name);
+		if (!dev) {
+			LOG_ERR("Sensor device %s not found", name);
+			return NULL;
+		}
+	}
+
+	devs[dev_count].name = name;
+	devs[dev_count].dev = dev;
+
+	return &devs[dev_count++];
+}
+
+int sensors_init(void)
+{
+	char path[sizeof("65535/65535/65535")];
+	struct ipso_sensor *s;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(sensors); i++) {
+		s = &sensors[i];
+
+		s->dev = dev_get(s->dev_name);
+		if (!s->dev) {
+			return -ENODEV;
+		}
+
+		snprintk(path, sizeof(path), "%u/%u", s->obj_id,
+			 s->obj_inst_id);
+		ret = lwm2m_engine_create_obj_inst(path);
+		if (ret) {
+			LOG_ERR("Cannot create %s: %d", log_strdup(path), ret);
+			return ret;
+		}
+
+		snprintk(path, sizeof(path), "%u/%u/%u", s->obj_id,
+			 s->obj_inst_id, SENSOR_VALUE_ID);
+		lwm2m_engine_register_read_callback(path, s->read_cb);
+
+		snprintk(path, sizeof(path), "%u/%u/%u", s->obj_id,
+			 s->obj_inst_id, SENSOR_UNITS_ID);
+		lwm2m_engine_set_string(path, (char *)s->units);
+
+		obs_sched_add(&s->obs);
+
+		LOG_INF("%u/%u from %s", s->obj_id, s->obj_inst_id,
+			s->dev_name ? s->dev_name : "simulated sensor");
+	}
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_SENSORS_H__
+#define FOTA_SENSORS_H__
+
+/**
+ * @file
+ * @brief IPSO sensor objects
+ *
+ * Exposes sensor channels as IPSO sensor object instances (Temperature
+ * 3303, Humidity 3304, Pressure 3323...), as listed in the table in
+ * sensors.c. Channels of one device are served from a single sample
+ * fetch, and their Sensor Value resources are observed through the
+ * observation scheduler.
+ */
+
+/**
+ * @brief Bind the sensor devices and create their object instances.
+ *
+ * @return 0 on success, negative errno if a device is missing or an
+ *         object instance cannot be created.
+ */
+int sensors_init(void);
+
+#endif	/* FOTA_SENSORS_H__ */
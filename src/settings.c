@@ -14,24 +14,133 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #include <settings/settings.h>
 
 #include "settings.h"
+#include "app_work_queue.h"
+
+/* Shortest and longest wait before retrying a failed save */
+#define FLUSH_RETRY_MIN_MS	MAX(CONFIG_FOTA_SETTINGS_FLUSH_DELAY_MS, \
+				    K_SECONDS(1))
+#define FLUSH_RETRY_MAX_MS	K_SECONDS(300)
+
+#define SUBTREE_LIST_LEN	MAX(sizeof(CONFIG_FOTA_SETTINGS_EARLY_SUBTREES), \
+				    sizeof(CONFIG_FOTA_SETTINGS_DEFERRED_SUBTREES))
+
+/*
+ * Application settings are written back lazily: updates only touch the
+ * RAM copy and mark it dirty, and dirty entries are saved to flash at
+ * most CONFIG_FOTA_SETTINGS_FLUSH_DELAY_MS later, on
+ * fota_settings_commit(), or before a reboot.
+ */
+struct settings_cache_entry {
+	const char *name;
+	void *value;
+	size_t len;
+	bool dirty;
+};
 
 static struct update_counter uc;
 
+static struct settings_cache_entry cache[] = {
+	{ .name = "fota/counter", .value = &uc, .len = sizeof(uc) },
+};
+
+static K_MUTEX_DEFINE(cache_lock);
+static struct k_delayed_work flush_work;
+static bool flush_pending;
+static s32_t flush_retry_ms;
+
+static struct k_work deferred_load_work;
+
+static int cache_flush(void)
+{
+	int ret = 0, err;
+	size_t i;
+
+	k_mutex_lock(&cache_lock, K_FOREVER);
+	for (i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (!cache[i].dirty) {
+			continue;
+		}
+
+		err = settings_save_one(cache[i].name, cache[i].value,
+					cache[i].len);
+		if (err) {
+			/* Keep it dirty so the next flush retries */
+			LOG_ERR("Failed to save %s (err %d)",
+				cache[i].name, err);
+			ret = err;
+			continue;
+		}
+
+		cache[i].dirty = false;
+		LOG_DBG("Saved %s", cache[i].name);
+	}
+
+	if (ret) {
+		/* Back off while the storage keeps failing */
+		flush_retry_ms = flush_retry_ms ?
+			MIN(flush_retry_ms * 2, FLUSH_RETRY_MAX_MS) :
+			FLUSH_RETRY_MIN_MS;
+		flush_pending = true;
+		k_delayed_work_submit(&flush_work, flush_retry_ms);
+	} else {
+		flush_retry_ms = 0;
+		flush_pending = false;
+	}
+	k_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+static void flush_handler(struct k_work *work)
+{
+	cache_flush();
+}
+
+/* Must be called with cache_lock held */
+static void cache_mark_dirty(struct settings_cache_entry *entry)
+{
+	entry->dirty = true;
+
+	/*
+	 * The deadline is set by the first change since the last flush and
+	 * is not pushed back by later ones, so data never stays in RAM for
+	 * longer than the configured delay.
+	 */
+	if (!flush_pending) {
+		flush_pending = true;
+		k_delayed_work_submit(&flush_work,
+				      CONFIG_FOTA_SETTINGS_FLUSH_DELAY_MS);
+	}
+}
+
+int fota_settings_commit(void)
+{
+	k_delayed_work_cancel(&flush_work);
+
+	return cache_flush();
+}
+
 int fota_update_counter_read(struct update_counter *update_counter)
 {
+	k_mutex_lock(&cache_lock, K_FOREVER);
 	memcpy(update_counter, &uc, sizeof(uc));
+	k_mutex_unlock(&cache_lock);
+
 	return 0;
 }
 
 int fota_update_counter_update(update_counter_t type, u32_t new_value)
 {
-	if (type == COUNTER_UPDATE) {
-		uc.update = new_value;
-	} else {
-		uc.current = new_value;
+	int *counter = (type == COUNTER_UPDATE) ? &uc.update : &uc.current;
+
+	k_mutex_lock(&cache_lock, K_FOREVER);
+	if (*counter != (int)new_value) {
+		*counter = new_value;
+		cache_mark_dirty(&cache[0]);
 	}
+	k_mutex_unlock(&cache_lock);
 
-	return settings_save_one("fota/counter", &uc, sizeof(uc));
+	return 0;
 }
 
 static int set(const char *key, size_t len_rd, settings_read_cb read_cb,
@@ -43,11 +152,17 @@ static int set(const char *key, size_t len_rd, settings_read_cb read_cb,
 	len = settings_name_next(key, &next);
 
 	if (!strncmp(key, "counter", len)) {
-		len = read_cb(cb_arg, &uc, sizeof(uc));
-		if (len < sizeof(uc)) {
-			LOG_ERR("Unable to read update counter.  Resetting.");
-			memset(&uc, 0, sizeof(uc));
+		k_mutex_lock(&cache_lock, K_FOREVER);
+		/* Don't replace a newer value waiting to be written back */
+		if (!cache[0].dirty) {
+			len = read_cb(cb_arg, &uc, sizeof(uc));
+			if (len < sizeof(uc)) {
+				LOG_ERR("Unable to read update counter.  "
+					"Resetting.");
+				memset(&uc, 0, sizeof(uc));
+			}
 		}
+		k_mutex_unlock(&cache_lock);
 
 		return 0;
 	}
@@ -57,10 +172,73 @@ static int set(const char *key, size_t len_rd, settings_read_cb read_cb,
 
 SETTINGS_STATIC_HANDLER_DEFINE(fota, "fota", NULL, set, NULL, NULL);
 
+static int load_subtree(const char *subtree)
+{
+	u32_t start, us;
+	int err;
+
+	start = k_cycle_get_32();
+	if (!strcmp(subtree, "*")) {
+		err = settings_load();
+	} else {
+		err = settings_load_subtree(subtree);
+	}
+	us = (u32_t)(SYS_CLOCK_HW_CYCLES_TO_NS64(k_cycle_get_32() - start) /
+		     NSEC_PER_USEC);
+
+	if (err) {
+		LOG_ERR("Loading settings subtree %s failed (err %d)",
+			subtree, err);
+	} else {
+		LOG_INF("Loaded settings subtree %s in %u us", subtree, us);
+	}
+
+	return err;
+}
+
+static int load_subtrees(const char *list)
+{
+	char subtrees[SUBTREE_LIST_LEN];
+	char *subtree, *saveptr;
+	int ret = 0, err;
+
+	strncpy(subtrees, list, sizeof(subtrees));
+
+	for (subtree = strtok_r(subtrees, " ,", &saveptr); subtree;
+	     subtree = strtok_r(NULL, " ,", &saveptr)) {
+		err = load_subtree(subtree);
+		if (err) {
+			ret = err;
+		}
+	}
+
+	return ret;
+}
+
+static void deferred_load_handler(struct k_work *work)
+{
+	load_subtrees(CONFIG_FOTA_SETTINGS_DEFERRED_SUBTREES);
+}
+
+int fota_settings_load_early(void)
+{
+	return load_subtrees(CONFIG_FOTA_SETTINGS_EARLY_SUBTREES);
+}
+
+void fota_settings_load_deferred(void)
+{
+	if (sizeof(CONFIG_FOTA_SETTINGS_DEFERRED_SUBTREES) > 1) {
+		app_wq_submit(&deferred_load_work);
+	}
+}
+
 int fota_settings_init(void)
 {
 	int err;
 
+	k_delayed_work_init(&flush_work, flush_handler);
+	k_work_init(&deferred_load_work, deferred_load_handler);
+
 	err = settings_subsys_init();
 	if (err) {
 		LOG_ERR("settings_subsys_init failed (err %d)", err);
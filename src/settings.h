@@ -18,7 +18,28 @@ typedef enum {
 } update_counter_t;
 
 int fota_update_counter_read(struct update_counter *update_counter);
+
+/*
+ * Updates are cached in RAM and written back to flash later; call
+ * fota_settings_commit() when the new value must survive a reset.
+ */
 int fota_update_counter_update(update_counter_t type, u32_t new_value);
+
+/* Write every modified setting to flash now. Call before rebooting. */
+int fota_settings_commit(void);
+
 int fota_settings_init(void);
 
+/*
+ * Load the settings subtrees needed before LwM2M registration
+ * (CONFIG_FOTA_SETTINGS_EARLY_SUBTREES) from the calling thread.
+ */
+int fota_settings_load_early(void);
+
+/*
+ * Queue loading of CONFIG_FOTA_SETTINGS_DEFERRED_SUBTREES on the
+ * application work queue.
+ */
+void fota_settings_load_deferred(void);
+
 #endif	/* FOTA_STORAGE_H__ */
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * BabbleSim central for the BLE reconnect test: connects to the device
+ * under test, serves its LwM2M registration, then drops the link a few
+ * times and checks that the device registers again each time the link
+ * is restored. Exits with 0 on success, so that the run script can
+ * tell the outcome.
+ */
+
+#define LOG_MODULE_NAME bsim_central
+#define LOG_LEVEL LOG_LEVEL_INF
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/uuid.h>
+#include <misc/byteorder.h>
+#include <net/bt.h>
+#include <net/net_if.h>
+#include <net/net_mgmt.h>
+#include <posix_board_if.h>
+
+#include "server.h"
+
+/*
+ * The device is given the peer address in ../device.conf: no router
+ * advertises a prefix on this link.
+ */
+#define CENTRAL_ADDR		"2001:db8::1"
+
+#define RECONNECT_LOOPS		3
+#define REGISTRATION_TIMEOUT	K_SECONDS(60)
+#define CONNECT_TIMEOUT		K_SECONDS(30)
+/*
+ * Well under CONFIG_FOTA_BT_RECONNECT_TIMEOUT, so the device keeps its
+ * session instead of rebooting.
+ */
+#define LINK_DOWN_TIME		K_SECONDS(10)
+#define LINK_UP_TIME		K_SECONDS(5)
+#define RECOVERY_TIMEOUT	K_SECONDS(60)
+
+static K_SEM_DEFINE(found_sem, 0, 1);
+static K_SEM_DEFINE(connected_sem, 0, 1);
+static K_SEM_DEFINE(disconnected_sem, 0, 1);
+
+static bt_addr_le_t device_addr;
+static struct bt_conn *device_conn;
+
+static bool has_ipss(struct bt_data *data, void *user_data)
+{
+	bool *found = user_data;
+	u16_t uuid;
+	int i;
+
+	if (data->type != BT_DATA_UUID16_SOME &&
+	    data->type != BT_DATA_UUID16_ALL) {
+		return true;
+	}
+
+	for (i = 0; i + 1 < data->data_len; i += 2) {
+		uuid = sys_get_le16(&data->data[i]);
+		if (uuid == BT_UUID_IPSS_VAL) {
+			*found = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void scan_cb(const bt_addr_le_t *addr, s8_t rssi, u8_t adv_type,
+		    struct net_buf_simple *ad)
+{
+	bool found = false;
+
+	if (adv_type != BT_LE_ADV_IND) {
+		return;
+	}
+
+	bt_data_parse(ad, has_ipss, &found);
+	if (found) {
+		bt_addr_le_copy(&device_addr, addr);
+		k_sem_give(&found_sem);
+	}
+}
+
+static void connected(struct bt_conn *conn, u8_t err)
+{
+	if (err) {
+		LOG_ERR("Connection failed: %u", err);
+		return;
+	}
+
+	device_conn = bt_conn_ref(conn);
+	k_sem_give(&connected_sem);
+}
+
+static void disconnected(struct bt_conn *conn, u8_t reason)
+{
+	if (conn != device_conn) {
+		return;
+	}
+
+	bt_conn_unref(device_conn);
+	device_conn = NULL;
+	k_sem_give(&disconnected_sem);
+}
+
+static struct bt_conn_cb conn_callbacks = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+/* Find the advertising device and open the IPSP channel to it */
+static int connect_device(void)
+{
+	struct net_if *iface = net_if_get_default();
+	int ret;
+
+	k_sem_reset(&found_sem);
+	k_sem_reset(&connected_sem);
+
+	ret = bt_le_scan_start(BT_LE_SCAN_ACTIVE, scan_cb);
+	if (ret) {
+		LOG_ERR("Cannot scan: %d", ret);
+		return ret;
+	}
+
+	ret = k_sem_take(&found_sem, CONNECT_TIMEOUT);
+	bt_le_scan_stop();
+	if (ret) {
+		LOG_ERR("Device not found");
+		return ret;
+	}
+
+	ret = net_mgmt(NET_REQUEST_BT_CONNECT, iface, &device_addr,
+		       sizeof(device_addr));
+	if (ret) {
+		LOG_ERR("Cannot connect: %d", ret);
+		return ret;
+	}
+
+	ret = k_sem_take(&connected_sem, CONNECT_TIMEOUT);
+	if (ret) {
+		LOG_ERR("Device did not connect");
+	}
+
+	return ret;
+}
+
+/*
+ * A Registration Update means the session survived, a new Register that
+ * it had to start over. Either way the device is back.
+ */
+static int wait_registered_again(const char **how)
+{
+	s64_t start = k_uptime_get();
+	u32_t at;
+
+	while (k_uptime_get() - start < RECOVERY_TIMEOUT) {
+		if (!perf_server_wait_update(K_MSEC(100), &at)) {
+			*how = "Registration Update";
+			return 0;
+		}
+
+		if (!perf_server_wait_registered(K_NO_WAIT, &at)) {
+			*how = "Register";
+			return 0;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int run(void)
+{
+	struct in6_addr addr;
+	const char *how;
+	u32_t at;
+	s64_t start;
+	int ret, i;
+
+	net_addr_pton(AF_INET6, CENTRAL_ADDR, &addr);
+	if (!net_if_ipv6_addr_add(net_if_get_default(), &addr,
+				  NET_ADDR_MANUAL, 0)) {
+		LOG_ERR("Cannot add %s", CENTRAL_ADDR);
+		return -ENOMEM;
+	}
+
+	ret = perf_server_start();
+	if (ret) {
+		LOG_ERR("Cannot start the LwM2M server: %d", ret);
+		return ret;
+	}
+
+	ret = connect_device();
+	if (ret) {
+		return ret;
+	}
+
+	if (perf_server_wait_registered(REGISTRATION_TIMEOUT, &at)) {
+		LOG_ERR("Device did not register");
+		return -ETIMEDOUT;
+	}
+
+	LOG_INF("Device registered");
+
+	for (i = 1; i <= RECONNECT_LOOPS; i++) {
+		k_sleep(LINK_UP_TIME);
+
+		k_sem_reset(&disconnected_sem);
+		ret = bt_conn_disconnect(device_conn,
+					 BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		if (ret || k_sem_take(&disconnected_sem, CONNECT_TIMEOUT)) {
+			LOG_ERR("Loop %d: cannot drop the link: %d", i, ret);
+			return -EIO;
+		}
+
+		LOG_INF("Loop %d: link dropped", i);
+		k_sleep(LINK_DOWN_TIME);
+
+		/* Only what the device sends once reconnected counts */
+		perf_server_wait_update(K_NO_WAIT, &at);
+		perf_server_wait_registered(K_NO_WAIT, &at);
+
+		start = k_uptime_get();
+		ret = connect_device();
+		if (ret) {
+			return ret;
+		}
+
+		ret = wait_registered_again(&how);
+		if (ret) {
+			LOG_ERR("Loop %d: device did not register again", i);
+			return ret;
+		}
+
+		LOG_INF("Loop %d: %s %u ms after reconnecting", i, how,
+			(u32_t)(k_uptime_get() - start));
+	}
+
+	return 0;
+}
+
+void main(void)
+{
+	int ret;
+
+	bt_conn_cb_register(&conn_callbacks);
+
+	ret = bt_enable(NULL);
+	if (ret) {
+		LOG_ERR("Bluetooth init failed: %d", ret);
+	} else {
+		ret = run();
+	}
+
+	LOG_INF("Reconnect test %s", ret ? "FAILED" : "PASSED");
+	LOG_PANIC();
+	posix_exit(ret ? 1 : 0);
+}
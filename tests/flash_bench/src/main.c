@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+#include <flash.h>
+#include <flash_map.h>
+
+/* Application under test */
+#include "fw_writer.h"
+
+#define FW_SLOT_ID		DT_FLASH_AREA_IMAGE_1_ID
+#define BENCH_IMAGE_SIZE	(64 * 1024)
+
+#if defined(CONFIG_FOTA_DEVICE_SOC_SERIES_KINETIS_K6X)
+#define SOC_SERIES		"kinetis_k6x"
+#elif defined(CONFIG_FOTA_DEVICE_SOC_SERIES_NRF52X)
+#define SOC_SERIES		"nrf52x"
+#else
+#define SOC_SERIES		CONFIG_SOC
+#endif
+
+enum write_mode {
+	/* fw_writer_write() from the caller's buffer: one copy per block */
+	WRITE_BUFFERED,
+	/* Blocks received into fw_writer_get_buf(), as lwm2m.c does */
+	WRITE_IN_PLACE,
+	/* Every block programmed as it comes, without the page buffer */
+	WRITE_DIRECT,
+};
+
+enum erase_mode {
+	/* Each sector just before it is first written */
+	ERASE_PROGRESSIVE,
+	/* The whole image before the first block */
+	ERASE_UP_FRONT,
+};
+
+static const char * const write_names[] = {
+	[WRITE_BUFFERED] = "buffered",
+	[WRITE_IN_PLACE] = "in-place",
+	[WRITE_DIRECT] = "direct",
+};
+
+static const char * const erase_names[] = {
+	[ERASE_PROGRESSIVE] = "progressive",
+	[ERASE_UP_FRONT] = "up-front",
+};
+
+static const size_t block_sizes[] = { 64, 128, 256, 512, 1024 };
+
+/* Times of one run, in microseconds */
+struct bench_result {
+	/* Start, and erase when done up front */
+	u32_t setup_us;
+	/* Setup, and every write call */
+	u32_t total_us;
+	/* Longest single write call */
+	u32_t call_max_us;
+	u32_t erase_us;
+	u32_t program_us;
+};
+
+static struct device *flash_dev;
+static u8_t block[1024] __aligned(4);
+static u8_t check[256];
+
+static u32_t us_since(u32_t start)
+{
+	return (u32_t)(SYS_CLOCK_HW_CYCLES_TO_NS64(k_cycle_get_32() - start) /
+		       NSEC_PER_USEC);
+}
+
+/* Differs from one block, and from one run, to the next */
+static void fill(u8_t *buf, size_t offset, size_t len, u8_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = (u8_t)((offset + i) * 7 + ((offset + i) >> 8) + seed);
+	}
+}
+
+static void verify(u8_t seed)
+{
+	const struct flash_area *fa;
+	u8_t expected[sizeof(check)];
+	size_t offset;
+
+	zassert_equal(flash_area_open(FW_SLOT_ID, &fa), 0,
+		      "Cannot open the image slot");
+
+	for (offset = 0; offset < BENCH_IMAGE_SIZE; offset += sizeof(check)) {
+		zassert_equal(flash_area_read(fa, offset, check,
+					      sizeof(check)), 0,
+			      "Cannot read the image slot at %zu", offset);
+		fill(expected, offset, sizeof(expected), seed);
+		zassert_mem_equal(check, expected, sizeof(check),
+				  "Image slot content differs at %zu", offset);
+	}
+
+	flash_area_close(fa);
+}
+
+/* Same sector by sector erase as fw_writer.c, for direct writes */
+static int direct_erase_up_to(const struct flash_area *fa, off_t *erased,
+			      off_t end, struct bench_result *result)
+{
+	struct flash_pages_info page;
+	u32_t cycles;
+	off_t start;
+	int ret;
+
+	while (*erased < end) {
+		ret = flash_get_page_info_by_offs(flash_dev,
+						  fa->fa_off + *erased, &page);
+		if (ret) {
+			return ret;
+		}
+
+		start = page.start_offset - fa->fa_off;
+		cycles = k_cycle_get_32();
+		ret = flash_area_erase(fa, start, page.size);
+		result->erase_us += us_since(cycles);
+		if (ret) {
+			return ret;
+		}
+
+		*erased = start + page.size;
+	}
+
+	return 0;
+}
+
+static void run_direct(enum erase_mode erase, size_t block_size, u8_t seed,
+		       struct bench_result *result)
+{
+	const struct flash_area *fa;
+	u32_t cycles, program, us;
+	off_t erased = 0;
+	size_t offset;
+	int ret;
+
+	zassert_equal(flash_area_open(FW_SLOT_ID, &fa), 0,
+		      "Cannot open the image slot");
+
+	if (erase == ERASE_UP_FRONT) {
+		cycles = k_cycle_get_32();
+		ret = direct_erase_up_to(fa, &erased, BENCH_IMAGE_SIZE,
+					 result);
+		result->setup_us = us_since(cycles);
+		zassert_equal(ret, 0, "Erase failed: %d", ret);
+	}
+
+	for (offset = 0; offset < BENCH_IMAGE_SIZE; offset += block_size) {
+		fill(block, offset, block_size, seed);
+
+		cycles = k_cycle_get_32();
+		ret = direct_erase_up_to(fa, &erased, offset + block_size,
+					 result);
+		if (!ret) {
+			program = k_cycle_get_32();
+			ret = flash_area_write(fa, offset, block, block_size);
+			result->program_us += us_since(program);
+		}
+		us = us_since(cycles);
+
+		zassert_equal(ret, 0, "Block at %zu failed: %d", offset, ret);
+		result->total_us += us;
+		result->call_max_us = MAX(result->call_max_us, us);
+	}
+
+	flash_area_close(fa);
+}
+
+static void run_writer(enum write_mode write, enum erase_mode erase,
+		       size_t block_size, u8_t seed,
+		       struct bench_result *result)
+{
+	struct fw_writer_stats stats;
+	size_t offset, avail;
+	u32_t cycles, trailer_us, us;
+	u8_t *buf;
+	bool last;
+	int ret;
+
+	cycles = k_cycle_get_32();
+	ret = fw_writer_start(flash_dev);
+	zassert_equal(ret, 0, "Cannot start the image: %d", ret);
+
+	/* Erasing the image trailer is part of every update, not the image */
+	fw_writer_stats_get(&stats);
+	trailer_us = stats.erase_us;
+
+	if (erase == ERASE_UP_FRONT) {
+		ret = fw_writer_erase_ahead(BENCH_IMAGE_SIZE);
+		zassert_equal(ret, 0, "Erase failed: %d", ret);
+	}
+	result->setup_us = us_since(cycles);
+
+	for (offset = 0; offset < BENCH_IMAGE_SIZE; offset += block_size) {
+		last = offset + block_size >= BENCH_IMAGE_SIZE;
+
+		if (write == WRITE_IN_PLACE) {
+			buf = fw_writer_get_buf(&avail);
+			zassert_true(avail >= block_size,
+				     "Only %zu bytes free at %zu", avail,
+				     offset);
+		} else {
+			buf = block;
+		}
+		fill(buf, offset, block_size, seed);
+
+		cycles = k_cycle_get_32();
+		ret = fw_writer_write(buf, block_size, last);
+		us = us_since(cycles);
+
+		zassert_equal(ret, 0, "Block at %zu failed: %d", offset, ret);
+		result->total_us += us;
+		result->call_max_us = MAX(result->call_max_us, us);
+	}
+
+	zassert_equal(fw_writer_bytes_written(), BENCH_IMAGE_SIZE,
+		      "Image not fully written");
+
+	fw_writer_stats_get(&stats);
+	result->erase_us = stats.erase_us - trailer_us;
+	result->program_us = stats.program_us;
+}
+
+static void sweep(enum write_mode write)
+{
+	static u8_t seed;
+	struct bench_result result;
+	enum erase_mode erase;
+	u64_t bps;
+	size_t i;
+
+	for (erase = ERASE_PROGRESSIVE; erase <= ERASE_UP_FRONT; erase++) {
+		for (i = 0; i < ARRAY_SIZE(block_sizes); i++) {
+			memset(&result, 0, sizeof(result));
+			seed++;
+
+			if (write == WRITE_DIRECT) {
+				run_direct(erase, block_sizes[i], seed,
+					   &result);
+			} else {
+				run_writer(write, erase, block_sizes[i], seed,
+					   &result);
+			}
+
+			result.total_us += result.setup_us;
+			bps = (u64_t)BENCH_IMAGE_SIZE * USEC_PER_SEC /
+			      MAX(result.total_us, 1);
+
+			TC_PRINT("FLASH %s %s %s %4zu B: %u.%03u MB/s, "
+				 "max call %u us, setup %u us, "
+				 "erase %u us, program %u us\n",
+				 SOC_SERIES, write_names[write],
+				 erase_names[erase], block_sizes[i],
+				 (u32_t)(bps / 1000000),
+				 (u32_t)(bps / 1000 % 1000),
+				 result.call_max_us, result.setup_us,
+				 result.erase_us, result.program_us);
+
+			verify(seed);
+		}
+	}
+}
+
+/* Runs before each test, so any of them can run alone */
+static void bench_setup(void)
+{
+	static bool printed;
+	const struct flash_area *fa;
+
+	flash_dev = device_get_binding(DT_FLASH_DEV_NAME);
+	zassert_not_null(flash_dev, "No flash device");
+
+	zassert_equal(flash_area_open(FW_SLOT_ID, &fa), 0,
+		      "Cannot open the image slot");
+	zassert_true(fa->fa_size >= BENCH_IMAGE_SIZE,
+		     "Image slot smaller than %u bytes", BENCH_IMAGE_SIZE);
+	flash_area_close(fa);
+
+	if (printed) {
+		return;
+	}
+
+	printed = true;
+	TC_PRINT("FLASH %s: %u byte image, %u byte page buffer\n",
+		 SOC_SERIES, BENCH_IMAGE_SIZE, CONFIG_FOTA_FW_WRITE_BUF_SIZE);
+}
+
+static void test_buffered(void)
+{
+	sweep(WRITE_BUFFERED);
+}
+
+static void test_in_place(void)
+{
+	sweep(WRITE_IN_PLACE);
+}
+
+static void test_direct(void)
+{
+	sweep(WRITE_DIRECT);
+}
+
+void test_main(void)
+{
+	ztest_test_suite(fota_flash_bench,
+			 ztest_unit_test_setup_teardown(test_buffered,
+							bench_setup,
+							unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_in_place,
+							bench_setup,
+							unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_direct,
+							bench_setup,
+							unit_test_noop));
+
+	ztest_run_test_suite(fota_flash_bench);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_PERF_BASELINES_H__
+#define FOTA_PERF_BASELINES_H__
+
+/*
+ * Reference results on native_posix. Time there is simulated: the
+ * network and CPU take no time, so the figures only move when timers,
+ * sleeps or the simulated flash timings (see tests/bench.conf) change,
+ * and the tolerances can be tight.
+ *
+ * A baseline of PERF_BASELINE_NONE has not been recorded yet, and its
+ * test fails. To record or update baselines, run the fota.perf.record
+ * variant, which only prints the values:
+ *
+ *     sanitycheck -p native_posix -T tests/perf
+ *
+ * on an unloaded host, copy each value from its test's "PERF" line
+ * here, and note the commit it was measured on in the commit message.
+ * Never enter values that were not measured this way.
+ */
+#define PERF_BASELINE_NONE		0
+
+/* From app_init() to the Registration being answered, in ms */
+#define PERF_BASELINE_REGISTRATION_MS	PERF_BASELINE_NONE
+
+/* From lwm2m_rd_client_update() to the update being answered, in ms */
+#define PERF_BASELINE_UPDATE_MS		PERF_BASELINE_NONE
+
+/* Average time to read a Device object resource, in microseconds */
+#define PERF_BASELINE_READ_US		PERF_BASELINE_NONE
+
+/* Block-wise firmware Write to the image slot, in bytes per second */
+#define PERF_BASELINE_FOTA_BPS		PERF_BASELINE_NONE
+
+/* Slack allowed past a baseline before the suite fails */
+#define PERF_TOLERANCE_PCT		10
+#define PERF_TOLERANCE_MIN_MS		10
+
+#endif	/* FOTA_PERF_BASELINES_H__ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+#include <flash_map.h>
+#include <net/lwm2m.h>
+#include <net/coap.h>
+
+/* Application under test */
+#include "app.h"
+#include "app_work_queue.h"
+#include "fw_writer.h"
+
+#include "baselines.h"
+#include "server.h"
+
+#define REGISTRATION_TIMEOUT	K_SECONDS(30)
+#define UPDATE_TIMEOUT		K_SECONDS(10)
+#define REQUEST_TIMEOUT		K_SECONDS(5)
+
+#define READ_COUNT		20
+#define READ_PATH		"3/0/0"
+
+#define FOTA_IMAGE_SIZE		(64 * 1024)
+#define FOTA_PATH		"5/0/0"
+
+/* Built with -DPERF_RECORD=1 to print values without baselines */
+#if defined(PERF_RECORD)
+#define RECORDING		1
+#else
+#define RECORDING		0
+#endif
+
+#define APP_WQ_STACK_SIZE	4096
+#define APP_WQ_PRIORITY		K_PRIO_PREEMPT(7)
+
+static K_THREAD_STACK_DEFINE(app_wq_stack, APP_WQ_STACK_SIZE);
+static struct k_thread app_wq_thread;
+
+static bool app_started;
+/* Time to the first registration, 0 until the client has registered */
+static u32_t registration_ms;
+
+/*
+ * Start the application the way main() does and wait for it to
+ * register, once for the whole suite. Every test runs with this as its
+ * setup, so each can run on its own, in any order.
+ */
+static void registered_setup(void)
+{
+	u32_t start, registered_at;
+
+	if (app_started) {
+		zassert_true(registration_ms, "Client did not register");
+		return;
+	}
+
+	app_started = true;
+	zassert_equal(perf_server_start(), 0,
+		      "Cannot start the LwM2M server");
+
+	start = k_uptime_get_32();
+	zassert_equal(app_init(false), 0, "app_init failed");
+	k_thread_create(&app_wq_thread, app_wq_stack,
+			K_THREAD_STACK_SIZEOF(app_wq_stack),
+			(k_thread_entry_t)app_wq_run, NULL, NULL, NULL,
+			APP_WQ_PRIORITY, 0, K_NO_WAIT);
+
+	zassert_equal(perf_server_wait_registered(REGISTRATION_TIMEOUT,
+						  &registered_at), 0,
+		      "Client did not register");
+	registration_ms = MAX(registered_at - start, 1);
+}
+
+/*
+ * Fail if a latency is worse than its baseline, past the tolerance.
+ * Without a recorded baseline, fail unless recording.
+ */
+static void check_latency(const char *name, u32_t value, u32_t baseline,
+			  const char *unit, u32_t min_slack)
+{
+	u32_t limit = baseline + MAX(baseline * PERF_TOLERANCE_PCT / 100,
+				     min_slack);
+
+	if (baseline == PERF_BASELINE_NONE) {
+		TC_PRINT("PERF %s %u %s (no baseline)\n", name, value, unit);
+		zassert_true(RECORDING, "No baseline for %s, see baselines.h",
+			     name);
+		return;
+	}
+
+	TC_PRINT("PERF %s %u %s (baseline %u %s)\n", name, value, unit,
+		 baseline, unit);
+	zassert_true(value <= limit, "%s regressed: %u %s, limit %u %s",
+		     name, value, unit, limit, unit);
+}
+
+static void check_throughput(const char *name, u32_t value, u32_t baseline)
+{
+	u32_t limit = baseline - baseline * PERF_TOLERANCE_PCT / 100;
+
+	if (baseline == PERF_BASELINE_NONE) {
+		TC_PRINT("PERF %s %u B/s (no baseline)\n", name, value);
+		zassert_true(RECORDING, "No baseline for %s, see baselines.h",
+			     name);
+		return;
+	}
+
+	TC_PRINT("PERF %s %u B/s (baseline %u B/s)\n", name, value,
+		 baseline);
+	zassert_true(value >= limit, "%s regressed: %u B/s, limit %u B/s",
+		     name, value, limit);
+}
+
+static void test_registration(void)
+{
+	check_latency("registration", registration_ms,
+		      PERF_BASELINE_REGISTRATION_MS, "ms",
+		      PERF_TOLERANCE_MIN_MS);
+}
+
+static void test_update(void)
+{
+	u32_t start, updated_at;
+
+	start = k_uptime_get_32();
+	lwm2m_rd_client_update();
+
+	zassert_equal(perf_server_wait_update(UPDATE_TIMEOUT, &updated_at), 0,
+		      "Client did not update its registration");
+	check_latency("update", updated_at - start, PERF_BASELINE_UPDATE_MS,
+		      "ms", PERF_TOLERANCE_MIN_MS);
+}
+
+static void test_read(void)
+{
+	u8_t buf[32];
+	u32_t start;
+	u64_t total = 0;
+	size_t len;
+	int i, ret;
+
+	/* Reads are quick: time them in cycles, not uptime ticks */
+	for (i = 0; i < READ_COUNT; i++) {
+		len = sizeof(buf);
+		start = k_cycle_get_32();
+		ret = perf_server_read(READ_PATH, buf, &len, REQUEST_TIMEOUT);
+		total += k_cycle_get_32() - start;
+
+		zassert_equal(ret, COAP_RESPONSE_CODE_CONTENT,
+			      "Read of %s failed: %d", READ_PATH, ret);
+		zassert_true(len > 0, "Empty read of %s", READ_PATH);
+	}
+
+	check_latency("read",
+		      (u32_t)(SYS_CLOCK_HW_CYCLES_TO_NS64(total) /
+			      NSEC_PER_USEC / READ_COUNT),
+		      PERF_BASELINE_READ_US, "us",
+		      PERF_TOLERANCE_MIN_MS * USEC_PER_MSEC);
+}
+
+static void test_fota(void)
+{
+	static u8_t block[CONFIG_LWM2M_COAP_BLOCK_SIZE];
+	const struct flash_area *fa;
+	u8_t check[sizeof(block)];
+	u32_t start, elapsed;
+	size_t offset, len;
+	int ret;
+
+	start = k_uptime_get_32();
+
+	for (offset = 0; offset < FOTA_IMAGE_SIZE; offset += len) {
+		len = MIN(sizeof(block), FOTA_IMAGE_SIZE - offset);
+		memset(block, offset / sizeof(block), len);
+
+		ret = perf_server_write_block(FOTA_PATH, block, len, offset,
+					      FOTA_IMAGE_SIZE,
+					      REQUEST_TIMEOUT);
+		zassert_equal(ret, offset + len < FOTA_IMAGE_SIZE ?
+			      COAP_RESPONSE_CODE_CONTINUE :
+			      COAP_RESPONSE_CODE_CHANGED,
+			      "Block at %zu failed: %d", offset, ret);
+	}
+
+	elapsed = MAX(k_uptime_get_32() - start, 1);
+
+	zassert_equal(fw_writer_bytes_written(), FOTA_IMAGE_SIZE,
+		      "Image not fully written");
+
+	/* Spot check the last block made it to the slot */
+	offset = FOTA_IMAGE_SIZE - sizeof(block);
+	zassert_equal(flash_area_open(DT_FLASH_AREA_IMAGE_1_ID, &fa), 0,
+		      "Cannot open the image slot");
+	zassert_equal(flash_area_read(fa, offset, check, sizeof(check)), 0,
+		      "Cannot read the image slot");
+	flash_area_close(fa);
+	memset(block, offset / sizeof(block), sizeof(block));
+	zassert_mem_equal(check, block, sizeof(block),
+			  "Image slot content differs");
+
+	check_throughput("fota", (u64_t)FOTA_IMAGE_SIZE * MSEC_PER_SEC /
+			 elapsed, PERF_BASELINE_FOTA_BPS);
+}
+
+void test_main(void)
+{
+	ztest_test_suite(fota_perf,
+			 ztest_unit_test_setup_teardown(test_registration,
+							registered_setup,
+							unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_update,
+							registered_setup,
+							unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_read,
+							registered_setup,
+							unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_fota,
+							registered_setup,
+							unit_test_noop));
+
+	ztest_run_test_suite(fota_perf);
+}
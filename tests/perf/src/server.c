@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_MODULE_NAME perf_server
+#define LOG_LEVEL LOG_LEVEL_INF
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#include <zephyr.h>
+#include <string.h>
+#include <net/socket.h>
+#include <net/coap.h>
+
+#include "server.h"
+
+#if defined(CONFIG_LWM2M_COAP_BLOCK_SIZE)
+#define BLOCK_SIZE		CONFIG_LWM2M_COAP_BLOCK_SIZE
+#else
+/* Images without the LwM2M client, such as the BabbleSim central */
+#define BLOCK_SIZE		256
+#endif
+
+#define SERVER_PORT		5683
+#define MAX_COAP_MSG_LEN	(BLOCK_SIZE + 128)
+#define MAX_OPTIONS		16
+#define MAX_TOKEN_LEN		8
+
+/* Registration location handed to the client: "/rd/0" */
+#define RD_PATH			"rd"
+#define RD_LOCATION		"0"
+
+/* LwM2M opaque content format */
+#define FORMAT_OCTET_STREAM	42
+
+#define SERVER_STACK_SIZE	2048
+#define SERVER_PRIORITY		K_PRIO_PREEMPT(8)
+
+static K_THREAD_STACK_DEFINE(server_stack, SERVER_STACK_SIZE);
+static struct k_thread server_thread;
+
+static int sock = -1;
+static struct sockaddr client_addr;
+static socklen_t client_addrlen;
+static bool registered;
+
+static K_SEM_DEFINE(registered_sem, 0, 1);
+static K_SEM_DEFINE(update_sem, 0, 1);
+static u32_t registered_at;
+static u32_t updated_at;
+
+/* The one request in flight from the tests to the client */
+static K_MUTEX_DEFINE(request_lock);
+static K_SEM_DEFINE(response_sem, 0, 1);
+static struct {
+	u8_t token[MAX_TOKEN_LEN];
+	u8_t tkl;
+	u8_t *buf;
+	size_t len;
+	int code;
+} pending;
+
+static void send_reply(const struct coap_packet *req, u8_t type, u8_t code,
+		       bool location, const struct sockaddr *addr,
+		       socklen_t addrlen)
+{
+	struct coap_packet reply;
+	u8_t token[MAX_TOKEN_LEN];
+	u8_t data[64];
+	u8_t tkl;
+	int ret;
+
+	tkl = type == COAP_TYPE_RESET ? 0 : coap_header_get_token(req, token);
+	ret = coap_packet_init(&reply, data, sizeof(data), 1, type, tkl, token,
+			       code, coap_header_get_id(req));
+	if (!ret && location) {
+		ret = coap_packet_append_option(&reply,
+						COAP_OPTION_LOCATION_PATH,
+						RD_PATH, strlen(RD_PATH));
+	}
+
+	if (!ret && location) {
+		ret = coap_packet_append_option(&reply,
+						COAP_OPTION_LOCATION_PATH,
+						RD_LOCATION,
+						strlen(RD_LOCATION));
+	}
+
+	if (ret) {
+		LOG_ERR("Cannot build reply: %d", ret);
+		return;
+	}
+
+	zsock_sendto(sock, reply.data, reply.offset, 0, addr, addrlen);
+}
+
+static bool path_is(struct coap_option *options, int count,
+		    const char *first, const char *second)
+{
+	if (count != (second ? 2 : 1)) {
+		return false;
+	}
+
+	if (options[0].len != strlen(first) ||
+	    memcmp(options[0].value, first, options[0].len)) {
+		return false;
+	}
+
+	return !second || (options[1].len == strlen(second) &&
+			   !memcmp(options[1].value, second, options[1].len));
+}
+
+static void handle_request(const struct coap_packet *req,
+			   const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct coap_option options[MAX_OPTIONS];
+	u8_t type = coap_header_get_type(req) == COAP_TYPE_CON ?
+		COAP_TYPE_ACK : COAP_TYPE_NON_CON;
+	u8_t code = coap_header_get_code(req);
+	int count;
+
+	count = coap_find_options(req, COAP_OPTION_URI_PATH, options,
+				  ARRAY_SIZE(options));
+
+	if (code == COAP_METHOD_POST && path_is(options, count, RD_PATH,
+						NULL)) {
+		memcpy(&client_addr, addr, addrlen);
+		client_addrlen = addrlen;
+		registered = true;
+		send_reply(req, type, COAP_RESPONSE_CODE_CREATED, true, addr,
+			   addrlen);
+		registered_at = k_uptime_get_32();
+		k_sem_give(&registered_sem);
+	} else if (code == COAP_METHOD_POST &&
+		   path_is(options, count, RD_PATH, RD_LOCATION)) {
+		send_reply(req, type, COAP_RESPONSE_CODE_CHANGED, false, addr,
+			   addrlen);
+		updated_at = k_uptime_get_32();
+		k_sem_give(&update_sem);
+	} else if (code == COAP_METHOD_DELETE &&
+		   path_is(options, count, RD_PATH, RD_LOCATION)) {
+		registered = false;
+		send_reply(req, type, COAP_RESPONSE_CODE_DELETED, false, addr,
+			   addrlen);
+	} else {
+		send_reply(req, type, COAP_RESPONSE_CODE_NOT_FOUND, false,
+			   addr, addrlen);
+	}
+}
+
+static void handle_response(const struct coap_packet *rsp,
+			    const struct sockaddr *addr, socklen_t addrlen)
+{
+	u8_t token[MAX_TOKEN_LEN];
+	const u8_t *payload;
+	u16_t payload_len;
+	u8_t tkl;
+
+	/* Separate responses must be acknowledged */
+	if (coap_header_get_type(rsp) == COAP_TYPE_CON) {
+		send_reply(rsp, COAP_TYPE_ACK, COAP_CODE_EMPTY, false, addr,
+			   addrlen);
+	}
+
+	tkl = coap_header_get_token(rsp, token);
+	if (!pending.tkl || tkl != pending.tkl ||
+	    memcmp(token, pending.token, tkl)) {
+		return;
+	}
+
+	payload = coap_packet_get_payload(rsp, &payload_len);
+	if (pending.buf) {
+		pending.len = MIN(pending.len, payload_len);
+		memcpy(pending.buf, payload, pending.len);
+	}
+
+	pending.code = coap_header_get_code(rsp);
+	pending.tkl = 0;
+	k_sem_give(&response_sem);
+}
+
+static void server_run(void *p1, void *p2, void *p3)
+{
+	static u8_t data[MAX_COAP_MSG_LEN];
+	struct coap_option options[MAX_OPTIONS];
+	struct coap_packet cpkt;
+	struct sockaddr addr;
+	socklen_t addrlen;
+	u8_t type, code;
+	int len;
+
+	while (true) {
+		addrlen = sizeof(addr);
+		len = zsock_recvfrom(sock, data, sizeof(data), 0, &addr,
+				     &addrlen);
+		if (len < 0) {
+			LOG_ERR("recvfrom failed: %d", errno);
+			continue;
+		}
+
+		if (coap_packet_parse(&cpkt, data, len, options,
+				      ARRAY_SIZE(options))) {
+			LOG_WRN("Dropping invalid CoAP message");
+			continue;
+		}
+
+		type = coap_header_get_type(&cpkt);
+		code = coap_header_get_code(&cpkt);
+
+		if (code == COAP_CODE_EMPTY) {
+			/* CoAP ping, as sent by the server health checks */
+			if (type == COAP_TYPE_CON) {
+				send_reply(&cpkt, COAP_TYPE_RESET,
+					   COAP_CODE_EMPTY, false, &addr,
+					   addrlen);
+			}
+		} else if (code < COAP_RESPONSE_CODE_OK) {
+			handle_request(&cpkt, &addr, addrlen);
+		} else {
+			handle_response(&cpkt, &addr, addrlen);
+		}
+	}
+}
+
+int perf_server_start(void)
+{
+#if defined(CONFIG_NET_IPV4)
+	struct sockaddr_in bind_addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(SERVER_PORT),
+		.sin_addr = INADDR_ANY_INIT,
+	};
+#else
+	struct sockaddr_in6 bind_addr = {
+		.sin6_family = AF_INET6,
+		.sin6_port = htons(SERVER_PORT),
+		.sin6_addr = IN6ADDR_ANY_INIT,
+	};
+#endif
+	int ret;
+
+	sock = zsock_socket(((struct sockaddr *)&bind_addr)->sa_family,
+			    SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		return -errno;
+	}
+
+	ret = zsock_bind(sock, (struct sockaddr *)&bind_addr,
+			 sizeof(bind_addr));
+	if (ret < 0) {
+		ret = -errno;
+		zsock_close(sock);
+		return ret;
+	}
+
+	k_thread_create(&server_thread, server_stack,
+			K_THREAD_STACK_SIZEOF(server_stack), server_run,
+			NULL, NULL, NULL, SERVER_PRIORITY, 0, K_NO_WAIT);
+
+	return 0;
+}
+
+int perf_server_wait_registered(s32_t timeout, u32_t *at)
+{
+	if (k_sem_take(&registered_sem, timeout)) {
+		return -EAGAIN;
+	}
+
+	*at = registered_at;
+
+	return 0;
+}
+
+int perf_server_wait_update(s32_t timeout, u32_t *at)
+{
+	if (k_sem_take(&update_sem, timeout)) {
+		return -EAGAIN;
+	}
+
+	*at = updated_at;
+
+	return 0;
+}
+
+static int append_path(struct coap_packet *cpkt, const char *path)
+{
+	const char *end;
+	int ret;
+
+	while (*path) {
+		end = strchr(path, '/');
+		if (!end) {
+			end = path + strlen(path);
+		}
+
+		ret = coap_packet_append_option(cpkt, COAP_OPTION_URI_PATH,
+						path, end - path);
+		if (ret) {
+			return ret;
+		}
+
+		path = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+static int request(u8_t method, const char *path,
+		   struct coap_block_context *block,
+		   const u8_t *payload, size_t payload_len,
+		   u8_t *buf, size_t *len, s32_t timeout)
+{
+	static u8_t data[MAX_COAP_MSG_LEN];
+	struct coap_packet cpkt;
+	int ret;
+
+	if (!registered) {
+		return -ENOTCONN;
+	}
+
+	k_mutex_lock(&request_lock, K_FOREVER);
+
+	ret = coap_packet_init(&cpkt, data, sizeof(data), 1, COAP_TYPE_CON,
+			       MAX_TOKEN_LEN, coap_next_token(), method,
+			       coap_next_id());
+	if (!ret) {
+		ret = append_path(&cpkt, path);
+	}
+
+	if (!ret && payload) {
+		ret = coap_append_option_int(&cpkt, COAP_OPTION_CONTENT_FORMAT,
+					     FORMAT_OCTET_STREAM);
+	}
+
+	if (!ret && block) {
+		ret = coap_append_block1_option(&cpkt, block);
+	}
+
+	if (!ret && block) {
+		ret = coap_append_size1_option(&cpkt, block);
+	}
+
+	if (!ret && payload) {
+		ret = coap_packet_append_payload_marker(&cpkt);
+	}
+
+	if (!ret && payload) {
+		ret = coap_packet_append_payload(&cpkt, (u8_t *)payload,
+						 payload_len);
+	}
+
+	if (ret) {
+		goto out;
+	}
+
+	k_sem_reset(&response_sem);
+	pending.tkl = coap_header_get_token(&cpkt, pending.token);
+	pending.buf = buf;
+	pending.len = len ? *len : 0;
+
+	ret = zsock_sendto(sock, cpkt.data, cpkt.offset, 0, &client_addr,
+			   client_addrlen);
+	if (ret < 0) {
+		ret = -errno;
+		pending.tkl = 0;
+		goto out;
+	}
+
+	if (k_sem_take(&response_sem, timeout)) {
+		pending.tkl = 0;
+		ret = -ETIMEDOUT;
+		goto out;
+	}
+
+	if (len) {
+		*len = pending.len;
+	}
+
+	ret = pending.code;
+
+out:
+	k_mutex_unlock(&request_lock);
+
+	return ret;
+}
+
+int perf_server_read(const char *path, u8_t *buf, size_t *len,
+		     s32_t timeout)
+{
+	return request(COAP_METHOD_GET, path, NULL, NULL, 0, buf, len,
+		       timeout);
+}
+
+int perf_server_write_block(const char *path, const u8_t *data, size_t len,
+			    size_t offset, size_t total, s32_t timeout)
+{
+	struct coap_block_context block;
+	/* SZX: 16 byte blocks are 0, each next size doubles */
+	enum coap_block_size szx =
+		find_msb_set(BLOCK_SIZE) - 5;
+
+	coap_block_transfer_init(&block, szx, total);
+	block.current = offset;
+
+	return request(COAP_METHOD_PUT, path, &block, data, len, NULL, NULL,
+		       timeout);
+}
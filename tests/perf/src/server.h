@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Foundries.io
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FOTA_PERF_SERVER_H__
+#define FOTA_PERF_SERVER_H__
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+
+/**
+ * @file
+ * @brief Minimal LwM2M server stand-in
+ *
+ * Just enough of an LwM2M server to time or exercise the application,
+ * over loopback in the same image or from the BabbleSim central over
+ * IPv6: it accepts Registrations and Registration Updates, answers
+ * CoAP pings, and lets tests send Read and block-wise Write requests to
+ * the registered client. No DTLS, no retransmissions.
+ */
+
+/**
+ * @brief Bind the server to the LwM2M port and start its thread.
+ */
+int perf_server_start(void);
+
+/**
+ * @brief Wait for the client to register.
+ *
+ * @param at Set to the uptime, in milliseconds, the Registration was
+ *        answered at.
+ * @return 0 on success, -EAGAIN on timeout.
+ */
+int perf_server_wait_registered(s32_t timeout, u32_t *at);
+
+/**
+ * @brief Wait for the next Registration Update.
+ *
+ * @param at Set to the uptime, in milliseconds, the update was
+ *        answered at.
+ * @return 0 on success, -EAGAIN on timeout.
+ */
+int perf_server_wait_update(s32_t timeout, u32_t *at);
+
+/**
+ * @brief Read a resource of the registered client.
+ *
+ * @param path Resource path, e.g. "3/0/0".
+ * @param buf Buffer for the response payload.
+ * @param len In: size of @a buf, out: payload length.
+ * @return CoAP response code, or negative errno.
+ */
+int perf_server_read(const char *path, u8_t *buf, size_t *len,
+		     s32_t timeout);
+
+/**
+ * @brief Write one block of a block-wise (Block1) opaque Write.
+ *
+ * @param offset Offset of the block in the whole payload; must be a
+ *        multiple of the block size, CONFIG_LWM2M_COAP_BLOCK_SIZE in
+ *        images with the LwM2M client.
+ * @param total Size of the whole payload.
+ * @return CoAP response code, or negative errno.
+ */
+int perf_server_write_block(const char *path, const u8_t *data, size_t len,
+			    size_t offset, size_t total, s32_t timeout);
+
+#endif	/* FOTA_PERF_SERVER_H__ */
@@ -0,0 +1,28 @@
+# Configuration shared by the test apps in this directory, which build
+# with the application's Kconfig options, configuration and board
+# support. Include it before Zephyr's boilerplate.cmake; it sets APP_DIR
+# to the application directory.
+
+get_filename_component(APP_DIR ${CMAKE_CURRENT_LIST_DIR}/.. ABSOLUTE)
+set(KCONFIG_ROOT ${APP_DIR}/Kconfig)
+
+# CONF_FILE is the application's prj.conf and boards/${BOARD}.conf, the
+# benchmark settings of bench.conf on native_posix, then the test app's
+# prj.conf and boards/${BOARD}.conf on top.
+set(CONF_FILE ${APP_DIR}/prj.conf)
+if(EXISTS ${APP_DIR}/boards/${BOARD}.conf)
+  set(CONF_FILE ${CONF_FILE} " ${APP_DIR}/boards/${BOARD}.conf")
+endif()
+if(BOARD STREQUAL native_posix)
+  set(CONF_FILE ${CONF_FILE} " ${CMAKE_CURRENT_LIST_DIR}/bench.conf")
+endif()
+set(CONF_FILE ${CONF_FILE} " ${CMAKE_CURRENT_SOURCE_DIR}/prj.conf")
+if(EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/boards/${BOARD}.conf)
+  set(CONF_FILE ${CONF_FILE} " ${CMAKE_CURRENT_SOURCE_DIR}/boards/${BOARD}.conf")
+endif()
+
+if(EXISTS ${APP_DIR}/boards/${BOARD}.overlay)
+  set(DTC_OVERLAY_FILE ${DTC_OVERLAY_FILE} " ${APP_DIR}/boards/${BOARD}.overlay")
+else()
+  message(FATAL_ERROR "Missing board support: ${APP_DIR}/boards/${BOARD}.overlay")
+endif()